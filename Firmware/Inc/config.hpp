@@ -2,17 +2,35 @@
 #include <leakguard/leak_logic.hpp>
 #include <leakguard/staticstring.hpp>
 
+#include <drivers/eeprom.hpp>
+#include <eeprom-queue.hpp>
+
+#include <ArduinoJson.hpp>
+
 #include <array>
+#include <bitset>
 #include <cstdint>
 
+#include <FreeRTOS.h>
+#include <task.h>
+
 namespace lg {
 
+// The config lives in RAM and is stored as a journal of small typed
+// records (one per field, schedule day or probe) in one of two EEPROM
+// areas. A commit appends the changed fields only. A full area is
+// compacted into the other one, which becomes active once its header is
+// written.
 class ConfigService {
 public:
     static constexpr auto CONFIG_PAGES = 64;
     static constexpr auto CURRENT_CONFIG_VERSION = 1;
     static constexpr auto BLOCKADE_ENABLED_FLAG = 1U << 31;
     static constexpr auto MAX_PROBES = 256;
+    static constexpr auto IGNORED_PROBES_PER_RECORD = 4;
+    // Records of the journal: one per scalar field, schedule day, paired
+    // probe and group of ignored flags
+    static constexpr auto RECORD_COUNT = 7 + 7 + MAX_PROBES + MAX_PROBES / IGNORED_PROBES_PER_RECORD;
 
     struct ProbeId {
         std::uint32_t word1, word2, word3;
@@ -53,27 +71,134 @@ public:
 
     using Config = ConfigV1;
 
+    // Values read on hot paths. A snapshot is published with every commit
+    // and can be read without the config lock, so a slow EEPROM write
+    // never stalls its readers.
+    struct Snapshot {
+        std::uint32_t generation; // Commit that published the snapshot
+        std::uint32_t impulsesPerLiter;
+        bool valveTypeNC;
+        std::array<std::uint32_t, 7> weeklySchedule;
+        StaticString<32> adminPassword;
+    };
+
+    static void configWriterEntryPoint(void* params);
+
     ConfigService() = default;
 
     void initialize();
-    Config& getCurrentConfig() { return m_currentConfig; };
     const Config& getCurrentConfig() const { return m_currentConfig; }
     void resetToDefault();
-    bool commit();
+
+    // Changes go through the setters, which mark the records that differ
+    // from the stored config. Only marked records are written on commit.
+    void setWifiSsid(const char* ssid);
+    void setWifiPassword(const char* password);
+    void setImpulsesPerLiter(std::uint32_t impulsesPerLiter);
+    void setValveTypeNC(bool valveTypeNC);
+    void setAdminPassword(const char* password);
+    void setWeeklySchedule(const std::array<std::uint32_t, 7>& weeklySchedule);
+    void setTimezoneId(std::uint32_t timezoneId);
+    void setLeakLogicConfig(const StaticString<64>& leakLogicConfig);
+    void setPairedProbe(std::uint8_t masterAddress, const ProbeId& probeId);
+    void setProbeIgnored(std::uint8_t masterAddress, bool ignored);
+
+    // Queues the current config for writing and returns right away. Commits
+    // made while a write is pending end up in the same write. The returned
+    // generation is stored once getCommittedGeneration() reaches it, a
+    // failed write is retried by the writer.
+    std::uint32_t commit();
+
+    [[nodiscard]] std::uint32_t getCommittedGeneration() const { return m_committedGeneration; }
+    [[nodiscard]] std::uint32_t getFailedGeneration() const { return m_failedGeneration; }
+
+    // Must not be called with the config locked, the writer needs the lock
+    // to copy out the dirty records. Use Device::waitForConfigCommit().
+    bool waitForCommit(std::uint32_t generation, TickType_t timeout) const;
+
+    // Safe without the config lock, use Device::getConfigSnapshot()
+    [[nodiscard]] Snapshot getSnapshot() const;
+
+    void writeDiagnostics(ArduinoJson::JsonObject out) const;
 
 private:
+    // Pages of the two full copies written by older firmware, reused as
+    // the two journal areas
     static constexpr auto FIRST_CONFIG_PAGE = 0;
     static constexpr auto SECOND_CONFIG_PAGE = CONFIG_PAGES;
-
-    bool readConfigFromEeprom();
+    static constexpr auto JOURNAL_AREA_SIZE = CONFIG_PAGES * EepromDriver::EEPROM_PAGE_SIZE_BYTES;
+    static constexpr auto CONFIG_COMMIT_EVENT = 1U << 0;
+    // Commits arriving within this time after the first one share a write
+    static constexpr auto COMMIT_COALESCE_TIME = pdMS_TO_TICKS(20);
+    static constexpr auto COMMIT_POLL_TIME = pdMS_TO_TICKS(5);
+    static constexpr auto COMMIT_RETRY_TIME = pdMS_TO_TICKS(5000);
+    static constexpr auto STAGING_SIZE = 4 * EepromDriver::EEPROM_PAGE_SIZE_BYTES;
+
+    void configWriterMain();
+    void writePendingConfig();
+    bool writeConfig();
+
+    bool loadJournal();
+    std::uint32_t replayJournal(std::uint32_t area, std::uint32_t sequence,
+        std::uint32_t limit, std::uint32_t& committedEnd);
+    // Serializes the dirty records into the staging buffer, false if they
+    // do not fit there or in the active area. Called with the config locked.
+    bool stageChanges(const std::bitset<RECORD_COUNT>& dirtyRecords, std::uint32_t& size);
+    bool appendStaged(std::uint32_t size);
+    bool compactJournal();
+    // Returns the size of the record
+    std::uint32_t buildRecord(std::uint32_t* record, std::uint32_t sequence,
+        std::size_t fieldIndex, std::size_t index, bool lastInCommit);
+    void writeJournalBytes(std::uint16_t address, const std::uint8_t* data, std::size_t size,
+        EepromQueue::Priority priority);
+    static void journalWriteFinished(void* context, bool success);
+    // Waits for the queued journal writes, false if any of them failed
+    bool finishJournalWrites(EepromQueue::Priority priority);
+    [[nodiscard]] static std::uint16_t getAreaAddress(std::uint32_t area);
+
+    template <typename T>
+    void updateElement(std::size_t fieldIndex, std::size_t index, T& element, const T& value);
+
+    void publishSnapshot(std::uint32_t generation);
+
+    static void setDefaults(Config& config);
+    bool readLegacyConfig(std::uint16_t page);
     bool isConfigSupported(std::uint32_t version);
     void migrate();
     static std::uint32_t calculateCrc(Config& config);
-    void copyCurrentToStored();
 
     Config m_currentConfig;
-    Config m_storedConfig;
-    bool m_needFullWrite {};
+    // Records of a commit, copied out under the config lock so the config
+    // stays usable while the EEPROM is written
+    std::array<std::uint32_t, STAGING_SIZE / sizeof(std::uint32_t)> m_stagedRecords {};
+
+    std::uint32_t m_activeArea {};
+    std::uint32_t m_sequence {};
+    std::uint32_t m_journalEnd {}; // End of the last complete commit in the active area
+    std::bitset<RECORD_COUNT> m_dirtyRecords {}; // Changed since they were last written
+    bool m_needCompaction {}; // No valid journal yet
+    volatile bool m_journalWriteFailed {}; // Set from the EEPROM queue task
+    std::uint32_t m_replayTimeMs {};
+    std::uint32_t m_replayedRecords {};
+    std::uint32_t m_compactions {};
+
+    // The writer fills the slot that is not published and then flips the
+    // index. The version of a slot is odd while it is being filled.
+    struct SnapshotSlot {
+        volatile std::uint32_t version;
+        Snapshot snapshot;
+    };
+
+    std::array<SnapshotSlot, 2> m_snapshots {};
+    volatile std::uint32_t m_publishedSnapshot {};
+
+    std::uint32_t m_requestedGeneration {};
+    volatile std::uint32_t m_committedGeneration {};
+    volatile std::uint32_t m_failedGeneration {};
+
+    TaskHandle_t m_configWriterTaskHandle {};
+    StaticTask_t m_configWriterTaskTcb {};
+    std::array<configSTACK_DEPTH_TYPE, 512> m_configWriterTaskStack {};
 };
 
 };
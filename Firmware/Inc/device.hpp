@@ -6,6 +6,8 @@
 #include "drivers/flash.hpp"
 #include "drivers/lora.hpp"
 #include "drivers/oled.hpp"
+#include "eeprom-queue.hpp"
+#include "flash-store.hpp"
 #include "flow-meter.hpp"
 #include "history.hpp"
 #include "lora.hpp"
@@ -63,6 +65,10 @@ public:
     void setError(ErrorCode code);
 
     void updateRtcTime(const UtcTime& newTime);
+    // Blocks until a config commit is stored, the config must not be locked
+    bool waitForConfigCommit(std::uint32_t generation, TickType_t timeout = portMAX_DELAY);
+    // Does not take the config lock
+    ConfigService::Snapshot getConfigSnapshot() const { return m_configService->getSnapshot(); }
     bool setLocalTimezone(const char* timezoneName);
     bool setLocalTimezone(std::uint32_t timezoneId);
     UtcTime getUtcTime(
@@ -71,6 +77,7 @@ public:
         std::uint32_t* subseconds = nullptr, std::uint32_t* secondFraction = nullptr);
     UtcTime getLocalTimeForUtcTimestamp(std::uint32_t timestamp);
     [[nodiscard]] std::uint32_t getLocalUtcOffset();
+    [[nodiscard]] std::uint32_t getLocalTimezoneRevision() const { return m_timezoneRevision; }
     [[nodiscard]] bool isTimeValid() const { return m_timeIsValid; }
     std::uint32_t getMonotonicTimestamp() const;
 
@@ -79,6 +86,7 @@ public:
     void setSignalStrength(SignalStrength strength) { m_signalStrength = strength; }
 
     ScopedResource<EepromDriver> getEepromDriver() { return m_eepromDriver; }
+    EepromQueue& getEepromQueue() { return m_eepromQueue; }
     EspAtDriver& getEspAtDriver() { return m_espDriver; }
     ScopedResource<FlashDriver> getFlashDriver() { return m_flashDriver; }
     ScopedResource<OledDriver> getOledDriver() { return m_oledDriver; }
@@ -86,6 +94,7 @@ public:
     ScopedResource<LoraDriver> getLoraDriver() { return m_loraDriver; }
 
     ScopedResource<CronService> getCronService() { return m_cronService; }
+    ScopedResource<FlashStore> getFlashStore() { return m_flashStore; }
     ScopedResource<ConfigService> getConfigService() { return m_configService; }
     ScopedResource<NetworkManager> getNetworkManager() { return m_networkManager; }
     ScopedResource<Server> getHttpServer() { return m_server; }
@@ -103,6 +112,7 @@ private:
     volatile ErrorCode m_error { ErrorCode::NO_ERROR };
     volatile SignalStrength m_signalStrength { SignalStrength::NO_STRENGTH };
     volatile bool m_timeIsValid {};
+    volatile std::uint32_t m_timezoneRevision {};
 
     mutable std::uint32_t m_monotonicTime {};
     mutable std::uint32_t m_monotonicLastTicks {};
@@ -116,6 +126,7 @@ private:
 
     // Drivers
     ProtectedResource<EepromDriver> m_eepromDriver;
+    EepromQueue m_eepromQueue; // <- this handles multithreading on its own
     EspAtDriver m_espDriver; // <- this handles multithreading on its own
     ProtectedResource<FlashDriver> m_flashDriver;
     ProtectedResource<OledDriver> m_oledDriver;
@@ -124,6 +135,7 @@ private:
 
     // Services
     ProtectedResource<CronService> m_cronService;
+    ProtectedResource<FlashStore> m_flashStore;
     ProtectedResource<ConfigService> m_configService;
     ProtectedResource<NetworkManager> m_networkManager;
     ProtectedResource<Server> m_server;
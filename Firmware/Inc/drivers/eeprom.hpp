@@ -1,9 +1,13 @@
 #pragma once
+#include <cstdint>
+
 #include <FreeRTOS.h>
 #include <task.h>
 
 #include <stm32f7xx_hal.h>
 
+#include <ArduinoJson.hpp>
+
 namespace lg {
 
 class EepromDriver {
@@ -14,6 +18,13 @@ public:
     static constexpr auto EEPROM_SIZE_BYTES = 65536U;
     static constexpr auto EEPROM_PAGE_SIZE_BYTES = 128U;
 
+    struct Stats {
+        std::uint32_t writeCycles;
+        std::uint32_t ackPolls;
+        std::uint32_t busyNacks; // Polls made while the write cycle was still running
+        std::uint32_t waitTimeMs;
+    };
+
     explicit EepromDriver(I2C_HandleTypeDef* i2c, GPIO_TypeDef* wpPort, uint16_t wpPin)
         : m_i2c(i2c)
         , m_wpGpioPort(wpPort)
@@ -53,9 +64,15 @@ public:
     void disableWrites();
     void enableWrites();
 
+    // Shares the "eeprom" section with the queue
+    void writeDiagnostics(ArduinoJson::JsonObject out) const;
+
 private:
     static constexpr auto I2C_TX = (1 << 1);
     static constexpr auto I2C_RX = (1 << 2);
+    // Kept apart from the event bits and queue notifications of the
+    // calling task, only the I2C interrupts notify this index
+    static constexpr auto I2C_NOTIFY_INDEX = 2U;
     static constexpr auto MIN_DMA_TRANSFER_SIZE = 32U;
     static constexpr auto OP_TIMEOUT_MS = 1000;
     static constexpr auto WRITE_OP_TIME_MS = 5;
@@ -66,14 +83,26 @@ private:
     bool performWritePage(uint16_t pageNumber, const uint8_t* in, size_t count);
     bool writeBytesDirect(uint16_t eepromAddress, const uint8_t* in, size_t count);
     bool writeBytesDma(uint16_t eepromAddress, const uint8_t* in, size_t count);
+    void prepareTransfer();
+    bool waitForTransfer(std::uint32_t bit, TickType_t timeout);
 
-    void waitForOperation();
+    // The device does not acknowledge its address until the write cycle
+    // is over. The task sleeps through the part of the cycle that can not
+    // be over yet and polls for the acknowledge after that.
+    bool waitForOperation();
+    bool pollAcknowledge();
+    void startWriteCycle();
+    void delay(std::uint32_t millis);
 
     I2C_HandleTypeDef* m_i2c;
     GPIO_TypeDef* m_wpGpioPort;
     uint16_t m_wpGpioPin;
 
     volatile TaskHandle_t m_suspendedTask {};
+
+    bool m_writeCyclePending {};
+    std::uint32_t m_writeCycleStartTicks {};
+    Stats m_stats {};
 };
 
 };
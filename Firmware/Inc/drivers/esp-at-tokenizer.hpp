@@ -0,0 +1,71 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+namespace lg {
+
+// Splits the bytes received from the ESP-AT module into response lines,
+// notifications, +IPD data and send prompts. Works in place on the
+// circular DMA buffer and searches whole spans for line endings, only a
+// line wrapping around the end of the buffer is copied.
+class EspAtTokenizer {
+public:
+    static constexpr auto MAX_LINE_SIZE = 512U;
+    static constexpr auto MAX_DATA_CHUNK_SIZE = 256U;
+
+    class Handler {
+    public:
+        // Without the line ending. Longer lines than MAX_LINE_SIZE are dropped.
+        virtual void gotLine(std::string_view line) = 0;
+        // The start of a line beginning with '+', up to and including the
+        // first colon. Returns true if it was a notification, the line
+        // ends there then.
+        virtual bool gotNotification(std::string_view header) = 0;
+        // Returns false to reject the data, it is read as lines then
+        virtual bool gotInputHeader(int linkId, std::size_t size) = 0;
+        // At most MAX_DATA_CHUNK_SIZE bytes per call
+        virtual void gotData(int linkId, const char* data, std::size_t size) = 0;
+        // A '>' at the start of a line, returns false if nobody waits for it
+        virtual bool gotPrompt() = 0;
+
+    protected:
+        ~Handler() = default;
+    };
+
+    EspAtTokenizer(const char* buffer, std::size_t size, Handler& handler)
+        : m_buffer(buffer)
+        , m_size(size)
+        , m_handler(handler)
+    {
+    }
+
+    // Handles the bytes up to the write position of the DMA. A line that
+    // is not complete yet stays in the buffer until the next call.
+    void process(std::size_t writeIndex);
+
+private:
+    void advance(std::size_t size);
+    void consume(std::size_t size);
+    void finishHeader();
+    void finishLine();
+    void parseInputHeader(std::string_view header);
+    [[nodiscard]] std::string_view getLine(std::size_t size);
+
+    const char* m_buffer;
+    std::size_t m_size;
+    Handler& m_handler;
+
+    std::size_t m_readIndex {};
+    std::size_t m_lineStart {};
+    std::size_t m_lineLength {};
+    // The line starts with '+' and its first colon is still to come
+    bool m_headerPending {};
+
+    int m_dataLinkId {};
+    std::size_t m_dataRemaining {};
+
+    std::array<char, MAX_LINE_SIZE> m_wrapBuffer {};
+};
+
+};
@@ -5,12 +5,17 @@
 #include <array>
 #include <cstdint>
 #include <functional>
+#include <string_view>
 
 #include <FreeRTOS.h>
 #include <semphr.h>
 #include <stm32f7xx_hal.h>
 #include <task.h>
 
+#include <drivers/esp-at-tokenizer.hpp>
+
+#include <ArduinoJson.hpp>
+
 #define ESP_AT_MAX_IPD_BYTES 2920
 #define ESP_LINE_BUFFER_SIZE 512
 #define ESP_RESPONSE_BUFFER_SIZE 2048
@@ -23,10 +28,10 @@
 
 namespace lg {
 
-class EspAtDriver {
+class EspAtDriver : private EspAtTokenizer::Handler {
 public:
     static inline constexpr auto MAX_CONNECTIONS = 5;
-    static inline constexpr auto MAX_DATA_CHUNK_SIZE = 256;
+    static inline constexpr auto MAX_DATA_CHUNK_SIZE = EspAtTokenizer::MAX_DATA_CHUNK_SIZE;
     static inline constexpr auto MAX_INACTIVITY_TIME_MS = 5000;
     static inline constexpr auto DEFAULT_TIMEOUT = 3000;
 
@@ -49,6 +54,25 @@ public:
         SET_OK,
         DRIVER_ERROR,
         ESP_TIMEOUT,
+        CANCELLED,
+    };
+
+    // The module runs one command at a time. Waiting commands get it in
+    // class order, oldest first within a class, so connection traffic
+    // never waits behind queued network maintenance.
+    enum class CommandClass {
+        DATA, // Sends and closes of client connections
+        CONTROL, // Network setup and leak alerts over MQTT
+        HOUSEKEEPING, // Periodic queries and scans
+        COMMAND_CLASS_COUNT
+    };
+
+    struct CommandStats {
+        std::uint32_t commands;
+        std::uint32_t waitTimeMs; // Sum of the time commands waited for the module
+        std::uint32_t maxWaitTimeMs;
+        std::uint32_t timeouts; // Gave up waiting for the module
+        std::uint32_t cancelled;
     };
 
     enum class EspWifiMode {
@@ -120,18 +144,25 @@ public:
         : m_usart(iface)
         , m_connectionOpen({ false })
         , m_connectionLastActivity({ 0 })
+        , m_tokenizer(m_uartRxBuffer.data(), m_uartRxBuffer.size(), *this)
     {
     }
 
     void initialize();
+    // IDLE line, half and full transfer of the receive DMA
+    BaseType_t notifyRxEventFromIsr();
 
     bool isReady() const { return m_ready; }
     EspWifiStatus getWifiStatus() const { return m_wifiStatus; }
+    [[nodiscard]] CommandStats getCommandStats(CommandClass commandClass) const;
+    [[nodiscard]] static const char* getCommandClassName(CommandClass commandClass);
+    void writeDiagnostics(ArduinoJson::JsonObject out) const;
 
     EspResponse startTcpServer(std::uint16_t portNumber);
     EspResponse stopTcpServer();
     EspResponse closeConnection(int linkId);
     EspResponse closeAllConnections();
+    // Returns CANCELLED if the connection closes while waiting for the module
     EspResponse sendData(int linkId, const char* data, std::size_t size);
 
     EspResponse setWifiMode(EspWifiMode mode);
@@ -174,17 +205,52 @@ public:
 
 private:
     static constexpr auto MQTT_TIMEOUT_MS = 10000;
+    static constexpr auto MQTT_CONNECT_TIMEOUT_MS = 20000;
     static constexpr auto MQTT_PORT = 1883;
+    static constexpr auto UART_RX_EVENT = 1U << 0;
+    static constexpr auto COMMAND_CLASS_COUNT = static_cast<std::size_t>(CommandClass::COMMAND_CLASS_COUNT);
+    // Housekeeping gives up rather than piling up behind busy traffic
+    static constexpr auto HOUSEKEEPING_QUEUE_TIMEOUT_MS = 10000;
+    // Keeps the hand-over apart from ESP_RX_DONE and the EEPROM queue
+    static constexpr auto ADMISSION_NOTIFY_INDEX = 5U;
+
+    enum class AdmissionState {
+        QUEUED,
+        ADMITTED,
+        TIMED_OUT,
+        CANCELLED
+    };
+
+    // Lives on the stack of the task waiting for the module
+    struct CommandWaiter {
+        TaskHandle_t task;
+        CommandClass commandClass;
+        UBaseType_t priority;
+        int sendLinkId; // Cancelled when this connection closes, -1 for none
+        TickType_t queuedTicks;
+        volatile AdmissionState state;
+        CommandWaiter* next;
+    };
 
+    // Holds the module while in scope. Only housekeeping and sends can
+    // fail to get it, the lock then holds the response to return.
     class Lock {
     public:
-        Lock(EspAtDriver* owner)
+        Lock(EspAtDriver* owner, CommandClass commandClass, int sendLinkId)
             : m_owner(owner)
+            , m_response(owner->acquireModule(commandClass, sendLinkId))
+        {
+        }
+
+        ~Lock()
         {
-            xSemaphoreTake(owner->m_mutex, portMAX_DELAY);
+            if (m_response == EspResponse::OK) {
+                m_owner->releaseModule();
+            }
         }
 
-        ~Lock() { xSemaphoreGive(m_owner->m_mutex); }
+        explicit operator bool() const { return m_response == EspResponse::OK; }
+        EspResponse getResponse() const { return m_response; }
 
         // Rule of 5
         Lock(const Lock&) = delete;
@@ -194,9 +260,18 @@ private:
 
     private:
         EspAtDriver* m_owner;
+        EspResponse m_response;
     };
 
-    Lock acquireLock() { return Lock(this); }
+    Lock acquireLock(CommandClass commandClass, int sendLinkId = -1)
+    {
+        return Lock(this, commandClass, sendLinkId);
+    }
+
+    EspResponse acquireModule(CommandClass commandClass, int sendLinkId);
+    void releaseModule();
+    void raiseHolderPriority(UBaseType_t priority);
+    void cancelQueuedSends(int linkId);
     void initTaskMain();
     void uartRxTaskMain();
     void connectionCloserMain();
@@ -213,17 +288,18 @@ private:
         const StaticString<ESP_RESPONSE_BUFFER_SIZE>& buffer,
         std::size_t& position, StaticString<outSize>& out);
 
-    void parseEspResponse(const StaticString<ESP_LINE_BUFFER_SIZE>& buffer);
-    bool parseEspNotification(const StaticString<ESP_LINE_BUFFER_SIZE>& buffer);
+    void gotLine(std::string_view line) override;
+    bool gotNotification(std::string_view header) override;
+    bool gotInputHeader(int linkId, std::size_t size) override;
+    void gotData(int linkId, const char* data, std::size_t size) override;
+    bool gotPrompt() override;
     void finishRequest(EspResponse response);
-    bool gotPrompt();
     void gotConnect(int linkId);
     void gotClosed(int linkId);
-    void gotData(int linkId, const char* data, std::size_t size);
     void gotTimeUpdated();
     void closeIdleConnections();
-
-    void parseInputData(const StaticString<ESP_LINE_BUFFER_SIZE>& buffer);
+    // Keeps the earlier of the armed deadline and this one
+    void armInactivityDeadline(TickType_t deadline);
 
     EspResponse sendCommandDirectAndWait(const char* data,
         std::uint32_t timeout = DEFAULT_TIMEOUT);
@@ -244,8 +320,15 @@ private:
     std::array<configSTACK_DEPTH_TYPE, 256> m_uartRxTaskStack {};
     std::array<configSTACK_DEPTH_TYPE, 64> m_connectionCloserTaskStack {};
 
-    SemaphoreHandle_t m_mutex {};
-    StaticSemaphore_t m_mutexBuffer {};
+    // Sorted by class, then queue order. Not empty only while the module is busy.
+    CommandWaiter* m_commandWaiters {};
+    bool m_moduleBusy {};
+    // The holder runs at the priority of its most urgent waiter, like the
+    // mutex it replaces did
+    TaskHandle_t m_moduleHolder {};
+    UBaseType_t m_holderBasePriority {};
+    UBaseType_t m_holderPriority {};
+    std::array<CommandStats, COMMAND_CLASS_COUNT> m_commandStats {};
 
     StaticQueue_t m_connectionsToCloseQ {};
     QueueHandle_t m_connectionsToCloseHandle {};
@@ -258,14 +341,18 @@ private:
     std::array<char, 16384> m_uartRxBuffer {};
     std::array<volatile bool, MAX_CONNECTIONS> m_connectionOpen;
     std::array<volatile TickType_t, MAX_CONNECTIONS> m_connectionLastActivity;
+    // Earliest time a connection can become idle, owned by the receive
+    // task. Activity only moves the real deadlines later, so the timer
+    // may fire early and is rearmed then, but never fires late.
+    TickType_t m_inactivityDeadline {};
+    bool m_inactivityDeadlineArmed {};
 
     volatile EspResponse m_currentResponse {};
     volatile TaskHandle_t m_requestInitiator {};
     volatile bool m_waitingForPrompt {};
     volatile EspWifiStatus m_wifiStatus { EspWifiStatus::DISCONNECTED };
 
-    int m_ipdLinkId {};
-    uint32_t m_ipdRemainingBytes {};
+    EspAtTokenizer m_tokenizer;
 };
 
 };
@@ -2,6 +2,9 @@
 #include <array>
 #include <cstdint>
 
+#include <FreeRTOS.h>
+#include <task.h>
+
 #include <stm32f7xx_hal.h>
 
 namespace lg {
@@ -26,7 +29,13 @@ public:
     void* getBasePtr() const;
     void* getPageAddress(std::uint32_t page) const;
 
+    // Writes and erases issued between these calls share one indirect
+    // mode window, the memory-mapped area is not readable meanwhile
+    bool beginWriteSession();
+    bool endWriteSession();
+
     bool writePage(std::uint32_t pageId, const std::uint8_t* data, std::size_t size);
+    bool writePages(std::uint32_t firstPageId, const std::uint8_t* data, std::size_t size);
 
     template <typename T>
     bool writeObject(std::uint32_t pageId, const T& object)
@@ -40,8 +49,19 @@ public:
 
     bool eraseSector(std::uint32_t sectorId);
 
+    BaseType_t notifyStatusMatchFromIsr(bool success);
+
 private:
+    static constexpr auto QSPI_MATCH = (1 << 3);
+    static constexpr auto QSPI_ERROR = (1 << 4);
+    // Index 0 is taken by the event bits of the calling tasks, the cron
+    // tick among them
+    static constexpr auto QSPI_NOTIFY_INDEX = 1U;
+
     QSPI_HandleTypeDef* m_qspi;
+    bool m_writeSessionActive {};
+
+    volatile TaskHandle_t m_suspendedTask {};
 
     void delay(std::uint32_t millis);
     bool testFlash();
@@ -53,6 +73,7 @@ private:
 
     bool writeEnable();
     bool autoPollingMemReady();
+    bool autoPollingIt(QSPI_CommandTypeDef* command, QSPI_AutoPollingTypeDef* config);
     bool configureQspi();
     bool doWritePage(std::uint32_t pageId,
         const std::uint8_t* data, std::size_t count);
@@ -0,0 +1,158 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <FreeRTOS.h>
+#include <queue.h>
+#include <semphr.h>
+#include <task.h>
+
+#include <drivers/eeprom.hpp>
+
+#include <ArduinoJson.hpp>
+
+namespace lg {
+
+// Runs all EEPROM transfers on one task, in priority order. Within one
+// priority requests run in the order they were queued, and a request never
+// overtakes an earlier one touching the same bytes. Write data is copied
+// into the queue, so the caller's buffer is free once write() returns.
+// Writes queued back to back, each continuing the previous one within a
+// page, go out as one page write and share one write cycle.
+class EepromQueue {
+public:
+    enum class Priority : std::uint8_t {
+        INTERACTIVE, // Someone is waiting for the result, like an HTTP query
+        NORMAL,
+        BACKGROUND, // Compaction and migration
+        PRIORITY_COUNT
+    };
+
+    // Called from the queue task once the transfer is done. Must not
+    // wait for other EEPROM requests.
+    using Callback = void (*)(void* context, bool success);
+
+    struct Stats {
+        std::uint32_t reads;
+        std::uint32_t writes;
+        std::uint32_t mergedWrites; // Went out with the page write of an earlier one
+        std::uint32_t bytesRead;
+        std::uint32_t bytesWritten;
+        std::uint32_t busyTimeMs; // Spent in transfers, including write cycles
+        std::uint32_t queueDelayMs; // Sum of the time requests waited in the queue
+        std::uint32_t maxQueueDelayMs;
+        std::uint32_t maxQueued;
+    };
+
+    static constexpr auto QUEUE_SIZE = 16U;
+
+    EepromQueue() = default;
+
+    void initialize();
+
+    // A write must not cross a page boundary, the EEPROM wraps around
+    // within a page. Waits for a free slot if the queue is full. Before
+    // the scheduler runs, requests are carried out right away.
+    bool write(std::uint16_t address, const void* data, std::size_t size,
+        Priority priority = Priority::NORMAL, Callback callback = nullptr, void* context = nullptr);
+    // The data has to stay valid until the callback
+    bool read(std::uint16_t address, void* data, std::size_t size,
+        Priority priority, Callback callback, void* context);
+
+    bool readSync(std::uint16_t address, void* data, std::size_t size, Priority priority = Priority::NORMAL);
+    bool writeSync(std::uint16_t address, const void* data, std::size_t size, Priority priority = Priority::NORMAL);
+    // Waits until every request queued before with the same priority is done
+    void flush(Priority priority);
+
+    template <typename T>
+    bool readObject(std::uint16_t address, T& out, Priority priority = Priority::NORMAL)
+    {
+        return readSync(address, &out, sizeof(T), priority);
+    }
+
+    template <typename T>
+    bool writeObject(std::uint16_t address, const T& in, Priority priority = Priority::NORMAL)
+    {
+        static_assert(sizeof(T) <= EepromDriver::EEPROM_PAGE_SIZE_BYTES,
+            "Object is too big to fit in one page");
+
+        return writeSync(address, &in, sizeof(T), priority);
+    }
+
+    [[nodiscard]] Stats getStats() const;
+    void writeDiagnostics(ArduinoJson::JsonObject out) const;
+
+private:
+    static constexpr auto REQUEST_EVENT = 1U << 0;
+    // The queue task runs the EEPROM driver, whose transfers must not be
+    // woken by a request queued in the meantime
+    static constexpr auto REQUEST_NOTIFY_INDEX = 4U;
+    // Keeps the completion of a synchronous request apart from the
+    // notifications the waiting task uses for its own events
+    static constexpr auto COMPLETION_NOTIFY_INDEX = 3U;
+    static constexpr auto PRIORITY_COUNT = static_cast<std::size_t>(Priority::PRIORITY_COUNT);
+
+    enum class Operation : std::uint8_t {
+        READ,
+        WRITE,
+        FLUSH
+    };
+
+    struct Slot {
+        bool queued;
+        Operation operation;
+        Priority priority;
+        std::uint16_t address;
+        std::uint16_t size;
+        std::uint32_t sequence;
+        TickType_t queuedTicks;
+        std::uint8_t* readData;
+        Callback callback;
+        void* context;
+        std::array<std::uint8_t, EepromDriver::EEPROM_PAGE_SIZE_BYTES> writeData;
+    };
+
+    struct Waiter {
+        TaskHandle_t task;
+        volatile bool success;
+    };
+
+    static void eepromQueueEntryPoint(void* params);
+    void eepromQueueMain();
+
+    bool submit(Operation operation, Priority priority, std::uint16_t address, const void* data,
+        std::size_t size, Callback callback, void* context);
+    bool runNext();
+    bool execute(Operation operation, std::uint16_t address, std::uint8_t* data, std::size_t size);
+    void updateStats(Operation operation, std::size_t size, std::size_t requests, std::uint32_t busyTimeMs);
+
+    [[nodiscard]] Slot* findNext();
+    [[nodiscard]] Slot* findMergeable(const Slot& previous, std::uint16_t mergedEnd);
+    [[nodiscard]] bool isBlocked(const Slot& slot) const;
+
+    static void notifyWaiter(void* context, bool success);
+    static bool waitForCompletion(Waiter& waiter, bool submitted);
+
+    std::array<Slot, QUEUE_SIZE> m_slots {};
+    // Slots taken by the request being carried out, in queue order
+    std::array<Slot*, QUEUE_SIZE> m_running {};
+    std::size_t m_runningCount {};
+    std::array<std::uint8_t, EepromDriver::EEPROM_PAGE_SIZE_BYTES> m_pageBuffer {};
+    std::uint32_t m_nextSequence {};
+    Stats m_stats {};
+
+    SemaphoreHandle_t m_mutex {};
+    StaticSemaphore_t m_mutexBuffer {};
+
+    // Indexes of the free slots, the queue blocks writers while it is full
+    QueueHandle_t m_freeSlotsHandle {};
+    StaticQueue_t m_freeSlotsQ {};
+    std::array<std::uint8_t, QUEUE_SIZE> m_freeSlotsBuffer {};
+
+    TaskHandle_t m_eepromQueueTaskHandle {};
+    StaticTask_t m_eepromQueueTaskTcb {};
+    std::array<configSTACK_DEPTH_TYPE, 512> m_eepromQueueTaskStack {};
+};
+
+};
@@ -0,0 +1,183 @@
+#pragma once
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+#include <drivers/flash.hpp>
+
+#include <ArduinoJson.hpp>
+
+namespace lg {
+
+// Log-structured storage on the QSPI flash. Every sector is owned by one
+// append-only stream and holds a header page followed by one record per
+// page. A stream that reaches its sector quota drops its oldest sector,
+// so appends never run out of space. Erased sectors are prepared in the
+// background and handed out least-worn first.
+class FlashStore {
+public:
+    enum class Stream : std::uint8_t {
+        HISTORY,
+        ROLLUPS,
+        STREAM_COUNT
+    };
+
+    struct Stats {
+        std::uint32_t mountTimeMs;
+        std::uint32_t usedSectors;
+        std::uint32_t readySectors;
+        std::uint32_t minEraseCount;
+        std::uint32_t maxEraseCount;
+    };
+
+    static constexpr auto RECORDS_PER_SECTOR = FlashDriver::FLASH_PAGES_PER_SECTOR - 1;
+    static constexpr auto MAX_RECORD_SIZE = FlashDriver::FLASH_PAGE_SIZE - 8;
+
+    FlashStore() = default;
+
+    void initialize();
+    void maintain();
+
+    bool append(Stream stream, const void* data, std::size_t size);
+
+    template <typename T>
+    bool appendObject(Stream stream, const T& object)
+    {
+        static_assert(sizeof(T) <= MAX_RECORD_SIZE,
+            "Object is too big to fit in one record");
+
+        return append(stream, &object, sizeof(T));
+    }
+
+    // Records are numbered in append order, numbers stay the same when
+    // the oldest records are dropped. The returned data lives in the
+    // memory-mapped flash and is valid until the next append or maintain.
+    [[nodiscard]] std::uint32_t getFirstRecord(Stream stream) const;
+    [[nodiscard]] std::uint32_t getEndRecord(Stream stream) const;
+    const void* getRecord(Stream stream, std::uint32_t record, std::size_t* size = nullptr);
+
+    template <typename T>
+    const T* getRecordObject(Stream stream, std::uint32_t record)
+    {
+        std::size_t size = 0;
+        auto data = getRecord(stream, record, &size);
+
+        return data && size == sizeof(T) ? reinterpret_cast<const T*>(data) : nullptr;
+    }
+
+    [[nodiscard]] static const char* getStreamName(Stream stream);
+    [[nodiscard]] std::uint32_t getStreamSectorCount(Stream stream) const;
+    [[nodiscard]] Stats getStats() const;
+
+    void writeDiagnostics(ArduinoJson::JsonObject out) const;
+
+private:
+    static constexpr auto INVALID_VALUE = 0xFFFFFFFFU;
+    static constexpr auto NO_SECTOR = 0xFFFFU;
+    static constexpr auto SECTOR_MAGIC = 0x4C47534DU;
+    static constexpr auto FORMAT_KEY = 0x5A3C9617U;
+    static constexpr auto ASSIGN_KEY = 0x61E2B84DU;
+
+    // Sectors kept out of every quota, so a prepared sector always exists
+    static constexpr auto RESERVED_SECTORS = 4U;
+    // One record per month, 40 years
+    static constexpr auto ROLLUP_SECTORS = 32U;
+    // Prepared sectors the background job keeps ahead of the appends
+    static constexpr auto READY_TARGET = 2U;
+
+    enum class SectorState : std::uint8_t {
+        BLANK, // Header page erased, the rest is checked before use
+        READY, // Erased and formatted, waiting for a stream
+        USED,
+        DIRTY, // Formatted before, has to be erased
+        FOREIGN // Not written by the store, erased last
+    };
+
+    // First page of every sector. The first half is programmed right after
+    // the erase, the second half once the sector is assigned to a stream.
+    struct SectorHeader {
+        std::uint32_t magic;
+        std::uint32_t eraseCount;
+        std::uint32_t formatCheck;
+        std::uint32_t sequence;
+        std::uint32_t stream;
+        std::uint32_t firstRecord;
+        std::uint32_t assignCheck;
+    };
+
+    struct RecordHeader {
+        std::uint32_t crc;
+        std::uint16_t size;
+        std::uint16_t reserved;
+    };
+
+    static_assert(sizeof(RecordHeader) + MAX_RECORD_SIZE == FlashDriver::FLASH_PAGE_SIZE);
+
+    struct StreamDescriptor {
+        const char* name;
+        std::uint32_t maxSectors;
+    };
+
+    static constexpr auto STREAM_COUNT = static_cast<std::size_t>(Stream::STREAM_COUNT);
+
+    static constexpr std::array<StreamDescriptor, STREAM_COUNT> STREAMS = { {
+        { "history", FlashDriver::FLASH_SECTOR_COUNT - RESERVED_SECTORS - ROLLUP_SECTORS },
+        { "rollups", ROLLUP_SECTORS },
+    } };
+
+    static_assert([] {
+        std::uint32_t total = 0;
+        for (auto& stream : STREAMS) {
+            total += stream.maxSectors;
+        }
+        return total;
+    }() <= FlashDriver::FLASH_SECTOR_COUNT - RESERVED_SECTORS,
+        "Stream quotas have to leave the reserved sectors free");
+
+    // Sectors of one stream, oldest first
+    struct StreamState {
+        std::array<std::uint16_t, FlashDriver::FLASH_SECTOR_COUNT> sectors;
+        std::uint32_t head;
+        std::uint32_t count;
+        std::uint32_t tail; // Used record slots of the newest sector
+    };
+
+    const std::uint8_t* m_flashBase {};
+    bool m_mounted {};
+    std::uint32_t m_nextSequence {};
+    std::uint32_t m_mountTimeMs {};
+
+    std::array<SectorState, FlashDriver::FLASH_SECTOR_COUNT> m_sectorStates {};
+    std::array<std::uint32_t, FlashDriver::FLASH_SECTOR_COUNT> m_eraseCounts {};
+    std::array<StreamState, STREAM_COUNT> m_streams {};
+
+    // CRC results of record pages, each page is checked at most once
+    std::bitset<FlashDriver::FLASH_PAGE_COUNT> m_pageChecked {};
+    std::bitset<FlashDriver::FLASH_PAGE_COUNT> m_pageValid {};
+
+    void mountSector(std::uint16_t sector, std::uint32_t& maxEraseCount);
+    void sortStream(StreamState& state);
+    std::uint32_t findTail(std::uint16_t sector) const;
+
+    bool openSector(Stream stream);
+    void releaseOldestSector(StreamState& state);
+    std::uint16_t takeReadySector();
+    bool prepareSector();
+    std::uint16_t findSectorToPrepare() const;
+    void forgetSectorPages(std::uint16_t sector);
+
+    [[nodiscard]] std::uint16_t getSectorAt(const StreamState& state, std::uint32_t position) const;
+    [[nodiscard]] std::uint16_t getNewestSector(const StreamState& state) const;
+    [[nodiscard]] const SectorHeader* getSectorHeader(std::uint16_t sector) const;
+    [[nodiscard]] const std::uint8_t* getPage(std::uint32_t page) const;
+    [[nodiscard]] bool isPageBlank(std::uint32_t page) const;
+    [[nodiscard]] bool isSectorBlank(std::uint16_t sector) const;
+    bool isRecordValid(std::uint32_t page);
+
+    static std::uint32_t calculateRecordCrc(const RecordHeader* record);
+    static std::uint32_t calculateFormatCheck(const SectorHeader& header);
+    static std::uint32_t calculateAssignCheck(const SectorHeader& header);
+};
+
+};
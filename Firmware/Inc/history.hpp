@@ -3,15 +3,26 @@
 #include <cstdint>
 #include <functional>
 
+#include <drivers/eeprom.hpp>
+#include <eeprom-queue.hpp>
+#include <flash-store.hpp>
+#include <minute-block.hpp>
+#include <scoped-res.hpp>
+#include <utc.hpp>
+
+#include <ArduinoJson.hpp>
+
 namespace lg {
 
 class HistoryService {
 public:
-    struct EepromHistoryEntry {
-        std::uint32_t timestamp;
-        std::uint32_t totalMl;
-        std::uint32_t volumeMl;
-        std::uint32_t checksum;
+    using EepromHistoryEntry = MinuteBlock::DataPoint;
+
+    struct EepromHistoryStats {
+        std::uint32_t dataPoints;
+        std::uint32_t usedBlocks;
+        std::uint32_t usedBytes;
+        std::uint32_t oldestTimestamp;
     };
 
     struct FlashHistoryEntry {
@@ -21,9 +32,13 @@ public:
         std::uint32_t fromTimestamp;
         std::uint32_t toTimestamp;
         std::array<std::uint32_t, 24> hourVolumesMl;
+        std::uint32_t cumulativeMl; // All days written so far, this one included
         std::uint32_t crc;
     };
 
+    static constexpr auto ROLLUP_FIRST_YEAR = 2024;
+    static constexpr auto ROLLUP_YEARS = 32;
+
     HistoryService() = default;
 
     void initialize();
@@ -33,36 +48,201 @@ public:
     void forEachFlashHistoryEntry(std::uint32_t fromTimestamp, std::uint32_t toTimestamp,
         std::function<void(std::size_t, const FlashHistoryEntry&)> functor);
 
+    // Totals of the days already written to flash, of one calendar month
+    // or, with month 0, of a whole year
+    bool getPeriodTotal(int year, int month, std::uint32_t& totalMl, std::uint32_t& days) const;
+
+    // Total of the flash days overlapping the range, from the running
+    // totals of the first and the last of them
+    void getRangeTotal(std::uint32_t fromTimestamp, std::uint32_t toTimestamp, std::uint32_t& totalMl);
+
+    // Drops the whole minute history with a single EEPROM write
+    void clearEepromHistory();
+
+    [[nodiscard]] EepromHistoryStats getEepromHistoryStats() const;
+    [[nodiscard]] std::uint32_t getLastQueryTimeMs() const { return m_lastQueryTimeMs; }
+
+    void writeDiagnostics(ArduinoJson::JsonObject out) const;
+
 private:
     static constexpr auto INVALID_VALUE = 0xFFFFFFFFU;
+
+    // Aggregates of one local day of the newest history, kept up to date
+    // as data points are written and overwritten in the EEPROM ring
+    struct DayIndexEntry {
+        int year;
+        int month;
+        int day;
+        std::uint32_t firstBlock; // Block of the oldest data point of the day
+        std::uint32_t count; // Data points
+        std::uint32_t fromTimestamp;
+        std::uint32_t toTimestamp;
+        std::array<std::uint32_t, 24> hourVolumesMl;
+
+        [[nodiscard]] bool isSameDay(const UtcTime& date) const
+        {
+            return day == date.getDay() && month == date.getMonth() && year == date.getYear();
+        }
+    };
+
+    // Newest data point, kept in RTC backup registers so the total volume
+    // of data points still staged in RAM survives a reset
+    struct PowerFailMarker {
+        std::uint32_t timestamp;
+        std::uint32_t totalMl;
+        std::uint32_t checksum;
+    };
+
+    // Written to flash once the first day of the next month is written
+    struct MonthRollupEntry {
+        int year;
+        int month;
+        std::uint32_t totalMl;
+        std::uint32_t days;
+    };
+
+    // Entry written by firmware without the running total
+    struct LegacyFlashHistoryEntry {
+        int year;
+        int month;
+        int day;
+        std::uint32_t fromTimestamp;
+        std::uint32_t toTimestamp;
+        std::array<std::uint32_t, 24> hourVolumesMl;
+        std::uint32_t crc;
+    };
+
+    // Data point of firmware that stored every minute uncompressed
+    struct LegacyEepromEntry {
+        std::uint32_t timestamp;
+        std::uint32_t totalMl;
+        std::uint32_t volumeMl;
+        std::uint32_t checksum;
+    };
+
+    // Blocks are only valid in the generation stored here, a new generation
+    // drops the whole ring at once
+    struct RingHeader {
+        std::uint32_t magic;
+        std::uint32_t generation;
+        std::uint32_t checksum;
+    };
+
+    // What boot and queries need to know about a block without reading it
+    struct BlockSummary {
+        std::uint32_t firstTimestamp;
+        std::uint16_t pointCount; // Zero if the block is not valid
+        std::uint8_t usedBytes;
+    };
+
+    struct LocalOffsetEntry {
+        std::uint32_t slot { INVALID_VALUE };
+        std::int32_t offset {};
+    };
+
     static constexpr auto NEWEST_HISTORY_ADDR = 0x8000;
+    static constexpr auto BLOCK_COUNT = 256U;
+    static constexpr auto RING_HEADER_ADDR = 0x7F80;
+    static constexpr auto RING_HEADER_MAGIC = 0x4D42484CU;
+    // Unused area, holds converted blocks while the legacy entries are read
+    static constexpr auto MIGRATION_ADDR = 0x4000;
+    static constexpr auto MIGRATION_BLOCK_COUNT = 127U;
+    static constexpr auto LOCAL_OFFSET_SLOT_SECONDS = 900;
+    static constexpr auto FLASH_STREAM = FlashStore::Stream::HISTORY;
+    static constexpr auto LEGACY_ENTRY_COUNT = 2048U;
+    static constexpr auto LEGACY_ENTRIES_PER_PAGE = EepromDriver::EEPROM_PAGE_SIZE_BYTES / sizeof(LegacyEepromEntry);
+    // Older blocks only hold days the day index drops again
+    static constexpr auto DAY_INDEX_SECONDS = 3 * 24 * 3600;
+    // Upper bound of history lost on power failure, a full block is
+    // flushed earlier. Shorter windows cost more EEPROM write cycles.
+    static constexpr auto MAX_STAGED_SECONDS = 8 * 60;
+    static constexpr auto POWER_FAIL_MARKER_REG = RTC_BKP_DR1; // DR1..DR3
+
+    static_assert(NEWEST_HISTORY_ADDR % EepromDriver::EEPROM_PAGE_SIZE_BYTES == 0,
+        "Blocks are flushed as EEPROM pages");
+    static_assert(NEWEST_HISTORY_ADDR + BLOCK_COUNT * sizeof(MinuteBlock) <= EepromDriver::EEPROM_SIZE_BYTES);
+    static_assert(MIGRATION_ADDR + MIGRATION_BLOCK_COUNT * sizeof(MinuteBlock) <= RING_HEADER_ADDR);
+    static_assert(RING_HEADER_ADDR % EepromDriver::EEPROM_PAGE_SIZE_BYTES == 0);
 
-    std::array<EepromHistoryEntry, 2048> m_newestHistory {};
-    std::uint32_t m_newestHistoryWriteIndex {};
+    // Ring of blocks in the EEPROM, only the block being written is kept
+    // in RAM. Other blocks are read into the page buffer when needed.
+    std::array<BlockSummary, BLOCK_COUNT> m_blockSummaries {};
+    std::uint32_t m_writeBlock {};
+    std::uint32_t m_generation {};
+    MinuteBlock m_openBlock {};
+    MinuteBlock m_readBlock {};
+    MinuteBlock::Writer m_blockWriter;
+    std::uint32_t m_lastQueryTimeMs {};
+    std::uint32_t m_stagedSinceTimestamp {};
+    std::uint32_t m_eepromWriteCount {};
     std::uint32_t m_newestHistoryLastTimestamp {};
     bool m_disabled {};
+    volatile bool m_eepromWriteFailed {}; // Set from the EEPROM queue task
     bool m_initialDumpDone {};
     bool m_initialTimeDone {};
 
     std::uint32_t m_lastTotalVolume {};
 
-    std::size_t m_flashWriteIndex {};
+    // [0] is the day of the newest entry, [1] the day before it
+    std::array<DayIndexEntry, 2> m_dayIndex {};
+    std::uint32_t m_dayIndexTimezoneRevision { INVALID_VALUE };
+    std::array<LocalOffsetEntry, 2> m_localOffsets {};
+    std::size_t m_nextLocalOffset {};
+
     std::uint32_t m_flashDataUpToTimestamp {};
+    std::uint32_t m_flashCumulativeMl {};
+
+    std::uint32_t m_flashLoadTimeMs {};
+
+    // Indexed by getMonthKey(), the open month is still summed up from
+    // the daily entries
+    std::array<std::uint32_t, ROLLUP_YEARS * 12> m_monthTotalsMl {};
+    std::array<std::uint8_t, ROLLUP_YEARS * 12> m_monthDays {};
+    std::array<std::uint32_t, ROLLUP_YEARS> m_yearTotalsMl {};
+    std::array<std::uint16_t, ROLLUP_YEARS> m_yearDays {};
+    int m_openMonthKey { -1 };
 
     void handleInterval();
     void loadNewestHistoryFromEeprom();
-    [[nodiscard]] std::uint32_t findNewestHistoryWriteIndex() const;
-    [[nodiscard]] std::uint16_t getEepromAddress(std::size_t index) const;
+    void loadGeneration();
+    bool loadBlockSummaries();
+    [[nodiscard]] std::uint32_t findNewestBlock() const;
+    [[nodiscard]] std::uint16_t getEepromAddress(std::size_t block) const;
+    const MinuteBlock* readBlock(std::uint32_t block);
+    void updateBlockSummary(std::uint32_t block, const MinuteBlock& data);
+    void migrateLegacyEepromHistory();
     bool writeNewestHistoryDataPoint();
-    static std::uint32_t calculateEntryChecksum(const EepromHistoryEntry& entry);
-    static bool isEntryValid(const EepromHistoryEntry& entry);
+    void appendDataPoint(const EepromHistoryEntry& point);
+    void startNextBlock();
+    void flushNewestHistory();
+    static void eepromWriteFinished(void* context, bool success);
+    static bool readPowerFailMarker(PowerFailMarker& marker);
+    static void writePowerFailMarker(std::uint32_t timestamp, std::uint32_t totalMl);
+    static std::uint32_t calculateMarkerChecksum(const PowerFailMarker& marker);
+    static bool isLegacyEntryValid(const LegacyEepromEntry& entry);
+    static std::uint32_t calculateRingHeaderChecksum(const RingHeader& header);
+    UtcTime getLocalTimeForEntry(std::uint32_t timestamp);
+    void ensureDayIndex();
+    void rebuildDayIndex();
+    bool addToDayIndex(std::uint32_t block, const EepromHistoryEntry& point);
+    [[nodiscard]] const DayIndexEntry* findDayIndexEntry(const UtcTime& localTime) const;
     void performInitialDumpToFlash();
-    void sumUpDayAndWriteToFlash(std::uint32_t timestamp);
-    static std::uint32_t calculateFlashEntryCrc(const FlashHistoryEntry& entry);
-    bool isFlashEntryOk(const FlashHistoryEntry& entry);
-    void findFlashWriteIndex();
-
-    void clearEepromHistory();
+    void sumUpDayAndWriteToFlash(const DayIndexEntry& day);
+    template <typename T>
+    static std::uint32_t calculateFlashEntryCrc(const T& entry);
+    template <typename T>
+    static bool isFlashEntryOk(const T& entry);
+    static std::uint32_t getDayTotal(const FlashHistoryEntry& day);
+    void mountFlashHistory();
+    void migrateLegacyFlashHistory(ScopedResource<FlashStore>& flashStore);
+    static bool isFlashPageEmpty(const LegacyFlashHistoryEntry* entry);
+    static std::uint32_t findFirstFlashRecord(ScopedResource<FlashStore>& flashStore, std::uint32_t fromTimestamp);
+    static std::uint32_t findFlashRecord(ScopedResource<FlashStore>& flashStore,
+        const std::function<bool(const FlashHistoryEntry&)>& isBefore);
+    void mountRollups();
+    void addDayToRollups(const FlashHistoryEntry& day);
+    void writeMonthRollup(int monthKey);
+    static int getMonthKey(int year, int month);
 };
 
 };
@@ -0,0 +1,106 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <drivers/eeprom.hpp>
+
+namespace lg {
+
+// One EEPROM page of minute history. Data points are coded against the
+// previous one: a data point one minute after it takes a varint of its
+// volume, a run of minutes without flow takes one varint for the whole
+// run. A page holds hours of data instead of eight plain data points.
+struct MinuteBlock {
+    struct DataPoint {
+        std::uint32_t timestamp;
+        std::uint32_t totalMl;
+        std::uint32_t volumeMl;
+    };
+
+    struct Header {
+        std::uint32_t crc; // Rest of the header and the used payload words
+        std::uint32_t firstTimestamp;
+        std::uint32_t baseTotalMl; // Total volume before the first data point
+        std::uint16_t pointCount;
+        std::uint8_t length; // Used payload bytes
+        std::uint8_t reserved;
+    };
+
+    static constexpr auto PAYLOAD_SIZE = EepromDriver::EEPROM_PAGE_SIZE_BYTES - sizeof(Header);
+
+    Header header;
+    std::array<std::uint8_t, PAYLOAD_SIZE> payload;
+
+    void clear();
+    // The generation is mixed into the CRC, so blocks sealed in another
+    // generation are not valid
+    void seal(std::uint32_t generation);
+    [[nodiscard]] bool isValid(std::uint32_t generation) const;
+    // Bytes from the start of the block covered by the CRC
+    [[nodiscard]] std::size_t getWriteSize() const;
+
+    class Reader;
+    class Writer;
+
+private:
+    enum class TokenKind : std::uint8_t {
+        RUN, // Minutes without flow
+        MINUTE, // One minute after the previous data point
+        GAP, // Any other distance to the previous data point
+    };
+
+    struct Token {
+        TokenKind kind;
+        std::uint32_t value; // Minutes of a run, volume otherwise
+        std::uint32_t gap;
+        std::size_t size;
+    };
+
+    static constexpr auto MINUTE_SECONDS = 60U;
+
+    [[nodiscard]] bool readToken(std::size_t offset, Token& token) const;
+    bool writeToken(std::size_t offset, const Token& token);
+    [[nodiscard]] std::uint32_t calculateCrc() const;
+};
+
+static_assert(sizeof(MinuteBlock) == EepromDriver::EEPROM_PAGE_SIZE_BYTES,
+    "A block is written as one EEPROM page");
+
+// Decodes the data points of a valid block, oldest first
+class MinuteBlock::Reader {
+public:
+    explicit Reader(const MinuteBlock& block);
+
+    bool next(DataPoint& point);
+
+private:
+    const MinuteBlock& m_block;
+    std::size_t m_offset {};
+    std::uint32_t m_runLeft {};
+    DataPoint m_point {};
+};
+
+// Appends data points to a block. The block has to be sealed before it
+// is written.
+class MinuteBlock::Writer {
+public:
+    Writer() = default;
+
+    // Continues a valid block, any other block is cleared
+    void open(MinuteBlock& block, std::uint32_t generation);
+    // Fails if the block is full or the data point does not follow the
+    // previous one, the block is unchanged then
+    bool append(const DataPoint& point);
+
+    [[nodiscard]] bool isEmpty() const { return !m_block || !m_block->header.pointCount; }
+    [[nodiscard]] const DataPoint& getLastPoint() const { return m_lastPoint; }
+
+private:
+    MinuteBlock* m_block {};
+    DataPoint m_lastPoint {};
+    std::size_t m_lastTokenOffset {};
+    bool m_lastTokenIsRun {};
+};
+
+};
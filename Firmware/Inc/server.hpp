@@ -23,6 +23,11 @@ public:
     void initialize();
 
 private:
+    // Settings changed over HTTP are answered once they are in the EEPROM
+    static constexpr auto CONFIG_COMMIT_TIMEOUT = pdMS_TO_TICKS(3000);
+    // Every subsystem writes its own section of /diagnostics
+    static constexpr auto DIAGNOSTICS_DOCUMENT_SIZE = 2048;
+
     void initHttpMain();
     void addGeneralRoutes();
     void addBlockRoutes();
@@ -35,6 +40,7 @@ private:
     void addJsonHeader(Response& res);
     void addAuthenticateHeader(Response& res);
     void respondBadRequest(Response& res);
+    void respondConfigNotStored(Response& res);
 
     Server_t m_server;
 
@@ -1,5 +1,8 @@
 #include <config.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <device.hpp>
@@ -18,159 +21,732 @@ static_assert(
 static_assert(
     sizeof(ConfigService::Config) % sizeof(std::uint32_t) == 0, "Config size must be word-aligned");
 
+static constexpr auto JOURNAL_MAGIC = 0x4A43474CU;
+static constexpr auto JOURNAL_CHECK_KEY = 0x93D1065AU;
+static constexpr auto RECORD_COMMIT_FLAG = 1U << 0;
+static constexpr auto NO_DEFAULT_FILL = -1;
+
+enum class RecordType : std::uint8_t {
+    WIFI_SSID = 1,
+    WIFI_PASSWORD,
+    IMPULSES_PER_LITER,
+    VALVE_TYPE_NC,
+    ADMIN_PASSWORD,
+    SCHEDULE_DAY,
+    TIMEZONE_ID,
+    LEAK_LOGIC_CONFIG,
+    PAIRED_PROBE,
+    IGNORED_PROBES,
+};
+
+// First bytes of a journal area, written after the records of a compaction
+struct JournalAreaHeader {
+    std::uint32_t magic;
+    std::uint32_t sequence;
+    std::uint32_t check;
+    std::uint32_t reserved;
+};
+
+// The CRC covers the rest of the header and the word-padded payload. It
+// is mixed with the area sequence, so records left over from an earlier
+// use of the area are not valid.
+struct JournalRecordHeader {
+    std::uint32_t crc;
+    RecordType type;
+    std::uint8_t index;
+    std::uint8_t length;
+    std::uint8_t flags;
+};
+
+static constexpr auto MAX_RECORD_SIZE = EepromDriver::EEPROM_PAGE_SIZE_BYTES;
+static constexpr auto MAX_PAYLOAD_SIZE = MAX_RECORD_SIZE - sizeof(JournalRecordHeader);
+
+// An array field is stored as one record per element. Elements made of
+// the default fill byte only are left out of a compaction.
+struct ConfigField {
+    RecordType type;
+    std::uint16_t offset;
+    std::uint16_t size;
+    std::uint16_t count;
+    std::int16_t defaultFill;
+};
+
+// NOLINTBEGIN(*-invalid-offsetof)
+static constexpr std::array<ConfigField, 10> FIELDS = { {
+    { RecordType::WIFI_SSID, offsetof(ConfigService::Config, wifiSsid), sizeof(ConfigService::Config::wifiSsid), 1, NO_DEFAULT_FILL },
+    { RecordType::WIFI_PASSWORD, offsetof(ConfigService::Config, wifiPassword), sizeof(ConfigService::Config::wifiPassword), 1, NO_DEFAULT_FILL },
+    { RecordType::IMPULSES_PER_LITER, offsetof(ConfigService::Config, impulsesPerLiter), sizeof(std::uint32_t), 1, NO_DEFAULT_FILL },
+    { RecordType::VALVE_TYPE_NC, offsetof(ConfigService::Config, valveTypeNC), sizeof(bool), 1, NO_DEFAULT_FILL },
+    { RecordType::ADMIN_PASSWORD, offsetof(ConfigService::Config, adminPassword), sizeof(ConfigService::Config::adminPassword), 1, NO_DEFAULT_FILL },
+    { RecordType::SCHEDULE_DAY, offsetof(ConfigService::Config, weeklySchedule), sizeof(std::uint32_t), 7, 0x00 },
+    { RecordType::TIMEZONE_ID, offsetof(ConfigService::Config, timezoneId), sizeof(std::uint32_t), 1, NO_DEFAULT_FILL },
+    { RecordType::LEAK_LOGIC_CONFIG, offsetof(ConfigService::Config, leakLogicConfig), sizeof(ConfigService::Config::leakLogicConfig), 1, NO_DEFAULT_FILL },
+    { RecordType::PAIRED_PROBE, offsetof(ConfigService::Config, pairedProbes), sizeof(ConfigService::ProbeId), ConfigService::MAX_PROBES, 0xFF },
+    { RecordType::IGNORED_PROBES, offsetof(ConfigService::Config, ignoredProbes), ConfigService::IGNORED_PROBES_PER_RECORD, ConfigService::MAX_PROBES / ConfigService::IGNORED_PROBES_PER_RECORD, 0x00 },
+} };
+// NOLINTEND(*-invalid-offsetof)
+
+static_assert(ConfigService::INVALID_PROBE_ID.word1 == 0xFFFFFFFFU
+        && ConfigService::INVALID_PROBE_ID.word2 == 0xFFFFFFFFU
+        && ConfigService::INVALID_PROBE_ID.word3 == 0xFFFFFFFFU,
+    "The default fill of the paired probes has to match");
+
+static_assert([] {
+    std::size_t records = 0;
+    for (std::size_t i = 0; i < FIELDS.size(); ++i) {
+        if (static_cast<std::size_t>(FIELDS[i].type) != i + 1) {
+            return false;
+        }
+        records += FIELDS[i].count;
+    }
+    return records == ConfigService::RECORD_COUNT;
+}(),
+    "Fields are listed in record type order and cover every record");
+
+// Position of the first element of a field among all records
+static constexpr std::size_t getFirstRecord(std::size_t fieldIndex)
+{
+    std::size_t record = 0;
+    for (std::size_t i = 0; i < fieldIndex; ++i) {
+        record += FIELDS[i].count;
+    }
+    return record;
+}
+
+static constexpr std::size_t getFieldIndex(RecordType type)
+{
+    return static_cast<std::size_t>(type) - 1;
+}
+
+static constexpr std::uint32_t getRecordSize(std::size_t payloadSize)
+{
+    return sizeof(JournalRecordHeader) + (payloadSize + sizeof(std::uint32_t) - 1) / sizeof(std::uint32_t) * sizeof(std::uint32_t);
+}
+
+static_assert([] {
+    for (auto& field : FIELDS) {
+        if (field.size > MAX_PAYLOAD_SIZE || field.count > 256) {
+            return false;
+        }
+    }
+    return true;
+}(),
+    "Every element has to fit in one record with an 8-bit index");
+
+static_assert([] {
+    std::uint32_t total = sizeof(JournalAreaHeader);
+    for (auto& field : FIELDS) {
+        total += getRecordSize(field.size) * field.count;
+    }
+    return total;
+}() <= ConfigService::CONFIG_PAGES * EepromDriver::EEPROM_PAGE_SIZE_BYTES,
+    "A compaction of a config without any default value has to fit in one area");
+
+static std::uint32_t calculateJournalCheck(std::uint32_t sequence)
+{
+    return JOURNAL_MAGIC ^ sequence ^ JOURNAL_CHECK_KEY;
+}
+
+static std::uint32_t calculateRecordCrc(const std::uint32_t* record, std::size_t size, std::uint32_t sequence)
+{
+    portDISABLE_INTERRUPTS();
+    auto crc = HAL_CRC_Calculate(&hcrc,
+        const_cast<std::uint32_t*>(record) + 1, size / sizeof(std::uint32_t) - 1);
+    portENABLE_INTERRUPTS();
+
+    return crc ^ sequence;
+}
+
+static const std::uint8_t* getElement(const ConfigService::Config& config,
+    const ConfigField& field, std::size_t index)
+{
+    return reinterpret_cast<const std::uint8_t*>(&config) + field.offset + index * field.size;
+}
+
+static bool isDefaultElement(const ConfigService::Config& config, const ConfigField& field, std::size_t index)
+{
+    if (field.defaultFill == NO_DEFAULT_FILL) {
+        return false;
+    }
+
+    auto element = getElement(config, field, index);
+    return std::all_of(element, element + field.size,
+        [&](std::uint8_t byte) { return byte == field.defaultFill; });
+}
+
+void ConfigService::configWriterEntryPoint(void* params)
+{
+    auto instance = reinterpret_cast<ConfigService*>(params);
+    instance->configWriterMain();
+}
+
 void ConfigService::initialize()
 {
-    if (readConfigFromEeprom()) {
-        copyCurrentToStored();
-    } else {
-        auto storedPtr = reinterpret_cast<std::uint32_t*>(&m_storedConfig);
-        for (int i = 0; i < sizeof(m_storedConfig) / sizeof(std::uint32_t); ++i) {
-            *(storedPtr++) = 0xFFFFFFFFU;
+    m_configWriterTaskHandle = xTaskCreateStatic(
+        &ConfigService::configWriterEntryPoint /* Task function */,
+        "Config Writer" /* Task name */,
+        m_configWriterTaskStack.size() /* Stack size */,
+        this /* Parameters */,
+        1 /* Priority */,
+        m_configWriterTaskStack.data() /* Task stack address */,
+        &m_configWriterTaskTcb /* Task control block */
+    );
+
+    auto startTicks = HAL_GetTick();
+
+    if (!loadJournal()) {
+        // No journal yet, take over a full copy written by older firmware.
+        // The compaction goes to the area of the other copy, so the copy
+        // that was read survives until the journal is complete.
+        if (readLegacyConfig(FIRST_CONFIG_PAGE)) {
+            m_activeArea = 0;
+        } else if (readLegacyConfig(SECOND_CONFIG_PAGE)) {
+            m_activeArea = 1;
+        } else {
+            resetToDefault();
+            m_activeArea = 1;
         }
 
-        m_needFullWrite = true;
+        m_needCompaction = true;
+        writeConfig();
     }
+
+    m_replayTimeMs = HAL_GetTick() - startTicks;
+    m_dirtyRecords.reset();
+    publishSnapshot(0);
 }
 
 void ConfigService::resetToDefault()
 {
-    m_currentConfig.configVersion = CURRENT_CONFIG_VERSION;
-    m_currentConfig.wifiSsid.Clear();
-    m_currentConfig.wifiPassword.Clear();
-    m_currentConfig.impulsesPerLiter = 500;
-    m_currentConfig.valveTypeNC = false;
-    m_currentConfig.adminPassword = "admin1";
-    m_currentConfig.weeklySchedule.fill(0);
-    m_currentConfig.timezoneId = 40; // London timezone (GMT/UTC+0)
-    m_currentConfig.leakLogicConfig.Clear();
-    m_currentConfig.pairedProbes.fill(INVALID_PROBE_ID);
-    m_currentConfig.ignoredProbes.fill(false);
+    setDefaults(m_currentConfig);
+    m_dirtyRecords.set();
+}
+
+template <typename T>
+void ConfigService::updateElement(std::size_t fieldIndex, std::size_t index, T& element, const T& value)
+{
+    // Comparing the bytes before and after the assignment also catches
+    // bytes an assignment leaves alone, like the tail of a string
+    std::array<std::uint8_t, sizeof(T)> previous {};
+    std::memcpy(previous.data(), &element, sizeof(T));
+    element = value;
+
+    if (std::memcmp(previous.data(), &element, sizeof(T))) {
+        m_dirtyRecords.set(getFirstRecord(fieldIndex) + index);
+    }
+}
+
+void ConfigService::setWifiSsid(const char* ssid)
+{
+    updateElement(getFieldIndex(RecordType::WIFI_SSID), 0, m_currentConfig.wifiSsid, decltype(Config::wifiSsid)(ssid));
+}
+
+void ConfigService::setWifiPassword(const char* password)
+{
+    updateElement(getFieldIndex(RecordType::WIFI_PASSWORD), 0, m_currentConfig.wifiPassword, decltype(Config::wifiPassword)(password));
+}
+
+void ConfigService::setImpulsesPerLiter(std::uint32_t impulsesPerLiter)
+{
+    updateElement(getFieldIndex(RecordType::IMPULSES_PER_LITER), 0, m_currentConfig.impulsesPerLiter, impulsesPerLiter);
+}
+
+void ConfigService::setValveTypeNC(bool valveTypeNC)
+{
+    updateElement(getFieldIndex(RecordType::VALVE_TYPE_NC), 0, m_currentConfig.valveTypeNC, valveTypeNC);
+}
+
+void ConfigService::setAdminPassword(const char* password)
+{
+    updateElement(getFieldIndex(RecordType::ADMIN_PASSWORD), 0, m_currentConfig.adminPassword, decltype(Config::adminPassword)(password));
+}
+
+void ConfigService::setWeeklySchedule(const std::array<std::uint32_t, 7>& weeklySchedule)
+{
+    for (std::size_t day = 0; day < weeklySchedule.size(); ++day) {
+        updateElement(getFieldIndex(RecordType::SCHEDULE_DAY), day, m_currentConfig.weeklySchedule.at(day), weeklySchedule.at(day));
+    }
+}
+
+void ConfigService::setTimezoneId(std::uint32_t timezoneId)
+{
+    updateElement(getFieldIndex(RecordType::TIMEZONE_ID), 0, m_currentConfig.timezoneId, timezoneId);
+}
+
+void ConfigService::setLeakLogicConfig(const StaticString<64>& leakLogicConfig)
+{
+    updateElement(getFieldIndex(RecordType::LEAK_LOGIC_CONFIG), 0, m_currentConfig.leakLogicConfig, leakLogicConfig);
+}
+
+void ConfigService::setPairedProbe(std::uint8_t masterAddress, const ProbeId& probeId)
+{
+    updateElement(getFieldIndex(RecordType::PAIRED_PROBE), masterAddress, m_currentConfig.pairedProbes.at(masterAddress), probeId);
+}
+
+void ConfigService::setProbeIgnored(std::uint8_t masterAddress, bool ignored)
+{
+    updateElement(getFieldIndex(RecordType::IGNORED_PROBES), masterAddress / IGNORED_PROBES_PER_RECORD,
+        m_currentConfig.ignoredProbes.at(masterAddress), ignored);
+}
+
+void ConfigService::setDefaults(Config& config)
+{
+    config.configVersion = CURRENT_CONFIG_VERSION;
+    config.wifiSsid.Clear();
+    config.wifiPassword.Clear();
+    config.impulsesPerLiter = 500;
+    config.valveTypeNC = false;
+    config.adminPassword = "admin1";
+    config.weeklySchedule.fill(0);
+    config.timezoneId = 40; // London timezone (GMT/UTC+0)
+    config.leakLogicConfig.Clear();
+    config.pairedProbes.fill(INVALID_PROBE_ID);
+    config.ignoredProbes.fill(false);
+
+    config.unused = 0;
+
+    config.crc = calculateCrc(config);
+}
+
+std::uint32_t ConfigService::commit()
+{
+    auto generation = ++m_requestedGeneration;
+    publishSnapshot(generation);
+
+    if (!m_configWriterTaskHandle || xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+        // Nobody to hand the write to yet
+        if (writeConfig()) {
+            m_committedGeneration = generation;
+        } else {
+            m_failedGeneration = generation;
+        }
+
+        return generation;
+    }
+
+    xTaskNotify(m_configWriterTaskHandle, CONFIG_COMMIT_EVENT, eSetBits);
+    return generation;
+}
+
+auto ConfigService::getSnapshot() const -> Snapshot
+{
+    while (true) {
+        auto& slot = m_snapshots.at(m_publishedSnapshot);
+        auto version = slot.version;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (version & 1) {
+            continue;
+        }
+
+        auto snapshot = slot.snapshot;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // Published twice while the copy was made, try the current slot
+        if (slot.version == version) {
+            return snapshot;
+        }
+    }
+}
+
+void ConfigService::publishSnapshot(std::uint32_t generation)
+{
+    auto index = m_publishedSnapshot ^ 1;
+    auto& slot = m_snapshots.at(index);
+
+    slot.version = slot.version + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    slot.snapshot.generation = generation;
+    slot.snapshot.impulsesPerLiter = m_currentConfig.impulsesPerLiter;
+    slot.snapshot.valveTypeNC = m_currentConfig.valveTypeNC;
+    slot.snapshot.weeklySchedule = m_currentConfig.weeklySchedule;
+    slot.snapshot.adminPassword = m_currentConfig.adminPassword;
 
-    m_currentConfig.unused = 0;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    slot.version = slot.version + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
 
-    m_currentConfig.crc = calculateCrc(m_currentConfig);
+    m_publishedSnapshot = index;
 }
 
-static inline bool compareWords(const uint32_t* first, const uint32_t* second, size_t nWords)
+bool ConfigService::waitForCommit(std::uint32_t generation, TickType_t timeout) const
 {
-    while (nWords) {
-        if (*first != *second)
+    auto startTicks = xTaskGetTickCount();
+
+    while (m_committedGeneration < generation) {
+        if (m_failedGeneration >= generation || xTaskGetTickCount() - startTicks >= timeout) {
             return false;
-        ++first;
-        ++second;
-        --nWords;
+        }
+
+        vTaskDelay(COMMIT_POLL_TIME);
     }
 
     return true;
 }
 
-bool ConfigService::commit()
+void ConfigService::configWriterMain()
 {
-    static constexpr auto PAGE_WORDS
-        = EepromDriver::EEPROM_PAGE_SIZE_BYTES / sizeof(std::uint32_t);
+    while (true) {
+        // A failed write is retried until it goes through, a new commit
+        // wakes the writer right away
+        auto retry = m_failedGeneration > m_committedGeneration;
+        xTaskNotifyWait(0, CONFIG_COMMIT_EVENT, nullptr, retry ? COMMIT_RETRY_TIME : portMAX_DELAY);
+
+        vTaskDelay(COMMIT_COALESCE_TIME);
+        writePendingConfig();
+    }
+}
 
-    m_currentConfig.crc = calculateCrc(m_currentConfig);
+void ConfigService::writePendingConfig()
+{
+    std::uint32_t generation = 0;
 
-    std::size_t remainingBytes = sizeof(Config);
-    std::uint16_t currentPage = FIRST_CONFIG_PAGE;
-    auto currentPtr = reinterpret_cast<const uint32_t*>(&m_currentConfig);
-    auto storedPtr = reinterpret_cast<const uint32_t*>(&m_storedConfig);
-    std::array<bool, CONFIG_PAGES> writeFlags {};
+    {
+        auto config = Device::get().getConfigService();
+        generation = m_requestedGeneration;
+        if (generation <= m_committedGeneration) {
+            return;
+        }
+    }
 
-    auto eeprom = Device::get().getEepromDriver();
-    eeprom->enableWrites();
+    if (writeConfig()) {
+        m_committedGeneration = generation;
+    } else {
+        m_failedGeneration = generation;
+        Device::get().setError(Device::ErrorCode::EEPROM_ERROR);
+    }
+}
 
-    // Overwrite first copy of config
-    while (remainingBytes > 0) {
-        std::size_t pageBytes = remainingBytes;
-        if (pageBytes > EepromDriver::EEPROM_PAGE_SIZE_BYTES) {
-            pageBytes = EepromDriver::EEPROM_PAGE_SIZE_BYTES;
+bool ConfigService::writeConfig()
+{
+    std::bitset<RECORD_COUNT> dirtyRecords;
+    std::uint32_t stagedSize = 0;
+    bool staged = false;
+
+    {
+        // The dirty records are copied out under the lock, so a commit is
+        // stored as a whole. The EEPROM is written without the lock.
+        auto config = Device::get().getConfigService();
+        dirtyRecords = m_dirtyRecords;
+        m_dirtyRecords.reset();
+
+        if (!m_needCompaction) {
+            staged = stageChanges(dirtyRecords, stagedSize);
         }
+    }
+
+    auto success = staged ? appendStaged(stagedSize) : compactJournal();
+
+    if (!success) {
+        // The records are written again with the next write
+        auto config = Device::get().getConfigService();
+        m_dirtyRecords |= dirtyRecords;
+    }
+
+    return success;
+}
+
+void ConfigService::writeDiagnostics(ArduinoJson::JsonObject out) const
+{
+    out["replay_ms"] = m_replayTimeMs;
+    out["journal_records"] = m_replayedRecords;
+    out["journal_bytes"] = m_journalEnd;
+    out["compactions"] = m_compactions;
+}
+
+std::uint16_t ConfigService::getAreaAddress(std::uint32_t area)
+{
+    return (area ? SECOND_CONFIG_PAGE : FIRST_CONFIG_PAGE) * EepromDriver::EEPROM_PAGE_SIZE_BYTES;
+}
+
+bool ConfigService::loadJournal()
+{
+    std::array<JournalAreaHeader, 2> headers {};
+    std::array<bool, 2> valid {};
+
+    for (std::uint32_t area = 0; area < headers.size(); ++area) {
+        auto& header = headers.at(area);
+
+        valid.at(area) = Device::get().getEepromQueue().readObject(getAreaAddress(area), header)
+            && header.magic == JOURNAL_MAGIC
+            && header.check == calculateJournalCheck(header.sequence);
+    }
+
+    if (!valid[0] && !valid[1]) {
+        return false;
+    }
+
+    if (valid[0] && valid[1]) {
+        m_activeArea = static_cast<std::int32_t>(headers[1].sequence - headers[0].sequence) > 0 ? 1 : 0;
+    } else {
+        m_activeArea = valid[1] ? 1 : 0;
+    }
 
-        bool same = !m_needFullWrite && compareWords(currentPtr, storedPtr, pageBytes / sizeof(std::uint32_t));
-        if (!same) {
-            writeFlags.at(currentPage) = true;
-            if (!eeprom->writePage(currentPage,
-                    reinterpret_cast<const uint8_t*>(currentPtr), pageBytes)) {
+    m_sequence = headers.at(m_activeArea).sequence;
+
+    resetToDefault();
+    std::uint32_t committedEnd = 0;
+    auto end = replayJournal(m_activeArea, m_sequence, JOURNAL_AREA_SIZE, committedEnd);
+
+    if (end != committedEnd) {
+        // The last commit was cut short, replay again without it
+        resetToDefault();
+        replayJournal(m_activeArea, m_sequence, committedEnd, committedEnd);
+    }
+
+    m_journalEnd = committedEnd;
+    return true;
+}
 
-                eeprom->disableWrites();
-                return false;
+std::uint32_t ConfigService::replayJournal(std::uint32_t area, std::uint32_t sequence,
+    std::uint32_t limit, std::uint32_t& committedEnd)
+{
+    // Records are read through a window of two pages, so the area is read
+    // in a few large transfers instead of two small ones per record
+    std::array<std::uint8_t, 2 * MAX_RECORD_SIZE> window {};
+    std::array<std::uint32_t, MAX_RECORD_SIZE / sizeof(std::uint32_t)> record {};
+    auto address = getAreaAddress(area);
+    std::uint32_t offset = sizeof(JournalAreaHeader);
+    std::uint32_t windowStart = offset;
+    std::uint32_t windowSize = 0;
+
+    committedEnd = offset;
+    m_replayedRecords = 0;
+
+    while (offset + sizeof(JournalRecordHeader) <= limit) {
+        auto windowEnd = windowStart + windowSize;
+
+        if (offset + MAX_RECORD_SIZE > windowEnd && windowEnd < limit) {
+            // Keep the bytes already read and fill up the rest
+            auto kept = windowEnd - offset;
+            std::memmove(window.data(), window.data() + offset - windowStart, kept);
+            auto size = std::min<std::uint32_t>(window.size() - kept, limit - windowEnd);
+
+            if (!Device::get().getEepromQueue().readSync(address + windowEnd, window.data() + kept, size)) {
+                break;
             }
+
+            windowStart = offset;
+            windowSize = kept + size;
         }
 
-        currentPtr += PAGE_WORDS;
-        storedPtr += PAGE_WORDS;
-        remainingBytes -= pageBytes;
-        ++currentPage;
-    }
+        JournalRecordHeader header {};
+        std::memcpy(&header, window.data() + offset - windowStart, sizeof(header));
+
+        auto size = getRecordSize(header.length);
+        if (header.length > MAX_PAYLOAD_SIZE || offset + size > windowStart + windowSize) {
+            break;
+        }
+
+        std::memcpy(record.data(), window.data() + offset - windowStart, size);
+        if (calculateRecordCrc(record.data(), size, sequence) != header.crc) {
+            break;
+        }
 
-    // Overwrite second copy of config
-    remainingBytes = sizeof(Config);
-    currentPage = SECOND_CONFIG_PAGE;
-    currentPtr = reinterpret_cast<const uint32_t*>(&m_currentConfig);
+        // Unknown types come from newer firmware and are skipped
+        auto field = std::find_if(FIELDS.begin(), FIELDS.end(),
+            [&](auto& field) { return field.type == header.type; });
 
-    while (remainingBytes > 0) {
-        std::size_t pageBytes = remainingBytes;
-        if (pageBytes > EepromDriver::EEPROM_PAGE_SIZE_BYTES) {
-            pageBytes = EepromDriver::EEPROM_PAGE_SIZE_BYTES;
+        if (field != FIELDS.end() && header.index < field->count && header.length == field->size) {
+            auto element = reinterpret_cast<std::uint8_t*>(&m_currentConfig) + field->offset + header.index * field->size;
+            std::memcpy(element, record.data() + sizeof(header) / sizeof(std::uint32_t), field->size);
         }
 
-        if (writeFlags.at(currentPage - SECOND_CONFIG_PAGE)) {
-            if (!eeprom->writePage(currentPage,
-                    reinterpret_cast<const uint8_t*>(currentPtr), pageBytes)) {
+        ++m_replayedRecords;
+        offset += size;
+
+        if (header.flags & RECORD_COMMIT_FLAG) {
+            committedEnd = offset;
+        }
+    }
+
+    return offset;
+}
+
+bool ConfigService::stageChanges(const std::bitset<RECORD_COUNT>& dirtyRecords, std::uint32_t& size)
+{
+    std::uint32_t changedRecords = dirtyRecords.count();
+    size = 0;
 
-                eeprom->disableWrites();
-                return false;
+    for (std::size_t f = 0; f < FIELDS.size(); ++f) {
+        for (std::size_t i = 0; i < FIELDS[f].count; ++i) {
+            if (dirtyRecords.test(getFirstRecord(f) + i)) {
+                size += getRecordSize(FIELDS[f].size);
             }
         }
+    }
 
-        currentPtr += PAGE_WORDS;
-        remainingBytes -= pageBytes;
-        ++currentPage;
+    // Large changes, like a reset to defaults, are cheaper as a compaction
+    if (size > STAGING_SIZE || m_journalEnd + size > JOURNAL_AREA_SIZE) {
+        return false;
     }
 
-    eeprom->disableWrites();
-    copyCurrentToStored();
-    m_needFullWrite = false;
+    std::uint32_t offset = 0;
+
+    for (std::size_t f = 0; f < FIELDS.size(); ++f) {
+        for (std::size_t i = 0; i < FIELDS[f].count; ++i) {
+            if (dirtyRecords.test(getFirstRecord(f) + i)) {
+                offset += buildRecord(m_stagedRecords.data() + offset / sizeof(std::uint32_t),
+                    m_sequence, f, i, --changedRecords == 0);
+            }
+        }
+    }
 
     return true;
 }
 
-bool ConfigService::readConfigFromEeprom()
+bool ConfigService::appendStaged(std::uint32_t size)
 {
-    auto eeprom = Device::get().getEepromDriver();
+    if (!size) {
+        return true;
+    }
 
-    if (!eeprom->readObject(
-            FIRST_CONFIG_PAGE * EepromDriver::EEPROM_PAGE_SIZE_BYTES, m_currentConfig)) {
+    writeJournalBytes(getAreaAddress(m_activeArea) + m_journalEnd,
+        reinterpret_cast<const std::uint8_t*>(m_stagedRecords.data()), size, EepromQueue::Priority::NORMAL);
 
-        resetToDefault();
+    // Without the commit flag, records written before a failed one are ignored
+    if (!finishJournalWrites(EepromQueue::Priority::NORMAL)) {
         return false;
     }
 
-    auto correctCrc = calculateCrc(m_currentConfig);
-    if (m_currentConfig.crc != correctCrc) {
-        if (!eeprom->readObject(
-                SECOND_CONFIG_PAGE * EepromDriver::EEPROM_PAGE_SIZE_BYTES, m_currentConfig)) {
+    m_journalEnd += size;
+    return true;
+}
 
-            resetToDefault();
-            return false;
+bool ConfigService::compactJournal()
+{
+    // Elements left at their default value need no record, the replay
+    // starts from the defaults. A failed compaction is retried on the
+    // next write.
+    m_needCompaction = true;
+
+    auto area = m_activeArea ^ 1;
+    auto sequence = m_sequence + 1;
+    std::uint32_t offset = sizeof(JournalAreaHeader);
+
+    for (std::size_t f = 0; f < FIELDS.size(); ++f) {
+        auto& field = FIELDS.at(f);
+
+        for (std::size_t i = 0; i < field.count; ++i) {
+            std::array<std::uint32_t, MAX_RECORD_SIZE / sizeof(std::uint32_t)> record {};
+            std::uint32_t size = 0;
+
+            {
+                // Locked per element, an element changed after its copy is
+                // marked dirty again and appended by the next write
+                auto config = Device::get().getConfigService();
+                if (!isDefaultElement(m_currentConfig, field, i)) {
+                    size = buildRecord(record.data(), sequence, f, i, true);
+                }
+            }
+
+            if (size) {
+                writeJournalBytes(getAreaAddress(area) + offset, reinterpret_cast<const std::uint8_t*>(record.data()),
+                    size, EepromQueue::Priority::BACKGROUND);
+                offset += size;
+            }
         }
+    }
 
-        correctCrc = calculateCrc(m_currentConfig);
-        if (m_currentConfig.crc != correctCrc) {
-            resetToDefault();
-            return false;
+    // The header makes the area active, so it goes out once every record is stored
+    if (!finishJournalWrites(EepromQueue::Priority::BACKGROUND)) {
+        return false;
+    }
+
+    JournalAreaHeader header {};
+    header.magic = JOURNAL_MAGIC;
+    header.sequence = sequence;
+    header.check = calculateJournalCheck(sequence);
+
+    writeJournalBytes(getAreaAddress(area), reinterpret_cast<const std::uint8_t*>(&header), sizeof(header),
+        EepromQueue::Priority::BACKGROUND);
+
+    if (!finishJournalWrites(EepromQueue::Priority::BACKGROUND)) {
+        return false;
+    }
+
+    m_activeArea = area;
+    m_sequence = sequence;
+    m_journalEnd = offset;
+    m_needCompaction = false;
+    ++m_compactions;
+    return true;
+}
+
+std::uint32_t ConfigService::buildRecord(std::uint32_t* record, std::uint32_t sequence,
+    std::size_t fieldIndex, std::size_t index, bool lastInCommit)
+{
+    auto& field = FIELDS.at(fieldIndex);
+    auto size = getRecordSize(field.size);
+
+    JournalRecordHeader header {};
+    header.type = field.type;
+    header.index = index;
+    header.length = field.size;
+    header.flags = lastInCommit ? RECORD_COMMIT_FLAG : 0;
+
+    // Keeps the padding of the payload zeroed, it is covered by the CRC
+    std::fill_n(record, size / sizeof(std::uint32_t), 0);
+    std::memcpy(record, &header, sizeof(header));
+    std::memcpy(record + sizeof(header) / sizeof(std::uint32_t), getElement(m_currentConfig, field, index), field.size);
+    record[0] = calculateRecordCrc(record, size, sequence);
+
+    return size;
+}
+
+// Queued without waiting, consecutive records are merged into page writes
+// by the queue. Splits the write at page boundaries, the EEPROM wraps
+// around within a page.
+void ConfigService::writeJournalBytes(std::uint16_t address, const std::uint8_t* data, std::size_t size,
+    EepromQueue::Priority priority)
+{
+    auto& queue = Device::get().getEepromQueue();
+
+    while (size > 0) {
+        auto pageLeft = EepromDriver::EEPROM_PAGE_SIZE_BYTES - address % EepromDriver::EEPROM_PAGE_SIZE_BYTES;
+        auto chunk = std::min<std::size_t>(size, pageLeft);
+
+        if (!queue.write(address, data, chunk, priority, &ConfigService::journalWriteFinished, this)) {
+            m_journalWriteFailed = true;
         }
+
+        address += chunk;
+        data += chunk;
+        size -= chunk;
     }
+}
+
+void ConfigService::journalWriteFinished(void* context, bool success)
+{
+    if (!success) {
+        static_cast<ConfigService*>(context)->m_journalWriteFailed = true;
+    }
+}
+
+bool ConfigService::finishJournalWrites(EepromQueue::Priority priority)
+{
+    Device::get().getEepromQueue().flush(priority);
+
+    bool success = !m_journalWriteFailed;
+    m_journalWriteFailed = false;
+    return success;
+}
+
+bool ConfigService::readLegacyConfig(std::uint16_t page)
+{
+    if (!Device::get().getEepromQueue().readObject(page * EepromDriver::EEPROM_PAGE_SIZE_BYTES, m_currentConfig)) {
+        return false;
+    }
+
+    if (m_currentConfig.crc != calculateCrc(m_currentConfig)
+        || !isConfigSupported(m_currentConfig.configVersion)) {
 
-    if (!isConfigSupported(m_currentConfig.configVersion)) {
-        resetToDefault();
         return false;
     }
 
     if (m_currentConfig.configVersion != CURRENT_CONFIG_VERSION) {
         migrate();
-        return false;
     }
 
     return true;
@@ -198,9 +774,4 @@ std::uint32_t ConfigService::calculateCrc(Config& config)
     return crc;
 }
 
-void ConfigService::copyCurrentToStored()
-{
-    memcpy(&m_storedConfig, &m_currentConfig, sizeof(Config));
-}
-
 };
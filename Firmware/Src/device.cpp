@@ -46,6 +46,7 @@ Device& Device::get()
 void Device::initializeDrivers()
 {
     m_eepromDriver->initialize();
+    m_eepromQueue.initialize();
     m_espDriver.initialize();
     m_flashDriver->initialize();
     m_oledDriver->initialize();
@@ -53,6 +54,7 @@ void Device::initializeDrivers()
     m_loraDriver->initialize();
 
     m_cronService->initialize();
+    m_flashStore->initialize();
     m_configService->initialize();
     m_networkManager->initialize();
     m_server->initialize();
@@ -92,6 +94,13 @@ void Device::updateRtcTime(const UtcTime& newTime)
     getHistoryService()->timeUpdated();
 }
 
+bool Device::waitForConfigCommit(std::uint32_t generation, TickType_t timeout)
+{
+    // The generations are read without the lock on purpose, the writer
+    // takes it to snapshot the config
+    return m_configService->waitForCommit(generation, timeout);
+}
+
 bool Device::setLocalTimezone(const char* timezoneName)
 {
     uzone_t tempZone {};
@@ -106,6 +115,7 @@ bool Device::setLocalTimezone(const char* timezoneName)
 
     portENTER_CRITICAL();
     ::memcpy(m_currentZone.get(), &tempZone, sizeof(tempZone));
+    m_timezoneRevision = m_timezoneRevision + 1;
     portEXIT_CRITICAL();
 
     return true;
@@ -125,6 +135,7 @@ bool Device::setLocalTimezone(std::uint32_t timezoneId)
 
     portENTER_CRITICAL();
     ::memcpy(m_currentZone.get(), &tempZone, sizeof(tempZone));
+    m_timezoneRevision = m_timezoneRevision + 1;
     portEXIT_CRITICAL();
 
     return true;
@@ -293,6 +304,34 @@ extern "C" void I2C2_EV_IRQHandler(void)
     }
 }
 
+extern "C" void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef* huart, std::uint16_t)
+{
+    if (huart == &huart1) {
+        auto higherPriorityWoken
+            = lg::Device::get().getEspAtDriver().notifyRxEventFromIsr();
+        portYIELD_FROM_ISR(higherPriorityWoken);
+    }
+}
+
+extern "C" void QUADSPI_IRQHandler(void)
+{
+    HAL_QSPI_IRQHandler(&hqspi);
+}
+
+extern "C" void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef*)
+{
+    auto higherPriorityWoken
+        = lg::Device::get().getFlashDriver()->notifyStatusMatchFromIsr(true);
+    portYIELD_FROM_ISR(higherPriorityWoken);
+}
+
+extern "C" void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef*)
+{
+    auto higherPriorityWoken
+        = lg::Device::get().getFlashDriver()->notifyStatusMatchFromIsr(false);
+    portYIELD_FROM_ISR(higherPriorityWoken);
+}
+
 extern "C" void HAL_GPIO_EXTI_Callback(std::uint16_t pin)
 {
     switch (pin) {
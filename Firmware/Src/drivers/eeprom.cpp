@@ -5,8 +5,6 @@
 #include <array>
 #include <cstdint>
 
-#include <stm32f7xx_ll_i2c.h>
-
 namespace lg {
 
 void EepromDriver::initialize()
@@ -81,7 +79,7 @@ BaseType_t EepromDriver::notifyDmaFinishedFromIsr(bool tx)
 
     if (task) {
         BaseType_t higherPriorityWoken = 0;
-        xTaskNotifyFromISR(task, tx ? I2C_TX : I2C_RX, eSetBits, &higherPriorityWoken);
+        xTaskNotifyIndexedFromISR(task, I2C_NOTIFY_INDEX, tx ? I2C_TX : I2C_RX, eSetBits, &higherPriorityWoken);
         return higherPriorityWoken;
     }
 
@@ -100,6 +98,10 @@ void EepromDriver::enableWrites()
 
 bool EepromDriver::readBytesDirect(uint16_t eepromAddress, uint8_t* out, size_t count)
 {
+    if (!waitForOperation()) {
+        return false;
+    }
+
     auto result = HAL_I2C_Mem_Read(m_i2c, I2C_ADDRESS, eepromAddress,
         sizeof(std::uint16_t), out, count, OP_TIMEOUT_MS);
     return result == HAL_OK;
@@ -107,9 +109,11 @@ bool EepromDriver::readBytesDirect(uint16_t eepromAddress, uint8_t* out, size_t
 
 bool EepromDriver::readBytesDma(uint16_t eepromAddress, uint8_t* out, size_t count)
 {
-    m_suspendedTask = xTaskGetCurrentTaskHandle();
+    if (!waitForOperation()) {
+        return false;
+    }
 
-    xTaskNotifyWait(0, I2C_RX, nullptr, 0);
+    prepareTransfer();
 
     auto result = HAL_I2C_Mem_Read_DMA(m_i2c, I2C_ADDRESS, eepromAddress,
         sizeof(std::uint16_t), out, count);
@@ -118,7 +122,7 @@ bool EepromDriver::readBytesDma(uint16_t eepromAddress, uint8_t* out, size_t cou
     }
 
     // Wait for the DMA transaction to finish
-    xTaskNotifyWait(0, I2C_RX, NULL, portMAX_DELAY);
+    waitForTransfer(I2C_RX, portMAX_DELAY);
 
     return true;
 }
@@ -149,23 +153,29 @@ bool EepromDriver::performWritePage(uint16_t pageNumber, const uint8_t* in, size
 
 bool EepromDriver::writeBytesDirect(uint16_t eepromAddress, const uint8_t* in, size_t count)
 {
-    waitForOperation();
+    if (!waitForOperation()) {
+        return false;
+    }
+
     auto result = HAL_I2C_Mem_Write(m_i2c, I2C_ADDRESS, eepromAddress,
         sizeof(std::uint16_t), const_cast<uint8_t*>(in), count, OP_TIMEOUT_MS);
 
     if (result != HAL_OK) {
         Device::get().setError(Device::ErrorCode::EEPROM_ERROR);
+        return false;
     }
 
-    return result == HAL_OK;
+    startWriteCycle();
+    return true;
 }
 
 bool EepromDriver::writeBytesDma(uint16_t eepromAddress, const uint8_t* in, size_t count)
 {
-    m_suspendedTask = xTaskGetCurrentTaskHandle();
-    waitForOperation();
+    if (!waitForOperation()) {
+        return false;
+    }
 
-    xTaskNotifyWait(0, I2C_TX, nullptr, 0);
+    prepareTransfer();
 
     auto result = HAL_I2C_Mem_Write_DMA(m_i2c, I2C_ADDRESS, eepromAddress,
         sizeof(std::uint16_t), const_cast<uint8_t*>(in), count);
@@ -175,48 +185,120 @@ bool EepromDriver::writeBytesDma(uint16_t eepromAddress, const uint8_t* in, size
     }
 
     // Wait for the DMA transaction to finish
-    xTaskNotifyWait(0, I2C_TX, NULL, portMAX_DELAY);
+    waitForTransfer(I2C_TX, portMAX_DELAY);
 
+    startWriteCycle();
     return true;
 }
 
-void EepromDriver::waitForOperation()
+bool EepromDriver::waitForOperation()
 {
-    auto i2c = m_i2c->Instance;
+    if (!m_writeCyclePending) {
+        return true;
+    }
 
-    while (LL_I2C_IsActiveFlag_BUSY(i2c))
-        ;
+    auto startTicks = HAL_GetTick();
 
-    LL_I2C_SetSlaveAddr(i2c, I2C_ADDRESS);
-    LL_I2C_SetTransferRequest(i2c, LL_I2C_REQUEST_WRITE);
-    LL_I2C_SetTransferSize(i2c, 0);
-    LL_I2C_EnableAutoEndMode(i2c);
+    auto elapsed = startTicks - m_writeCycleStartTicks;
+    if (elapsed < WRITE_OP_TIME_MS) {
+        delay(WRITE_OP_TIME_MS - elapsed);
+    }
 
-    while (true) {
-        while (LL_I2C_IsActiveFlag_BUSY(i2c))
-            ;
+    // The cycle usually ends earlier than the datasheet maximum, so the
+    // first poll mostly succeeds
+    while (!pollAcknowledge()) {
+        ++m_stats.busyNacks;
 
-        LL_I2C_ClearFlag_NACK(i2c);
-        LL_I2C_ClearFlag_STOP(i2c);
-        LL_I2C_GenerateStartCondition(i2c);
+        if (HAL_GetTick() - startTicks >= OP_TIMEOUT_MS) {
+            Device::get().setError(Device::ErrorCode::EEPROM_ERROR);
+            return false;
+        }
 
-        while (!LL_I2C_IsActiveFlag_STOP(i2c) && !LL_I2C_IsActiveFlag_NACK(i2c))
-            ;
+        delay(1);
+    }
 
-        if (LL_I2C_IsActiveFlag_NACK(i2c)) {
-            LL_I2C_ClearFlag_NACK(i2c);
+    m_writeCyclePending = false;
+    m_stats.waitTimeMs += HAL_GetTick() - startTicks;
+    return true;
+}
 
-            if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
-                vTaskDelay(1);
+bool EepromDriver::pollAcknowledge()
+{
+    ++m_stats.ackPolls;
+
+    if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+        return HAL_I2C_IsDeviceReady(m_i2c, I2C_ADDRESS, 1, OP_TIMEOUT_MS) == HAL_OK;
+    }
+
+    // Address only transfer, the STOP interrupt wakes the task for both
+    // the acknowledge and the NACK
+    static std::uint8_t dummy {};
+
+    prepareTransfer();
+
+    if (HAL_I2C_Master_Transmit_IT(m_i2c, I2C_ADDRESS, &dummy, 0) != HAL_OK) {
+        return false;
+    }
+
+    if (!waitForTransfer(I2C_TX, OP_TIMEOUT_MS)) {
+        return false;
+    }
+
+    return HAL_I2C_GetError(m_i2c) == HAL_I2C_ERROR_NONE;
+}
+
+void EepromDriver::prepareTransfer()
+{
+    m_suspendedTask = xTaskGetCurrentTaskHandle();
+
+    // Drop a completion left over from an earlier transfer
+    xTaskNotifyWaitIndexed(I2C_NOTIFY_INDEX, 0, I2C_TX | I2C_RX, nullptr, 0);
+}
+
+bool EepromDriver::waitForTransfer(std::uint32_t bit, TickType_t timeout)
+{
+    auto startTicks = xTaskGetTickCount();
+    std::uint32_t notifiedValue = 0;
+
+    while (!(notifiedValue & bit)) {
+        TickType_t remaining = portMAX_DELAY;
+
+        if (timeout != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - startTicks;
+            if (elapsed >= timeout) {
+                return false;
             }
 
-            continue;
+            remaining = timeout - elapsed;
         }
 
-        if (LL_I2C_IsActiveFlag_STOP(i2c)) {
-            LL_I2C_ClearFlag_STOP(i2c);
-            break;
-        }
+        xTaskNotifyWaitIndexed(I2C_NOTIFY_INDEX, 0, bit, &notifiedValue, remaining);
+    }
+
+    return true;
+}
+
+void EepromDriver::writeDiagnostics(ArduinoJson::JsonObject out) const
+{
+    out["write_cycles"] = m_stats.writeCycles;
+    out["ack_polls"] = m_stats.ackPolls;
+    out["busy_nacks"] = m_stats.busyNacks;
+    out["wait_ms"] = m_stats.waitTimeMs;
+}
+
+void EepromDriver::startWriteCycle()
+{
+    m_writeCyclePending = true;
+    m_writeCycleStartTicks = HAL_GetTick();
+    ++m_stats.writeCycles;
+}
+
+void EepromDriver::delay(std::uint32_t millis)
+{
+    if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+        vTaskDelay(millis);
+    } else {
+        HAL_Delay(millis);
     }
 }
 
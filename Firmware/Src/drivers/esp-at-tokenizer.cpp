@@ -0,0 +1,142 @@
+#include <drivers/esp-at-tokenizer.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace lg {
+
+void EspAtTokenizer::process(std::size_t writeIndex)
+{
+    while (m_readIndex != writeIndex) {
+        // Contiguous bytes up to the write position or the end of the buffer
+        const char* data = m_buffer + m_readIndex;
+        std::size_t available = (writeIndex > m_readIndex ? writeIndex : m_size) - m_readIndex;
+
+        if (m_dataRemaining) {
+            auto size = std::min({ available, m_dataRemaining, std::size_t(MAX_DATA_CHUNK_SIZE) });
+
+            m_handler.gotData(m_dataLinkId, data, size);
+            m_dataRemaining -= size;
+            advance(size);
+            continue;
+        }
+
+        if (!m_lineLength) {
+            if (*data == '>' && m_handler.gotPrompt()) {
+                advance(1);
+                continue;
+            }
+
+            m_lineStart = m_readIndex;
+            m_headerPending = *data == '+';
+        }
+
+        auto newline = static_cast<const char*>(std::memchr(data, '\n', available));
+        std::size_t lineBytes = newline ? newline - data : available;
+
+        if (m_headerPending) {
+            if (auto colon = static_cast<const char*>(std::memchr(data, ':', lineBytes))) {
+                m_headerPending = false;
+                consume(colon - data + 1);
+                finishHeader();
+                continue;
+            }
+        }
+
+        if (!newline) {
+            consume(available);
+            continue;
+        }
+
+        consume(lineBytes + 1);
+        finishLine();
+    }
+}
+
+void EspAtTokenizer::advance(std::size_t size)
+{
+    m_readIndex += size;
+    if (m_readIndex >= m_size) {
+        m_readIndex = 0;
+    }
+}
+
+void EspAtTokenizer::consume(std::size_t size)
+{
+    m_lineLength += size;
+    advance(size);
+}
+
+void EspAtTokenizer::finishHeader()
+{
+    if (m_lineLength > MAX_LINE_SIZE) {
+        return;
+    }
+
+    auto header = getLine(m_lineLength);
+
+    if (header.starts_with("+IPD,")) {
+        parseInputHeader(header);
+        m_lineLength = 0;
+    } else if (m_handler.gotNotification(header)) {
+        m_lineLength = 0;
+    }
+}
+
+void EspAtTokenizer::finishLine()
+{
+    auto size = m_lineLength;
+    m_lineLength = 0;
+
+    if (size > MAX_LINE_SIZE) {
+        return;
+    }
+
+    auto line = getLine(size);
+    line.remove_suffix(1);
+
+    if (line.ends_with('\r')) {
+        line.remove_suffix(1);
+    }
+
+    m_handler.gotLine(line);
+}
+
+void EspAtTokenizer::parseInputHeader(std::string_view header)
+{
+    // +IPD,<link ID>,<length>:
+    auto end = header.data() + header.size() - 1;
+    int linkId = 0;
+    std::size_t size = 0;
+
+    auto [linkIdEnd, linkIdError] = std::from_chars(header.data() + 5, end, linkId);
+    if (linkIdError != std::errc() || linkIdEnd == end || *linkIdEnd != ',') {
+        return;
+    }
+
+    auto [sizeEnd, sizeError] = std::from_chars(linkIdEnd + 1, end, size);
+    if (sizeError != std::errc() || sizeEnd != end) {
+        return;
+    }
+
+    if (m_handler.gotInputHeader(linkId, size)) {
+        m_dataLinkId = linkId;
+        m_dataRemaining = size;
+    }
+}
+
+std::string_view EspAtTokenizer::getLine(std::size_t size)
+{
+    if (m_lineStart + size <= m_size) {
+        return { m_buffer + m_lineStart, size };
+    }
+
+    auto firstPart = m_size - m_lineStart;
+    std::copy_n(m_buffer + m_lineStart, firstPart, m_wrapBuffer.begin());
+    std::copy_n(m_buffer, size - firstPart, m_wrapBuffer.begin() + firstPart);
+
+    return { m_wrapBuffer.data(), size };
+}
+
+};
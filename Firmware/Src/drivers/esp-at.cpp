@@ -2,6 +2,7 @@
 
 #include <device.hpp>
 
+#include <algorithm>
 #include <array>
 #include <cstring>
 
@@ -61,8 +62,6 @@ void EspAtDriver::initialize()
         &m_connectionCloserTaskTcb /* Task control block */
     );
 
-    m_mutex = xSemaphoreCreateMutexStatic(&m_mutexBuffer);
-
     m_connectionsToCloseHandle = xQueueCreateStatic(
         m_connectionsToCloseBuffer.size(),
         sizeof(m_connectionsToCloseBuffer[0]),
@@ -72,7 +71,7 @@ void EspAtDriver::initialize()
 
 auto EspAtDriver::startTcpServer(std::uint16_t portNumber) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
     m_txLineBuffer = "AT+CIPSERVER=1,";
     m_txLineBuffer += StaticString<5>::Of(portNumber);
@@ -82,7 +81,7 @@ auto EspAtDriver::startTcpServer(std::uint16_t portNumber) -> EspResponse
 
 auto EspAtDriver::stopTcpServer() -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
     return sendCommandDirectAndWait("AT+CIPSERVER=0,1");
 }
@@ -91,7 +90,7 @@ auto EspAtDriver::closeConnection(int linkId) -> EspResponse
 {
     m_connectionOpen.at(linkId) = false;
 
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::DATA);
     clearResponsePrefix();
     m_txLineBuffer = "AT+CIPCLOSE=";
     m_txLineBuffer += StaticString<1>::Of(linkId);
@@ -104,7 +103,7 @@ auto EspAtDriver::closeAllConnections() -> EspResponse
     static const auto falsch = false;
     m_connectionOpen.fill(falsch);
 
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
     return sendCommandDirectAndWait("AT+CIPCLOSE=5");
 }
@@ -113,7 +112,10 @@ auto EspAtDriver::sendData(
     int linkId, const char* data, std::size_t size) -> EspResponse
 {
     static constexpr auto MAX_PROMPT_WAIT_TIME = 1000; // Wait for 1s
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::DATA, linkId);
+    if (!lock) {
+        return lock.getResponse();
+    }
 
     m_connectionLastActivity.at(linkId) = xTaskGetTickCount();
     clearResponsePrefix();
@@ -131,7 +133,14 @@ auto EspAtDriver::sendData(
         return response;
     }
 
+    auto promptWaitStart = xTaskGetTickCount();
     while (m_waitingForPrompt) {
+        if (xTaskGetTickCount() - promptWaitStart > MAX_PROMPT_WAIT_TIME) {
+            m_waitingForPrompt = false;
+            m_requestInitiator = nullptr;
+            return EspResponse::ESP_TIMEOUT;
+        }
+
         vTaskDelay(1);
     }
 
@@ -149,6 +158,7 @@ auto EspAtDriver::sendData(
 
     bool gotRx = xTaskNotifyWait(0, ESP_RX_DONE, nullptr, MAX_PROMPT_WAIT_TIME);
     if (!gotRx) {
+        m_requestInitiator = nullptr;
         return EspResponse::ESP_TIMEOUT;
     }
 
@@ -157,7 +167,7 @@ auto EspAtDriver::sendData(
 
 auto EspAtDriver::setWifiMode(EspWifiMode mode) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
     m_txLineBuffer = "AT+CWMODE=";
     m_txLineBuffer += StaticString<1>::Of(static_cast<int>(mode));
@@ -168,7 +178,7 @@ auto EspAtDriver::setWifiMode(EspWifiMode mode) -> EspResponse
 auto EspAtDriver::joinAccessPoint(const char* ssid, const char* password) -> EspResponse
 {
     static constexpr auto COMMAND_TIMEOUT = 30000;
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
 
     m_txLineBuffer = "AT+CWJAP=";
@@ -192,7 +202,11 @@ auto EspAtDriver::listAccessPoints(StaticVector<AccessPoint, ESP_AP_LIST_SIZE>&
 {
     static constexpr auto COMMAND_TIMEOUT = 10000;
 
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::HOUSEKEEPING);
+    if (!lock) {
+        return lock.getResponse();
+    }
+
     setResponsePrefix("+CWLAP:");
 
     auto response = sendCommandDirectAndWait("AT+CWLAP", COMMAND_TIMEOUT);
@@ -230,7 +244,7 @@ auto EspAtDriver::listAccessPoints(StaticVector<AccessPoint, ESP_AP_LIST_SIZE>&
 
 auto EspAtDriver::quitAccessPoint() -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
     return sendCommandDirectAndWait("AT+CWQAP");
 }
@@ -238,7 +252,7 @@ auto EspAtDriver::quitAccessPoint() -> EspResponse
 auto EspAtDriver::setupSoftAp(const char* ssid,
     const char* password, int channel, Encryption encryption) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
     m_txLineBuffer = "AT+CWSAP=";
     appendAtString(ssid);
@@ -254,7 +268,11 @@ auto EspAtDriver::setupSoftAp(const char* ssid,
 
 auto EspAtDriver::queryStationIp(StaticString<ESP_IP_STRING_SIZE>& out) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::HOUSEKEEPING);
+    if (!lock) {
+        return lock.getResponse();
+    }
+
     setResponsePrefix("+CIPSTA:ip:");
 
     auto response = sendCommandDirectAndWait("AT+CIPSTA?");
@@ -270,7 +288,7 @@ auto EspAtDriver::queryStationIp(StaticString<ESP_IP_STRING_SIZE>& out) -> EspRe
 
 auto EspAtDriver::disableMdns() -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
     return sendCommandDirectAndWait("AT+MDNS=0");
 }
@@ -278,7 +296,7 @@ auto EspAtDriver::disableMdns() -> EspResponse
 auto EspAtDriver::enableMdns(
     const char* hostname, const char* service, std::uint16_t port) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
     m_txLineBuffer = "AT+MDNS=1,";
     appendAtString(hostname);
@@ -293,7 +311,7 @@ auto EspAtDriver::enableMdns(
 
 auto EspAtDriver::setHostname(const char* hostname) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
 
     m_txLineBuffer = "AT+CWHOSTNAME=";
@@ -305,7 +323,11 @@ auto EspAtDriver::setHostname(const char* hostname) -> EspResponse
 
 auto EspAtDriver::getRssi(int& rssiOut) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::HOUSEKEEPING);
+    if (!lock) {
+        return lock.getResponse();
+    }
+
     setResponsePrefix("+CWJAP:");
     auto response = sendCommandDirectAndWait("AT+CWJAP?");
 
@@ -343,7 +365,11 @@ auto EspAtDriver::getRssi(int& rssiOut) -> EspResponse
 
 auto EspAtDriver::getStationMacAddress(StaticString<ESP_MAC_STRING_SIZE>& out) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::HOUSEKEEPING);
+    if (!lock) {
+        return lock.getResponse();
+    }
+
     setResponsePrefix("+CIPSTAMAC:");
     auto response = sendCommandDirectAndWait("AT+CIPSTAMAC?");
 
@@ -358,7 +384,11 @@ auto EspAtDriver::getStationMacAddress(StaticString<ESP_MAC_STRING_SIZE>& out) -
 
 auto EspAtDriver::getApMacAddress(StaticString<ESP_MAC_STRING_SIZE>& out) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::HOUSEKEEPING);
+    if (!lock) {
+        return lock.getResponse();
+    }
+
     setResponsePrefix("+CIPAPMAC:");
     auto response = sendCommandDirectAndWait("AT+CIPAPMAC?");
 
@@ -374,7 +404,7 @@ auto EspAtDriver::getApMacAddress(StaticString<ESP_MAC_STRING_SIZE>& out) -> Esp
 auto EspAtDriver::configureSntp(int timezone,
     const char* server1, const char* server2, const char* server3) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
 
     m_txLineBuffer = "AT+CIPSNTPCFG=1,";
@@ -399,7 +429,7 @@ auto EspAtDriver::configureSntp(int timezone,
 
 auto EspAtDriver::setSntpUpdateInterval(int seconds) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
 
     m_txLineBuffer = "AT+CIPSNTPINTV=";
@@ -411,7 +441,11 @@ auto EspAtDriver::setSntpUpdateInterval(int seconds) -> EspResponse
 
 auto EspAtDriver::querySntpTime(StaticString<ESP_ASCTIME_STRING_SIZE>& asctime) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::HOUSEKEEPING);
+    if (!lock) {
+        return lock.getResponse();
+    }
+
     setResponsePrefix("+CIPSNTPTIME:");
     auto response = sendCommandDirectAndWait("AT+CIPSNTPTIME?");
 
@@ -426,7 +460,7 @@ auto EspAtDriver::querySntpTime(StaticString<ESP_ASCTIME_STRING_SIZE>& asctime)
 
 auto EspAtDriver::mqttClean() -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
     return sendCommandDirectAndWait("AT+MQTTCLEAN=0");
 }
@@ -434,7 +468,7 @@ auto EspAtDriver::mqttClean() -> EspResponse
 auto EspAtDriver::configureMqttUser(MqttScheme scheme, const char* clientId,
     const char* username, const char* password, const char* path) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
 
     m_txLineBuffer = "AT+MQTTUSERCFG=0,";
@@ -455,7 +489,7 @@ auto EspAtDriver::configureMqttUser(MqttScheme scheme, const char* clientId,
 auto EspAtDriver::mqttConnectToBroker(
     const char* host, std::uint16_t port) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
 
     m_txLineBuffer = "AT+MQTTCONN=0,";
@@ -464,13 +498,13 @@ auto EspAtDriver::mqttConnectToBroker(
     m_txLineBuffer += StaticString<5>::Of(port);
     m_txLineBuffer += ",1\r\n";
 
-    return sendCommandBufferAndWait(portMAX_DELAY);
+    return sendCommandBufferAndWait(MQTT_CONNECT_TIMEOUT_MS);
 }
 
 auto EspAtDriver::mqttPublish(
     const char* topic, const char* data, MqttQoS qos, bool retain) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
 
     m_txLineBuffer = "AT+MQTTPUB=0,";
@@ -488,7 +522,7 @@ auto EspAtDriver::mqttPublish(
 
 auto EspAtDriver::mqttSubscribe(const char* topic, MqttQoS qos) -> EspResponse
 {
-    auto lock = acquireLock();
+    auto lock = acquireLock(CommandClass::CONTROL);
     clearResponsePrefix();
 
     m_txLineBuffer = "AT+MQTTSUB=0,";
@@ -503,12 +537,13 @@ auto EspAtDriver::mqttSubscribe(const char* topic, MqttQoS qos) -> EspResponse
 void EspAtDriver::initTaskMain()
 {
     {
-        auto lock = acquireLock();
+        auto lock = acquireLock(CommandClass::CONTROL);
 
         vTaskDelay(1000);
 
-        // Enable reception via DMA
-        HAL_UART_Receive_DMA(m_usart,
+        // Enable reception via circular DMA, the IDLE line and the DMA
+        // half and full transfer interrupts wake the receive task
+        HAL_UARTEx_ReceiveToIdle_DMA(m_usart,
             reinterpret_cast<uint8_t*>(m_uartRxBuffer.data()), m_uartRxBuffer.size());
 
         sendCommandDirectAndWait("");
@@ -539,88 +574,39 @@ void EspAtDriver::initTaskMain()
 
 void EspAtDriver::uartRxTaskMain()
 {
-    uint32_t dmaReadIdx = 0;
-    StaticString<ESP_LINE_BUFFER_SIZE> lineBuffer;
-    auto crlf = STR("\r\n");
-    auto colon = STR(":");
-
-    volatile char* dmaBuffer = m_uartRxBuffer.data();
-
     while (true) {
-        while (true) {
-            closeIdleConnections();
-
-            uint32_t dmaWriteIdx = m_uartRxBuffer.size() - __HAL_DMA_GET_COUNTER(m_usart->hdmarx);
-
-            if (dmaWriteIdx >= m_uartRxBuffer.size()) {
-                // The task is not yet ready
-                break;
-            }
-
-            if (dmaReadIdx == dmaWriteIdx) {
-                // No more bytes to read
-                break;
-            }
-
-            if (m_ipdRemainingBytes > 0) {
-                uint32_t bytesInBuffer = 0;
-                bool exit = true;
+        uint32_t dmaWriteIdx = m_uartRxBuffer.size() - __HAL_DMA_GET_COUNTER(m_usart->hdmarx);
 
-                if (dmaWriteIdx > dmaReadIdx) {
-                    bytesInBuffer = dmaWriteIdx - dmaReadIdx;
-                } else {
-                    bytesInBuffer = m_uartRxBuffer.size() - dmaReadIdx;
-                    exit = false;
-                }
-
-                if (bytesInBuffer > m_ipdRemainingBytes) {
-                    bytesInBuffer = m_ipdRemainingBytes;
-                }
-
-                if (bytesInBuffer > MAX_DATA_CHUNK_SIZE) {
-                    bytesInBuffer = MAX_DATA_CHUNK_SIZE;
-                    exit = false;
-                }
-
-                gotData(m_ipdLinkId, m_uartRxBuffer.begin() + dmaReadIdx, bytesInBuffer);
-                m_ipdRemainingBytes -= bytesInBuffer;
-                dmaReadIdx += bytesInBuffer;
-
-                if (dmaReadIdx >= m_uartRxBuffer.size()) {
-                    dmaReadIdx = 0;
-                }
+        // Before the reception is started the counter reads zero
+        if (dmaWriteIdx < m_uartRxBuffer.size()) {
+            m_tokenizer.process(dmaWriteIdx);
+        }
 
-                if (exit) {
-                    break;
-                }
+        TickType_t timeout = portMAX_DELAY;
 
+        if (m_inactivityDeadlineArmed) {
+            auto remaining = static_cast<std::int32_t>(m_inactivityDeadline - xTaskGetTickCount());
+            if (remaining <= 0) {
+                closeIdleConnections();
                 continue;
             }
 
-            lineBuffer += dmaBuffer[dmaReadIdx++];
-            if (dmaReadIdx >= m_uartRxBuffer.size()) {
-                dmaReadIdx = 0;
-            }
-
-            if (lineBuffer.EndsWith(crlf)) {
-                lineBuffer.Truncate(lineBuffer.GetSize() - 2);
-                parseEspResponse(lineBuffer);
-                lineBuffer.Clear();
-            } else if (lineBuffer.EndsWith(colon)) {
-                if (parseEspNotification(lineBuffer)) {
-                    lineBuffer.Clear();
-                }
-            } else if (lineBuffer.GetSize() == 1 && *lineBuffer.begin() == '>') {
-                if (gotPrompt()) {
-                    lineBuffer.Clear();
-                }
-            }
+            timeout = remaining;
         }
 
-        vTaskDelay(5);
+        // Bytes arriving after the buffer was drained have set the event
+        // already, so nothing is missed between the check and the wait
+        xTaskNotifyWait(0, UART_RX_EVENT, nullptr, timeout);
     }
 }
 
+BaseType_t EspAtDriver::notifyRxEventFromIsr()
+{
+    BaseType_t higherPriorityWoken = 0;
+    xTaskNotifyFromISR(m_uartRxTaskHandle, UART_RX_EVENT, eSetBits, &higherPriorityWoken);
+    return higherPriorityWoken;
+}
+
 void EspAtDriver::connectionCloserMain()
 {
     while (true) {
@@ -757,87 +743,83 @@ void EspAtDriver::readAtString(
     position = currentPos;
 }
 
-void EspAtDriver::parseEspResponse(
-    const StaticString<ESP_LINE_BUFFER_SIZE>& buffer)
+void EspAtDriver::gotLine(std::string_view line)
 {
-    if (buffer == STR("OK")) {
+    if (line == "OK") {
         return finishRequest(EspResponse::OK);
     }
 
-    if (buffer == STR("ERROR")) {
+    if (line == "ERROR") {
         return finishRequest(EspResponse::ERROR);
     }
 
-    if (buffer == STR("SEND OK")) {
+    if (line == "SEND OK") {
         return finishRequest(EspResponse::SEND_OK);
     }
 
-    if (buffer == STR("SEND FAIL")) {
+    if (line == "SEND FAIL") {
         return finishRequest(EspResponse::SEND_FAIL);
     }
 
-    if (buffer == STR("SET OK")) {
+    if (line == "SET OK") {
         return finishRequest(EspResponse::SET_OK);
     }
 
-    if (buffer == STR("ready")) {
+    if (line == "ready") {
         xTaskNotify(m_initTaskHandle, 1, eSetBits);
         return;
     }
 
-    if (buffer == STR("WIFI CONNECTED")) {
+    if (line == "WIFI CONNECTED") {
         m_wifiStatus = EspWifiStatus::CONNECTED;
         return;
     }
 
-    if (buffer == STR("WIFI GOT IP")) {
+    if (line == "WIFI GOT IP") {
         m_wifiStatus = EspWifiStatus::DHCP_GOT_IP;
         return;
     }
 
-    if (buffer == STR("WIFI DISCONNECT")) {
+    if (line == "WIFI DISCONNECT") {
         m_wifiStatus = EspWifiStatus::DISCONNECTED;
         return;
     }
 
-    if (buffer.EndsWith(STR("CONNECT"))) {
-        if (buffer[1] == ',') {
-            int linkId = buffer[0] - '0';
+    if (line.ends_with("CONNECT")) {
+        if (line[1] == ',') {
+            int linkId = line[0] - '0';
             gotConnect(linkId);
             return;
         }
         return gotConnect(0);
     }
 
-    if (buffer.EndsWith(STR("CLOSED"))) {
-        if (buffer[1] == ',') {
-            int linkId = buffer[0] - '0';
+    if (line.ends_with("CLOSED")) {
+        if (line[1] == ',') {
+            int linkId = line[0] - '0';
             gotClosed(linkId);
             return;
         }
         return gotClosed(0);
     }
 
-    if (buffer.StartsWith(STR("+TIME_UPDATED"))) {
+    if (line.starts_with("+TIME_UPDATED")) {
         gotTimeUpdated();
         return;
     }
 
-    if (!m_responsePrefix.IsEmpty() && buffer.StartsWith(m_responsePrefix)) {
-        m_responseBuffer += buffer;
+    if (!m_responsePrefix.IsEmpty() && line.starts_with(m_responsePrefix.ToCStr())) {
+        for (char c : line) {
+            m_responseBuffer += c;
+        }
+
         m_responseBuffer += "\r\n";
     }
 }
 
-bool EspAtDriver::parseEspNotification(
-    const StaticString<ESP_LINE_BUFFER_SIZE>& buffer)
+bool EspAtDriver::gotNotification(std::string_view header)
 {
-    if (buffer.StartsWith(STR("+IPD,"))) {
-        parseInputData(buffer);
-        return true;
-    }
-
-    if (buffer.StartsWith(STR("+MQTTSUB:"))) {
+    if (header == "+MQTTSUB:") {
         // TODO: parse MQTT events
         return true;
     }
@@ -881,8 +863,11 @@ bool EspAtDriver::gotPrompt()
 void EspAtDriver::gotConnect(int linkId)
 {
     if (linkId >= 0 && linkId < MAX_CONNECTIONS) {
+        TickType_t currentTick = xTaskGetTickCount();
+
         m_connectionOpen.at(linkId) = true;
-        m_connectionLastActivity.at(linkId) = xTaskGetTickCount();
+        m_connectionLastActivity.at(linkId) = currentTick;
+        armInactivityDeadline(currentTick + MAX_INACTIVITY_TIME_MS + 1);
     }
 
     if (onConnected) {
@@ -894,6 +879,7 @@ void EspAtDriver::gotClosed(int linkId)
 {
     if (linkId >= 0 && linkId < MAX_CONNECTIONS) {
         m_connectionOpen.at(linkId) = false;
+        cancelQueuedSends(linkId);
     }
 
     if (onClosed) {
@@ -922,34 +908,38 @@ void EspAtDriver::gotTimeUpdated()
 void EspAtDriver::closeIdleConnections()
 {
     TickType_t currentTick = xTaskGetTickCount();
+    m_inactivityDeadlineArmed = false;
 
     for (int i = 0; i < MAX_CONNECTIONS; ++i) {
         if (m_connectionOpen.at(i)) {
-            if (currentTick - m_connectionLastActivity.at(i) > MAX_INACTIVITY_TIME_MS) {
+            TickType_t lastActivity = m_connectionLastActivity.at(i);
+
+            if (currentTick - lastActivity > MAX_INACTIVITY_TIME_MS) {
                 int connectionId = i;
                 xQueueSend(m_connectionsToCloseHandle, &connectionId, 0);
                 gotClosed(connectionId);
+            } else {
+                armInactivityDeadline(lastActivity + MAX_INACTIVITY_TIME_MS + 1);
             }
         }
     }
 }
 
-void EspAtDriver::parseInputData(const StaticString<ESP_LINE_BUFFER_SIZE>& buffer)
+void EspAtDriver::armInactivityDeadline(TickType_t deadline)
 {
-    StaticString<16> bufferCopy = buffer;
-    const char* bufferData = bufferCopy.ToCStr();
+    if (!m_inactivityDeadlineArmed
+        || static_cast<std::int32_t>(deadline - m_inactivityDeadline) < 0) {
 
-    int linkId = atoi(bufferData + 5);
-    int dataSize = atoi(bufferData + 7);
-
-    if (linkId >= 0 && linkId < MAX_CONNECTIONS
-        && dataSize >= 0 && dataSize <= ESP_AT_MAX_IPD_BYTES) {
-
-        m_ipdLinkId = linkId;
-        m_ipdRemainingBytes = dataSize;
+        m_inactivityDeadline = deadline;
+        m_inactivityDeadlineArmed = true;
     }
 }
 
+bool EspAtDriver::gotInputHeader(int linkId, std::size_t size)
+{
+    return linkId >= 0 && linkId < MAX_CONNECTIONS && size <= ESP_AT_MAX_IPD_BYTES;
+}
+
 auto EspAtDriver::sendCommandDirectAndWait(const char* data, std::uint32_t timeout) -> EspResponse
 {
     m_txLineBuffer = data;
@@ -973,12 +963,206 @@ auto EspAtDriver::sendCommandBufferAndWait(std::uint32_t timeout) -> EspResponse
 
     bool gotRx = xTaskNotifyWait(0, ESP_RX_DONE, nullptr, timeout);
     if (!gotRx) {
+        // A late response must not complete the next command
+        m_requestInitiator = nullptr;
         return EspResponse::ESP_TIMEOUT;
     }
 
     return m_currentResponse;
 }
 
+auto EspAtDriver::getCommandStats(CommandClass commandClass) const -> CommandStats
+{
+    taskENTER_CRITICAL();
+    auto stats = m_commandStats.at(static_cast<std::size_t>(commandClass));
+    taskEXIT_CRITICAL();
+
+    return stats;
+}
+
+const char* EspAtDriver::getCommandClassName(CommandClass commandClass)
+{
+    static constexpr std::array<const char*, COMMAND_CLASS_COUNT> names = { "data", "control", "housekeeping" };
+    return names.at(static_cast<std::size_t>(commandClass));
+}
+
+void EspAtDriver::writeDiagnostics(ArduinoJson::JsonObject out) const
+{
+    for (std::size_t i = 0; i < COMMAND_CLASS_COUNT; ++i) {
+        auto commandClass = static_cast<CommandClass>(i);
+        auto stats = getCommandStats(commandClass);
+
+        auto section = out.createNestedObject(getCommandClassName(commandClass));
+        section["commands"] = stats.commands;
+        section["avg_wait_ms"] = stats.commands ? stats.waitTimeMs / stats.commands : 0;
+        section["max_wait_ms"] = stats.maxWaitTimeMs;
+        section["timeouts"] = stats.timeouts;
+        section["cancelled"] = stats.cancelled;
+    }
+}
+
+auto EspAtDriver::acquireModule(CommandClass commandClass, int sendLinkId) -> EspResponse
+{
+    CommandWaiter waiter {};
+    waiter.task = xTaskGetCurrentTaskHandle();
+    waiter.commandClass = commandClass;
+    waiter.priority = uxTaskPriorityGet(nullptr);
+    waiter.sendLinkId = sendLinkId;
+    waiter.queuedTicks = xTaskGetTickCount();
+    waiter.state = AdmissionState::QUEUED;
+
+    auto& stats = m_commandStats.at(static_cast<std::size_t>(commandClass));
+
+    taskENTER_CRITICAL();
+
+    if (!m_moduleBusy) {
+        m_moduleBusy = true;
+        m_moduleHolder = waiter.task;
+        m_holderBasePriority = waiter.priority;
+        m_holderPriority = waiter.priority;
+        ++stats.commands;
+        taskEXIT_CRITICAL();
+
+        return EspResponse::OK;
+    }
+
+    // Behind every waiter of the same or a more urgent class
+    auto link = &m_commandWaiters;
+    while (*link && (*link)->commandClass <= commandClass) {
+        link = &(*link)->next;
+    }
+
+    waiter.next = *link;
+    *link = &waiter;
+
+    raiseHolderPriority(waiter.priority);
+
+    taskEXIT_CRITICAL();
+
+    TickType_t timeout = commandClass == CommandClass::HOUSEKEEPING
+        ? HOUSEKEEPING_QUEUE_TIMEOUT_MS
+        : portMAX_DELAY;
+
+    // A hand-over meant for an earlier wait of this task can arrive late,
+    // so only the state tells whether the wait is over
+    while (waiter.state == AdmissionState::QUEUED) {
+        TickType_t waited = xTaskGetTickCount() - waiter.queuedTicks;
+
+        if (timeout != portMAX_DELAY && waited >= timeout) {
+            break;
+        }
+
+        ulTaskNotifyTakeIndexed(ADMISSION_NOTIFY_INDEX, pdTRUE,
+            timeout == portMAX_DELAY ? portMAX_DELAY : timeout - waited);
+    }
+
+    taskENTER_CRITICAL();
+
+    if (waiter.state == AdmissionState::QUEUED) {
+        for (link = &m_commandWaiters; *link != &waiter; link = &(*link)->next) { }
+        *link = waiter.next;
+
+        waiter.state = AdmissionState::TIMED_OUT;
+        ++stats.timeouts;
+    }
+
+    taskEXIT_CRITICAL();
+
+    switch (waiter.state) {
+    case AdmissionState::ADMITTED:
+        return EspResponse::OK;
+    case AdmissionState::CANCELLED:
+        return EspResponse::CANCELLED;
+    default:
+        return EspResponse::ESP_TIMEOUT;
+    }
+}
+
+void EspAtDriver::releaseModule()
+{
+    TaskHandle_t nextTask = nullptr;
+    TickType_t currentTick = xTaskGetTickCount();
+
+    taskENTER_CRITICAL();
+
+    auto basePriority = m_holderBasePriority;
+    auto restorePriority = m_holderPriority != basePriority;
+
+    if (auto waiter = m_commandWaiters) {
+        m_commandWaiters = waiter->next;
+        waiter->state = AdmissionState::ADMITTED;
+        nextTask = waiter->task;
+
+        m_moduleHolder = waiter->task;
+        m_holderBasePriority = waiter->priority;
+        m_holderPriority = waiter->priority;
+        for (auto other = m_commandWaiters; other; other = other->next) {
+            raiseHolderPriority(other->priority);
+        }
+
+        auto& stats = m_commandStats.at(static_cast<std::size_t>(waiter->commandClass));
+        std::uint32_t waitTime = currentTick - waiter->queuedTicks;
+        ++stats.commands;
+        stats.waitTimeMs += waitTime;
+        stats.maxWaitTimeMs = std::max(stats.maxWaitTimeMs, waitTime);
+    } else {
+        m_moduleBusy = false;
+        m_moduleHolder = nullptr;
+    }
+
+    taskEXIT_CRITICAL();
+
+    // The waiter may be gone once its state is set, only the handle is used
+    if (nextTask) {
+        xTaskNotifyGiveIndexed(nextTask, ADMISSION_NOTIFY_INDEX);
+    }
+
+    // Last, dropping the priority may switch to the next holder right away
+    if (restorePriority) {
+        vTaskPrioritySet(nullptr, basePriority);
+    }
+}
+
+// Called in a critical section by a task at least as urgent as the
+// priority, so raising the holder never switches tasks. A waiter that
+// times out or is cancelled leaves the holder raised until it releases.
+void EspAtDriver::raiseHolderPriority(UBaseType_t priority)
+{
+    if (m_holderPriority < priority) {
+        m_holderPriority = priority;
+        vTaskPrioritySet(m_moduleHolder, priority);
+    }
+}
+
+void EspAtDriver::cancelQueuedSends(int linkId)
+{
+    while (true) {
+        TaskHandle_t task = nullptr;
+
+        taskENTER_CRITICAL();
+
+        for (auto link = &m_commandWaiters; *link; link = &(*link)->next) {
+            auto waiter = *link;
+
+            if (waiter->sendLinkId == linkId) {
+                *link = waiter->next;
+                waiter->state = AdmissionState::CANCELLED;
+                task = waiter->task;
+                ++m_commandStats.at(static_cast<std::size_t>(waiter->commandClass)).cancelled;
+                break;
+            }
+        }
+
+        taskEXIT_CRITICAL();
+
+        if (!task) {
+            break;
+        }
+
+        xTaskNotifyGiveIndexed(task, ADMISSION_NOTIFY_INDEX);
+    }
+}
+
 void EspAtDriver::waitForDmaReady()
 {
     while (HAL_DMA_GetState(m_usart->hdmatx) != HAL_DMA_STATE_READY
@@ -7,6 +7,8 @@
 
 #include <stm32f7xx_hal.h>
 
+#include <algorithm>
+
 // Some of the code is based on:
 // https://controllerstech.com/w25q-flash-series-part-7-quadspi-write-read-memory-mapped-mode/
 
@@ -63,7 +65,7 @@ void FlashDriver::initialize()
 
 void* FlashDriver::getBasePtr() const
 {
-    return reinterpret_cast<void*>(0x90000000);
+    return reinterpret_cast<void*>(QSPI_BASE);
 }
 
 void* FlashDriver::getPageAddress(std::uint32_t page) const
@@ -71,24 +73,90 @@ void* FlashDriver::getPageAddress(std::uint32_t page) const
     return reinterpret_cast<std::uint8_t*>(getBasePtr()) + page * FLASH_PAGE_SIZE;
 }
 
+bool FlashDriver::beginWriteSession()
+{
+    if (m_writeSessionActive) {
+        return false;
+    }
+
+    if (!disableMemoryMappedMode()) {
+        Device::get().setError(Device::ErrorCode::FLASH_ERROR);
+        return false;
+    }
+
+    m_writeSessionActive = true;
+    return true;
+}
+
+bool FlashDriver::endWriteSession()
+{
+    if (!m_writeSessionActive) {
+        return false;
+    }
+
+    m_writeSessionActive = false;
+
+    if (!enableMemoryMappedMode()) {
+        Device::get().setError(Device::ErrorCode::FLASH_ERROR);
+        return false;
+    }
+
+    return true;
+}
+
 bool FlashDriver::writePage(std::uint32_t pageId, const std::uint8_t* data, std::size_t size)
 {
     if (pageId >= FLASH_PAGE_COUNT) {
         return false;
     }
 
-    if (!disableMemoryMappedMode()) {
+    bool ownSession = !m_writeSessionActive;
+    if (ownSession && !beginWriteSession()) {
+        return false;
+    }
+
+    bool result = doWritePage(pageId, data, size);
+    if (!result) {
         Device::get().setError(Device::ErrorCode::FLASH_ERROR);
+    }
+
+    if (ownSession && !endWriteSession()) {
+        return false;
+    }
+
+    return result;
+}
+
+bool FlashDriver::writePages(std::uint32_t firstPageId, const std::uint8_t* data, std::size_t size)
+{
+    auto pageCount = (size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    if (firstPageId + pageCount > FLASH_PAGE_COUNT) {
         return false;
     }
 
-    if (!doWritePage(pageId, data, size)) {
+    bool ownSession = !m_writeSessionActive;
+    if (ownSession && !beginWriteSession()) {
+        return false;
+    }
+
+    bool result = true;
+
+    for (std::size_t i = 0; i < pageCount && result; ++i) {
+        auto offset = i * FLASH_PAGE_SIZE;
+        auto count = std::min<std::size_t>(size - offset, FLASH_PAGE_SIZE);
+
+        result = doWritePage(firstPageId + i, data + offset, count);
+    }
+
+    if (!result) {
         Device::get().setError(Device::ErrorCode::FLASH_ERROR);
-        enableMemoryMappedMode();
+    }
+
+    if (ownSession && !endWriteSession()) {
         return false;
     }
 
-    return enableMemoryMappedMode();
+    return result;
 }
 
 bool FlashDriver::eraseSector(std::uint32_t sectorId)
@@ -97,18 +165,35 @@ bool FlashDriver::eraseSector(std::uint32_t sectorId)
         return false;
     }
 
-    if (!disableMemoryMappedMode()) {
-        Device::get().setError(Device::ErrorCode::FLASH_ERROR);
+    bool ownSession = !m_writeSessionActive;
+    if (ownSession && !beginWriteSession()) {
         return false;
     }
 
-    if (!doEraseSector(sectorId)) {
+    bool result = doEraseSector(sectorId);
+    if (!result) {
         Device::get().setError(Device::ErrorCode::FLASH_ERROR);
-        enableMemoryMappedMode();
+    }
+
+    if (ownSession && !endWriteSession()) {
         return false;
     }
 
-    return enableMemoryMappedMode();
+    return result;
+}
+
+BaseType_t FlashDriver::notifyStatusMatchFromIsr(bool success)
+{
+    auto task = m_suspendedTask;
+
+    if (task) {
+        BaseType_t higherPriorityWoken = 0;
+        xTaskNotifyIndexedFromISR(task, QSPI_NOTIFY_INDEX, success ? QSPI_MATCH : QSPI_ERROR,
+            eSetBits, &higherPriorityWoken);
+        return higherPriorityWoken;
+    }
+
+    return 0;
 }
 
 void FlashDriver::delay(std::uint32_t millis)
@@ -202,8 +287,6 @@ bool FlashDriver::eraseChip()
 
 bool FlashDriver::enableMemoryMappedMode()
 {
-    static constexpr auto OP_DELAY_MS = 100;
-
     QSPI_CommandTypeDef sCommand;
     QSPI_MemoryMappedTypeDef sMemMappedCfg;
 
@@ -227,11 +310,15 @@ bool FlashDriver::enableMemoryMappedMode()
     sMemMappedCfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_DISABLE;
     sMemMappedCfg.TimeOutPeriod = 0;
 
+    // Reads return garbage while a program or erase is still running
+    if (!autoPollingMemReady()) {
+        return false;
+    }
+
     if (HAL_QSPI_MemoryMapped(m_qspi, &sCommand, &sMemMappedCfg) != HAL_OK) {
         return false;
     }
 
-    delay(OP_DELAY_MS);
     return true;
 }
 
@@ -302,6 +389,12 @@ bool FlashDriver::autoPollingMemReady()
     sConfig.Interval = 0x10;
     sConfig.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
 
+    if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+        // Programs and erases take up to hundreds of milliseconds,
+        // let the peripheral poll and sleep until the status matches
+        return autoPollingIt(&sCommand, &sConfig);
+    }
+
     if (HAL_QSPI_AutoPolling(m_qspi, &sCommand, &sConfig, HAL_MAX_DELAY)) {
         return false;
     }
@@ -309,6 +402,28 @@ bool FlashDriver::autoPollingMemReady()
     return true;
 }
 
+bool FlashDriver::autoPollingIt(QSPI_CommandTypeDef* command, QSPI_AutoPollingTypeDef* config)
+{
+    m_suspendedTask = xTaskGetCurrentTaskHandle();
+
+    xTaskNotifyWaitIndexed(QSPI_NOTIFY_INDEX, 0, QSPI_MATCH | QSPI_ERROR, nullptr, 0);
+
+    if (HAL_QSPI_AutoPolling_IT(m_qspi, command, config) != HAL_OK) {
+        m_suspendedTask = nullptr;
+        return false;
+    }
+
+    // Wait for the status match interrupt
+    std::uint32_t notifiedValue = 0;
+    while (!(notifiedValue & (QSPI_MATCH | QSPI_ERROR))) {
+        xTaskNotifyWaitIndexed(QSPI_NOTIFY_INDEX, 0, QSPI_MATCH | QSPI_ERROR, &notifiedValue, portMAX_DELAY);
+    }
+
+    m_suspendedTask = nullptr;
+
+    return (notifiedValue & QSPI_MATCH) != 0;
+}
+
 bool FlashDriver::configureQspi()
 {
     QSPI_CommandTypeDef sCommand = { 0 };
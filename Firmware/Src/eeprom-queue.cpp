@@ -0,0 +1,383 @@
+#include <eeprom-queue.hpp>
+
+#include <device.hpp>
+
+#include <algorithm>
+
+namespace lg {
+
+static bool isOlder(std::uint32_t sequence, std::uint32_t other)
+{
+    return static_cast<std::int32_t>(sequence - other) < 0;
+}
+
+static bool overlaps(std::uint16_t address, std::uint16_t size, std::uint16_t otherAddress, std::uint16_t otherSize)
+{
+    return address < otherAddress + otherSize && otherAddress < address + size;
+}
+
+void EepromQueue::eepromQueueEntryPoint(void* params)
+{
+    auto instance = reinterpret_cast<EepromQueue*>(params);
+    instance->eepromQueueMain();
+}
+
+void EepromQueue::initialize()
+{
+    m_mutex = xSemaphoreCreateMutexStatic(&m_mutexBuffer);
+
+    m_freeSlotsHandle = xQueueCreateStatic(
+        m_freeSlotsBuffer.size(),
+        sizeof(m_freeSlotsBuffer[0]),
+        m_freeSlotsBuffer.data(),
+        &m_freeSlotsQ);
+
+    for (std::uint8_t i = 0; i < QUEUE_SIZE; ++i) {
+        xQueueSend(m_freeSlotsHandle, &i, 0);
+    }
+
+    m_eepromQueueTaskHandle = xTaskCreateStatic(
+        &EepromQueue::eepromQueueEntryPoint /* Task function */,
+        "EEPROM Queue" /* Task name */,
+        m_eepromQueueTaskStack.size() /* Stack size */,
+        this /* Parameters */,
+        5 /* Priority */,
+        m_eepromQueueTaskStack.data() /* Task stack address */,
+        &m_eepromQueueTaskTcb /* Task control block */
+    );
+}
+
+bool EepromQueue::write(std::uint16_t address, const void* data, std::size_t size,
+    Priority priority, Callback callback, void* context)
+{
+    if (size > EepromDriver::EEPROM_PAGE_SIZE_BYTES
+        || address % EepromDriver::EEPROM_PAGE_SIZE_BYTES + size > EepromDriver::EEPROM_PAGE_SIZE_BYTES) {
+
+        return false;
+    }
+
+    return submit(Operation::WRITE, priority, address, data, size, callback, context);
+}
+
+bool EepromQueue::read(std::uint16_t address, void* data, std::size_t size,
+    Priority priority, Callback callback, void* context)
+{
+    return submit(Operation::READ, priority, address, data, size, callback, context);
+}
+
+bool EepromQueue::readSync(std::uint16_t address, void* data, std::size_t size, Priority priority)
+{
+    Waiter waiter {};
+    waiter.task = xTaskGetSchedulerState() == taskSCHEDULER_RUNNING ? xTaskGetCurrentTaskHandle() : nullptr;
+
+    return waitForCompletion(waiter,
+        read(address, data, size, priority, &EepromQueue::notifyWaiter, &waiter));
+}
+
+bool EepromQueue::writeSync(std::uint16_t address, const void* data, std::size_t size, Priority priority)
+{
+    Waiter waiter {};
+    waiter.task = xTaskGetSchedulerState() == taskSCHEDULER_RUNNING ? xTaskGetCurrentTaskHandle() : nullptr;
+
+    return waitForCompletion(waiter,
+        write(address, data, size, priority, &EepromQueue::notifyWaiter, &waiter));
+}
+
+void EepromQueue::flush(Priority priority)
+{
+    Waiter waiter {};
+    waiter.task = xTaskGetSchedulerState() == taskSCHEDULER_RUNNING ? xTaskGetCurrentTaskHandle() : nullptr;
+
+    waitForCompletion(waiter,
+        submit(Operation::FLUSH, priority, 0, nullptr, 0, &EepromQueue::notifyWaiter, &waiter));
+}
+
+EepromQueue::Stats EepromQueue::getStats() const
+{
+    if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+        return m_stats;
+    }
+
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    auto stats = m_stats;
+    xSemaphoreGive(m_mutex);
+
+    return stats;
+}
+
+void EepromQueue::writeDiagnostics(ArduinoJson::JsonObject out) const
+{
+    auto stats = getStats();
+    auto requests = stats.reads + stats.writes + stats.mergedWrites;
+    auto bytes = stats.bytesRead + stats.bytesWritten;
+
+    out["queue_reads"] = stats.reads;
+    out["queue_writes"] = stats.writes;
+    out["merged_writes"] = stats.mergedWrites;
+    out["avg_queue_delay_ms"] = requests ? stats.queueDelayMs / requests : 0;
+    out["max_queue_delay_ms"] = stats.maxQueueDelayMs;
+    out["max_queued"] = stats.maxQueued;
+    out["busy_ms"] = stats.busyTimeMs;
+    out["bytes_per_s"] = static_cast<std::uint32_t>(stats.busyTimeMs
+            ? static_cast<std::uint64_t>(bytes) * 1000 / stats.busyTimeMs
+            : 0);
+}
+
+void EepromQueue::eepromQueueMain()
+{
+    while (true) {
+        xTaskNotifyWaitIndexed(REQUEST_NOTIFY_INDEX, 0, REQUEST_EVENT, nullptr, portMAX_DELAY);
+
+        while (runNext()) { }
+    }
+}
+
+bool EepromQueue::submit(Operation operation, Priority priority, std::uint16_t address, const void* data,
+    std::size_t size, Callback callback, void* context)
+{
+    if (address + size > EepromDriver::EEPROM_SIZE_BYTES) {
+        return false;
+    }
+
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-const-cast)
+    auto bytes = const_cast<std::uint8_t*>(static_cast<const std::uint8_t*>(data));
+    // NOLINTEND(cppcoreguidelines-pro-type-const-cast)
+
+    if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+        // Nothing else can be queued yet
+        auto startTicks = HAL_GetTick();
+        auto success = execute(operation, address, bytes, size);
+        updateStats(operation, size, 1, HAL_GetTick() - startTicks);
+
+        if (callback) {
+            callback(context, success);
+        }
+
+        return true;
+    }
+
+    std::uint8_t index = 0;
+    xQueueReceive(m_freeSlotsHandle, &index, portMAX_DELAY);
+
+    auto& slot = m_slots.at(index);
+    slot.operation = operation;
+    slot.priority = priority;
+    slot.address = address;
+    slot.size = size;
+    slot.readData = operation == Operation::READ ? bytes : nullptr;
+    slot.callback = callback;
+    slot.context = context;
+
+    if (operation == Operation::WRITE) {
+        std::copy_n(bytes, size, slot.writeData.begin());
+    }
+
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    slot.sequence = m_nextSequence++;
+    slot.queuedTicks = xTaskGetTickCount();
+    slot.queued = true;
+
+    m_stats.maxQueued = std::max<std::uint32_t>(m_stats.maxQueued,
+        QUEUE_SIZE - uxQueueMessagesWaiting(m_freeSlotsHandle));
+
+    xSemaphoreGive(m_mutex);
+
+    xTaskNotifyIndexed(m_eepromQueueTaskHandle, REQUEST_NOTIFY_INDEX, REQUEST_EVENT, eSetBits);
+    return true;
+}
+
+bool EepromQueue::runNext()
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    auto first = findNext();
+    if (!first) {
+        xSemaphoreGive(m_mutex);
+        return false;
+    }
+
+    first->queued = false;
+    m_running[0] = first;
+    m_runningCount = 1;
+
+    auto operation = first->operation;
+    auto address = first->address;
+    std::uint16_t size = first->size;
+    auto data = first->readData;
+
+    if (operation == Operation::WRITE) {
+        std::copy_n(first->writeData.begin(), size, m_pageBuffer.begin());
+
+        while (auto next = findMergeable(*m_running.at(m_runningCount - 1), address + size)) {
+            std::copy_n(next->writeData.begin(), next->size, m_pageBuffer.begin() + size);
+            size += next->size;
+
+            next->queued = false;
+            m_running.at(m_runningCount++) = next;
+        }
+
+        data = m_pageBuffer.data();
+    }
+
+    auto startTicks = xTaskGetTickCount();
+
+    for (std::size_t i = 0; i < m_runningCount; ++i) {
+        std::uint32_t delay = startTicks - m_running.at(i)->queuedTicks;
+        m_stats.queueDelayMs += delay;
+        m_stats.maxQueueDelayMs = std::max(m_stats.maxQueueDelayMs, delay);
+    }
+
+    xSemaphoreGive(m_mutex);
+
+    auto success = execute(operation, address, data, size);
+
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    updateStats(operation, size, m_runningCount, xTaskGetTickCount() - startTicks);
+    auto runningCount = m_runningCount;
+    m_runningCount = 0;
+
+    xSemaphoreGive(m_mutex);
+
+    for (std::size_t i = 0; i < runningCount; ++i) {
+        auto slot = m_running.at(i);
+        auto callback = slot->callback;
+        auto context = slot->context;
+
+        std::uint8_t index = slot - m_slots.data();
+        xQueueSend(m_freeSlotsHandle, &index, 0);
+
+        if (callback) {
+            callback(context, success);
+        }
+    }
+
+    return true;
+}
+
+bool EepromQueue::execute(Operation operation, std::uint16_t address, std::uint8_t* data, std::size_t size)
+{
+    if (operation == Operation::FLUSH) {
+        return true;
+    }
+
+    auto eeprom = Device::get().getEepromDriver();
+
+    if (operation == Operation::READ) {
+        return eeprom->readBytes(address, data, size);
+    }
+
+    eeprom->enableWrites();
+    auto success = eeprom->writeBytes(address, data, size);
+    eeprom->disableWrites();
+
+    return success;
+}
+
+void EepromQueue::updateStats(Operation operation, std::size_t size, std::size_t requests, std::uint32_t busyTimeMs)
+{
+    if (operation == Operation::WRITE) {
+        ++m_stats.writes;
+        m_stats.mergedWrites += requests - 1;
+        m_stats.bytesWritten += size;
+    } else if (operation == Operation::READ) {
+        ++m_stats.reads;
+        m_stats.bytesRead += size;
+    }
+
+    m_stats.busyTimeMs += busyTimeMs;
+}
+
+EepromQueue::Slot* EepromQueue::findNext()
+{
+    // The oldest request overall is never blocked, so something is found
+    // whenever anything is queued
+    for (std::size_t priority = 0; priority < PRIORITY_COUNT; ++priority) {
+        Slot* oldest = nullptr;
+
+        for (auto& slot : m_slots) {
+            if (slot.queued && static_cast<std::size_t>(slot.priority) == priority
+                && (!oldest || isOlder(slot.sequence, oldest->sequence))) {
+
+                oldest = &slot;
+            }
+        }
+
+        if (oldest && !isBlocked(*oldest)) {
+            return oldest;
+        }
+    }
+
+    return nullptr;
+}
+
+EepromQueue::Slot* EepromQueue::findMergeable(const Slot& previous, std::uint16_t mergedEnd)
+{
+    if (mergedEnd % EepromDriver::EEPROM_PAGE_SIZE_BYTES == 0) {
+        // The next write would start a new page
+        return nullptr;
+    }
+
+    // Only the request queued right after the previous one in the same
+    // priority, anything else would change the order of the writes
+    Slot* next = nullptr;
+
+    for (auto& slot : m_slots) {
+        if (slot.queued && slot.priority == previous.priority
+            && (!next || isOlder(slot.sequence, next->sequence))) {
+
+            next = &slot;
+        }
+    }
+
+    if (!next || next->operation != Operation::WRITE || next->address != mergedEnd || isBlocked(*next)) {
+        return nullptr;
+    }
+
+    return next;
+}
+
+bool EepromQueue::isBlocked(const Slot& slot) const
+{
+    for (auto& other : m_slots) {
+        if (other.queued && isOlder(other.sequence, slot.sequence)
+            && (slot.operation == Operation::WRITE || other.operation == Operation::WRITE)
+            && overlaps(slot.address, slot.size, other.address, other.size)) {
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void EepromQueue::notifyWaiter(void* context, bool success)
+{
+    // The waiter lives on the stack of the waiting task and is gone as
+    // soon as that task wakes up
+    auto waiter = static_cast<Waiter*>(context);
+    auto task = waiter->task;
+
+    waiter->success = success;
+
+    if (task) {
+        xTaskNotifyGiveIndexed(task, COMPLETION_NOTIFY_INDEX);
+    }
+}
+
+bool EepromQueue::waitForCompletion(Waiter& waiter, bool submitted)
+{
+    if (!submitted) {
+        return false;
+    }
+
+    // Without a task the request was carried out right away
+    if (waiter.task) {
+        ulTaskNotifyTakeIndexed(COMPLETION_NOTIFY_INDEX, pdTRUE, portMAX_DELAY);
+    }
+
+    return waiter.success;
+}
+
+};
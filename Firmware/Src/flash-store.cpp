@@ -0,0 +1,560 @@
+#include <flash-store.hpp>
+
+#include <device.hpp>
+
+#include <crc.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace lg {
+
+void FlashStore::initialize()
+{
+    auto startTicks = HAL_GetTick();
+
+    {
+        auto flashDriver = Device::get().getFlashDriver();
+        m_flashBase = reinterpret_cast<const std::uint8_t*>(flashDriver->getBasePtr());
+    }
+
+    m_eraseCounts.fill(INVALID_VALUE);
+
+    // Only the header pages are read, a torn erase or program leaves a
+    // header that fails its check and the sector is erased again
+    std::uint32_t maxEraseCount = 0;
+
+    for (std::uint16_t sector = 0; sector < FlashDriver::FLASH_SECTOR_COUNT; ++sector) {
+        mountSector(sector, maxEraseCount);
+    }
+
+    // Sectors without a readable erase count are assumed to be as worn
+    // as the most worn known sector
+    for (auto& eraseCount : m_eraseCounts) {
+        if (eraseCount == INVALID_VALUE) {
+            eraseCount = maxEraseCount;
+        }
+    }
+
+    for (std::size_t i = 0; i < STREAM_COUNT; ++i) {
+        auto& state = m_streams.at(i);
+        sortStream(state);
+
+        while (state.count > STREAMS.at(i).maxSectors) {
+            releaseOldestSector(state);
+        }
+
+        if (state.count) {
+            state.tail = findTail(getNewestSector(state));
+        }
+    }
+
+    m_mounted = true;
+    m_mountTimeMs = HAL_GetTick() - startTicks;
+
+    Device::get().getCronService()->registerJob([] {
+        Device::get().getFlashStore()->maintain();
+    });
+}
+
+void FlashStore::maintain()
+{
+    if (!m_mounted) {
+        return;
+    }
+
+    // Erases happen here instead of in the append path
+    auto readySectors = static_cast<std::uint32_t>(
+        std::count(m_sectorStates.begin(), m_sectorStates.end(), SectorState::READY));
+
+    while (readySectors < READY_TARGET && prepareSector()) {
+        ++readySectors;
+    }
+}
+
+bool FlashStore::append(Stream stream, const void* data, std::size_t size)
+{
+    if (!m_mounted || size > MAX_RECORD_SIZE) {
+        return false;
+    }
+
+    auto& state = m_streams.at(static_cast<std::size_t>(stream));
+
+    if (!state.count || state.tail >= RECORDS_PER_SECTOR) {
+        if (!openSector(stream)) {
+            Device::get().setError(Device::ErrorCode::FLASH_ERROR);
+            return false;
+        }
+    }
+
+    std::array<std::uint32_t, FlashDriver::FLASH_PAGE_SIZE / sizeof(std::uint32_t)> buffer;
+    buffer.fill(INVALID_VALUE);
+
+    auto record = reinterpret_cast<RecordHeader*>(buffer.data());
+    record->size = static_cast<std::uint16_t>(size);
+    std::memcpy(record + 1, data, size);
+    record->crc = calculateRecordCrc(record);
+
+    auto sector = getNewestSector(state);
+    auto page = sector * FlashDriver::FLASH_PAGES_PER_SECTOR + 1 + state.tail;
+
+    // A failed program can leave the slot half written, it is not reused
+    ++state.tail;
+
+    bool result = false;
+    {
+        auto flashDriver = Device::get().getFlashDriver();
+        result = flashDriver->writePage(page,
+            reinterpret_cast<const std::uint8_t*>(buffer.data()), sizeof(RecordHeader) + size);
+    }
+
+    m_pageChecked.set(page);
+    m_pageValid.set(page, result);
+    return result;
+}
+
+std::uint32_t FlashStore::getFirstRecord(Stream stream) const
+{
+    auto& state = m_streams.at(static_cast<std::size_t>(stream));
+    if (!state.count) {
+        return 0;
+    }
+
+    return getSectorHeader(getSectorAt(state, 0))->firstRecord;
+}
+
+std::uint32_t FlashStore::getEndRecord(Stream stream) const
+{
+    auto& state = m_streams.at(static_cast<std::size_t>(stream));
+    if (!state.count) {
+        return 0;
+    }
+
+    return getSectorHeader(getNewestSector(state))->firstRecord + state.tail;
+}
+
+const void* FlashStore::getRecord(Stream stream, std::uint32_t record, std::size_t* size)
+{
+    auto& state = m_streams.at(static_cast<std::size_t>(stream));
+
+    if (record < getFirstRecord(stream) || record >= getEndRecord(stream)) {
+        return nullptr;
+    }
+
+    // Find the newest sector starting at or before the record. The first
+    // record numbers of consecutive sectors only have gaps where a broken
+    // sector was dropped at mount.
+    std::uint32_t low = 0;
+    std::uint32_t high = state.count;
+
+    while (high - low > 1) {
+        auto middle = low + (high - low) / 2;
+
+        if (getSectorHeader(getSectorAt(state, middle))->firstRecord <= record) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    auto sector = getSectorAt(state, low);
+    auto slot = record - getSectorHeader(sector)->firstRecord;
+
+    if (slot >= RECORDS_PER_SECTOR) {
+        return nullptr;
+    }
+
+    auto page = sector * FlashDriver::FLASH_PAGES_PER_SECTOR + 1 + slot;
+    if (!isRecordValid(page)) {
+        return nullptr;
+    }
+
+    auto header = reinterpret_cast<const RecordHeader*>(getPage(page));
+    if (size) {
+        *size = header->size;
+    }
+
+    return header + 1;
+}
+
+const char* FlashStore::getStreamName(Stream stream)
+{
+    return STREAMS.at(static_cast<std::size_t>(stream)).name;
+}
+
+std::uint32_t FlashStore::getStreamSectorCount(Stream stream) const
+{
+    return m_streams.at(static_cast<std::size_t>(stream)).count;
+}
+
+FlashStore::Stats FlashStore::getStats() const
+{
+    Stats stats {};
+    stats.mountTimeMs = m_mountTimeMs;
+    stats.minEraseCount = INVALID_VALUE;
+
+    for (std::uint16_t sector = 0; sector < FlashDriver::FLASH_SECTOR_COUNT; ++sector) {
+        auto state = m_sectorStates.at(sector);
+        auto eraseCount = m_eraseCounts.at(sector);
+
+        if (state == SectorState::USED) {
+            ++stats.usedSectors;
+        } else if (state == SectorState::READY) {
+            ++stats.readySectors;
+        }
+
+        stats.minEraseCount = std::min(stats.minEraseCount, eraseCount);
+        stats.maxEraseCount = std::max(stats.maxEraseCount, eraseCount);
+    }
+
+    return stats;
+}
+
+void FlashStore::writeDiagnostics(ArduinoJson::JsonObject out) const
+{
+    auto stats = getStats();
+
+    out["mount_ms"] = stats.mountTimeMs;
+    out["used_sectors"] = stats.usedSectors;
+    out["ready_sectors"] = stats.readySectors;
+    out["min_erase_count"] = stats.minEraseCount;
+    out["max_erase_count"] = stats.maxEraseCount;
+
+    auto streamSectors = out.createNestedObject("stream_sectors");
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Stream::STREAM_COUNT); ++i) {
+        auto stream = static_cast<Stream>(i);
+        streamSectors[getStreamName(stream)] = getStreamSectorCount(stream);
+    }
+}
+
+void FlashStore::mountSector(std::uint16_t sector, std::uint32_t& maxEraseCount)
+{
+    auto header = getSectorHeader(sector);
+    auto& state = m_sectorStates.at(sector);
+
+    if (header->magic != SECTOR_MAGIC) {
+        auto headerPage = sector * FlashDriver::FLASH_PAGES_PER_SECTOR;
+        state = isPageBlank(headerPage) ? SectorState::BLANK : SectorState::FOREIGN;
+        return;
+    }
+
+    if (header->formatCheck != calculateFormatCheck(*header)) {
+        state = SectorState::DIRTY;
+        return;
+    }
+
+    m_eraseCounts.at(sector) = header->eraseCount;
+    maxEraseCount = std::max(maxEraseCount, header->eraseCount);
+
+    if (header->sequence == INVALID_VALUE && header->stream == INVALID_VALUE
+        && header->firstRecord == INVALID_VALUE && header->assignCheck == INVALID_VALUE) {
+
+        state = SectorState::READY;
+        return;
+    }
+
+    if (header->assignCheck != calculateAssignCheck(*header) || header->stream >= STREAM_COUNT) {
+        state = SectorState::DIRTY;
+        return;
+    }
+
+    auto& stream = m_streams.at(header->stream);
+    stream.sectors.at(stream.count++) = sector;
+    state = SectorState::USED;
+
+    m_nextSequence = std::max(m_nextSequence, header->sequence + 1);
+}
+
+void FlashStore::sortStream(StreamState& state)
+{
+    state.head = 0;
+
+    std::sort(state.sectors.begin(), state.sectors.begin() + state.count,
+        [this](std::uint16_t left, std::uint16_t right) {
+            return getSectorHeader(left)->sequence < getSectorHeader(right)->sequence;
+        });
+}
+
+std::uint32_t FlashStore::findTail(std::uint16_t sector) const
+{
+    // Records are programmed in slot order, the tail follows the last
+    // slot that is not blank, even if its record is broken
+    auto firstRecordPage = sector * FlashDriver::FLASH_PAGES_PER_SECTOR + 1;
+
+    for (auto slot = RECORDS_PER_SECTOR; slot > 0; --slot) {
+        if (!isPageBlank(firstRecordPage + slot - 1)) {
+            return slot;
+        }
+    }
+
+    return 0;
+}
+
+bool FlashStore::openSector(Stream stream)
+{
+    auto index = static_cast<std::size_t>(stream);
+    auto& state = m_streams.at(index);
+
+    std::uint32_t firstRecord = 0;
+    if (state.count) {
+        firstRecord = getSectorHeader(getNewestSector(state))->firstRecord + RECORDS_PER_SECTOR;
+    }
+
+    if (state.count >= STREAMS.at(index).maxSectors) {
+        releaseOldestSector(state);
+    }
+
+    auto sector = takeReadySector();
+    if (sector == NO_SECTOR) {
+        return false;
+    }
+
+    // Bits of the already programmed first half are left untouched
+    SectorHeader header {};
+    header.magic = INVALID_VALUE;
+    header.eraseCount = INVALID_VALUE;
+    header.formatCheck = INVALID_VALUE;
+    header.sequence = m_nextSequence++;
+    header.stream = index;
+    header.firstRecord = firstRecord;
+    header.assignCheck = calculateAssignCheck(header);
+
+    {
+        auto flashDriver = Device::get().getFlashDriver();
+        if (!flashDriver->writeObject(sector * FlashDriver::FLASH_PAGES_PER_SECTOR, header)) {
+            m_sectorStates.at(sector) = SectorState::DIRTY;
+            return false;
+        }
+    }
+
+    m_sectorStates.at(sector) = SectorState::USED;
+    state.sectors.at((state.head + state.count) % state.sectors.size()) = sector;
+    ++state.count;
+    state.tail = 0;
+
+    return true;
+}
+
+void FlashStore::releaseOldestSector(StreamState& state)
+{
+    auto sector = getSectorAt(state, 0);
+
+    state.head = (state.head + 1) % state.sectors.size();
+    --state.count;
+
+    m_sectorStates.at(sector) = SectorState::DIRTY;
+}
+
+std::uint16_t FlashStore::takeReadySector()
+{
+    auto pickReady = [this] {
+        std::uint16_t best = NO_SECTOR;
+
+        for (std::uint16_t sector = 0; sector < FlashDriver::FLASH_SECTOR_COUNT; ++sector) {
+            if (m_sectorStates.at(sector) != SectorState::READY) {
+                continue;
+            }
+
+            if (best == NO_SECTOR || m_eraseCounts.at(sector) < m_eraseCounts.at(best)) {
+                best = sector;
+            }
+        }
+
+        return best;
+    };
+
+    auto sector = pickReady();
+
+    if (sector == NO_SECTOR) {
+        // The background job fell behind, erase in the append path
+        if (!prepareSector()) {
+            return NO_SECTOR;
+        }
+
+        sector = pickReady();
+    }
+
+    return sector;
+}
+
+bool FlashStore::prepareSector()
+{
+    auto sector = findSectorToPrepare();
+    if (sector == NO_SECTOR) {
+        return false;
+    }
+
+    bool needsErase = m_sectorStates.at(sector) != SectorState::BLANK || !isSectorBlank(sector);
+    auto eraseCount = m_eraseCounts.at(sector) + (needsErase ? 1 : 0);
+
+    SectorHeader header {};
+    std::memset(&header, 0xFF, sizeof(header));
+    header.magic = SECTOR_MAGIC;
+    header.eraseCount = eraseCount;
+    header.formatCheck = calculateFormatCheck(header);
+
+    forgetSectorPages(sector);
+
+    bool result = true;
+    {
+        auto flashDriver = Device::get().getFlashDriver();
+
+        if (!flashDriver->beginWriteSession()) {
+            return false;
+        }
+
+        if (needsErase) {
+            result = flashDriver->eraseSector(sector);
+        }
+
+        if (result) {
+            result = flashDriver->writeObject(sector * FlashDriver::FLASH_PAGES_PER_SECTOR, header);
+        }
+
+        if (!flashDriver->endWriteSession()) {
+            result = false;
+        }
+    }
+
+    if (!result) {
+        // Retried last, after all other candidates
+        m_sectorStates.at(sector) = SectorState::FOREIGN;
+        return false;
+    }
+
+    m_sectorStates.at(sector) = SectorState::READY;
+    m_eraseCounts.at(sector) = eraseCount;
+    return true;
+}
+
+std::uint16_t FlashStore::findSectorToPrepare() const
+{
+    // Blank sectors cost no erase. Dirty sectors are taken least worn
+    // first, foreign ones last as they can still hold data of an older
+    // firmware.
+    auto rank = [](SectorState state) {
+        switch (state) {
+        case SectorState::BLANK:
+            return 0;
+        case SectorState::DIRTY:
+            return 1;
+        case SectorState::FOREIGN:
+            return 2;
+        default:
+            return -1;
+        }
+    };
+
+    std::uint16_t best = NO_SECTOR;
+    int bestRank = 0;
+
+    for (std::uint16_t sector = 0; sector < FlashDriver::FLASH_SECTOR_COUNT; ++sector) {
+        auto sectorRank = rank(m_sectorStates.at(sector));
+        if (sectorRank < 0) {
+            continue;
+        }
+
+        if (best == NO_SECTOR || sectorRank < bestRank
+            || (sectorRank == bestRank && m_eraseCounts.at(sector) < m_eraseCounts.at(best))) {
+
+            best = sector;
+            bestRank = sectorRank;
+        }
+    }
+
+    return best;
+}
+
+void FlashStore::forgetSectorPages(std::uint16_t sector)
+{
+    auto firstPage = sector * FlashDriver::FLASH_PAGES_PER_SECTOR;
+
+    for (std::size_t i = 0; i < FlashDriver::FLASH_PAGES_PER_SECTOR; ++i) {
+        m_pageChecked.reset(firstPage + i);
+        m_pageValid.reset(firstPage + i);
+    }
+}
+
+std::uint16_t FlashStore::getSectorAt(const StreamState& state, std::uint32_t position) const
+{
+    return state.sectors.at((state.head + position) % state.sectors.size());
+}
+
+std::uint16_t FlashStore::getNewestSector(const StreamState& state) const
+{
+    return getSectorAt(state, state.count - 1);
+}
+
+const FlashStore::SectorHeader* FlashStore::getSectorHeader(std::uint16_t sector) const
+{
+    return reinterpret_cast<const SectorHeader*>(getPage(sector * FlashDriver::FLASH_PAGES_PER_SECTOR));
+}
+
+const std::uint8_t* FlashStore::getPage(std::uint32_t page) const
+{
+    return m_flashBase + page * FlashDriver::FLASH_PAGE_SIZE;
+}
+
+bool FlashStore::isPageBlank(std::uint32_t page) const
+{
+    auto pageWordAddr = reinterpret_cast<const std::uint32_t*>(getPage(page));
+
+    for (std::size_t i = 0; i < FlashDriver::FLASH_PAGE_SIZE / sizeof(std::uint32_t); ++i) {
+        if (pageWordAddr[i] != INVALID_VALUE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FlashStore::isSectorBlank(std::uint16_t sector) const
+{
+    auto firstPage = sector * FlashDriver::FLASH_PAGES_PER_SECTOR;
+
+    for (std::size_t i = 0; i < FlashDriver::FLASH_PAGES_PER_SECTOR; ++i) {
+        if (!isPageBlank(firstPage + i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FlashStore::isRecordValid(std::uint32_t page)
+{
+    if (!m_pageChecked.test(page)) {
+        auto record = reinterpret_cast<const RecordHeader*>(getPage(page));
+
+        m_pageChecked.set(page);
+        m_pageValid.set(page, record->size <= MAX_RECORD_SIZE && record->crc == calculateRecordCrc(record));
+    }
+
+    return m_pageValid.test(page);
+}
+
+std::uint32_t FlashStore::calculateRecordCrc(const RecordHeader* record)
+{
+    // Covers the size and the payload, the unused tail of the last word
+    // is still erased
+    auto words = (sizeof(RecordHeader) - sizeof(std::uint32_t) + record->size + 3) / sizeof(std::uint32_t);
+    auto data = reinterpret_cast<const std::uint32_t*>(record) + 1;
+
+    portDISABLE_INTERRUPTS();
+    auto crc = HAL_CRC_Calculate(&hcrc, const_cast<std::uint32_t*>(data), words);
+    portENABLE_INTERRUPTS();
+
+    return crc;
+}
+
+std::uint32_t FlashStore::calculateFormatCheck(const SectorHeader& header)
+{
+    return header.magic ^ header.eraseCount ^ FORMAT_KEY;
+}
+
+std::uint32_t FlashStore::calculateAssignCheck(const SectorHeader& header)
+{
+    return header.sequence ^ header.stream ^ header.firstRecord ^ ASSIGN_KEY;
+}
+
+};
@@ -70,11 +70,8 @@ void FlowMeterService::updateFlow()
     std::uint32_t impulsesPerLiterInt = 0;
     float impulsesPerLiter = 0;
 
-    {
-        auto configService = Device::get().getConfigService();
-        impulsesPerLiterInt = configService->getCurrentConfig().impulsesPerLiter;
-        impulsesPerLiter = static_cast<float>(impulsesPerLiterInt);
-    }
+    impulsesPerLiterInt = Device::get().getConfigSnapshot().impulsesPerLiter;
+    impulsesPerLiter = static_cast<float>(impulsesPerLiterInt);
 
     if (impulsesPerLiter == 0) {
         impulsesPerLiter = DEFAULT_IMPULSES_PER_LITER;
@@ -3,15 +3,12 @@
 #include <device.hpp>
 
 #include <crc.h>
+#include <rtc.h>
 
-namespace lg {
+#include <algorithm>
+#include <cstddef>
 
-static inline bool areTheSameDay(const UtcTime& date1, const UtcTime& date2)
-{
-    return date1.getDay() == date2.getDay()
-        && date1.getMonth() == date2.getMonth()
-        && date1.getYear() == date2.getYear();
-}
+namespace lg {
 
 void HistoryService::initialize()
 {
@@ -20,17 +17,32 @@ void HistoryService::initialize()
     });
 
     loadNewestHistoryFromEeprom();
-    findFlashWriteIndex();
+
+    auto startTicks = HAL_GetTick();
+    mountFlashHistory();
+    mountRollups();
+
+    m_flashLoadTimeMs = HAL_GetTick() - startTicks;
 
     std::uint32_t totalVolumeMl = 0;
-    for (auto& entry : m_newestHistory) {
-        if (isEntryValid(entry) && entry.totalMl > totalVolumeMl) {
-            totalVolumeMl = entry.totalMl;
-        }
+    std::uint32_t newestTimestamp = 0;
+    if (!m_blockWriter.isEmpty()) {
+        totalVolumeMl = m_blockWriter.getLastPoint().totalMl;
+        newestTimestamp = m_blockWriter.getLastPoint().timestamp;
     }
 
-    Device::get().getFlowMeterService()->setTotalVolumeInMl(totalVolumeMl);
+    // Data points that were still staged when the power failed are lost,
+    // but the volume they counted is picked up by the next data point
     m_lastTotalVolume = totalVolumeMl;
+
+    PowerFailMarker marker {};
+    if (readPowerFailMarker(marker) && marker.timestamp > newestTimestamp
+        && marker.totalMl > totalVolumeMl) {
+
+        totalVolumeMl = marker.totalMl;
+    }
+
+    Device::get().getFlowMeterService()->setTotalVolumeInMl(totalVolumeMl);
 }
 
 void HistoryService::timeUpdated()
@@ -39,13 +51,14 @@ void HistoryService::timeUpdated()
         return;
     }
 
+    ensureDayIndex();
+
     auto currentTime = Device::get().getLocalTime();
     std::uint32_t todayTotalMl = 0;
 
-    for (auto& entry : m_newestHistory) {
-        auto entryLocalTime = Device::get().getLocalTimeForUtcTimestamp(entry.timestamp);
-        if (isEntryValid(entry) && areTheSameDay(currentTime, entryLocalTime)) {
-            todayTotalMl += entry.volumeMl;
+    if (auto today = findDayIndexEntry(currentTime)) {
+        for (auto volumeMl : today->hourVolumesMl) {
+            todayTotalMl += volumeMl;
         }
     }
 
@@ -57,27 +70,38 @@ void HistoryService::timeUpdated()
 void HistoryService::forEachNewestHistoryEntry(
     std::function<void(std::size_t, const EepromHistoryEntry&)> functor)
 {
-    auto localTime = Device::get().getLocalTime();
+    ensureDayIndex();
+
+    auto today = findDayIndexEntry(Device::get().getLocalTime());
+    if (!today) {
+        return;
+    }
 
-    auto readIndex = m_newestHistoryWriteIndex;
     std::size_t functorCallCount = 0;
+    std::uint32_t readTicks = 0;
 
-    for (std::size_t processed = 0; processed < m_newestHistory.size(); ++processed) {
-        auto& entry = m_newestHistory.at(readIndex);
+    for (auto block = today->firstBlock;; block = (block + 1) % m_blockSummaries.size()) {
+        auto startTicks = HAL_GetTick();
+        auto data = readBlock(block);
+        readTicks += HAL_GetTick() - startTicks;
 
-        if (isEntryValid(entry)) {
-            auto entryTime = Device::get().getLocalTimeForUtcTimestamp(entry.timestamp);
+        if (data) {
+            MinuteBlock::Reader reader(*data);
+            EepromHistoryEntry point {};
 
-            if (areTheSameDay(entryTime, localTime)) {
-                functor(functorCallCount++, entry);
+            while (reader.next(point)) {
+                if (point.timestamp >= today->fromTimestamp && point.timestamp <= today->toTimestamp) {
+                    functor(functorCallCount++, point);
+                }
             }
         }
 
-        ++readIndex;
-        if (readIndex >= m_newestHistory.size()) {
-            readIndex = 0;
+        if (block == m_writeBlock) {
+            break;
         }
     }
+
+    m_lastQueryTimeMs = readTicks;
 }
 
 void HistoryService::forEachFlashHistoryEntry(
@@ -85,16 +109,21 @@ void HistoryService::forEachFlashHistoryEntry(
     std::function<void(std::size_t, const FlashHistoryEntry&)> functor)
 {
     std::size_t functorCallCount = 0;
-    auto flash = Device::get().getFlashDriver();
-
-    for (size_t i = 0; i < m_flashWriteIndex; ++i) {
-        auto entry = reinterpret_cast<FlashHistoryEntry*>(flash->getPageAddress(i));
+    auto flashStore = Device::get().getFlashStore();
+    auto endRecord = flashStore->getEndRecord(FLASH_STREAM);
 
-        if (entry->toTimestamp < fromTimestamp || entry->fromTimestamp > toTimestamp) {
+    for (auto i = findFirstFlashRecord(flashStore, fromTimestamp); i < endRecord; ++i) {
+        auto entry = flashStore->getRecordObject<FlashHistoryEntry>(FLASH_STREAM, i);
+        if (!entry) {
             continue;
         }
 
-        if (!isFlashEntryOk(*entry)) {
+        if (entry->fromTimestamp > toTimestamp) {
+            // Valid records are written in timestamp order
+            break;
+        }
+
+        if (entry->toTimestamp < fromTimestamp) {
             continue;
         }
 
@@ -104,6 +133,11 @@ void HistoryService::forEachFlashHistoryEntry(
 
 void HistoryService::handleInterval()
 {
+    // Block writes are queued, a failure is only known afterwards
+    if (m_eepromWriteFailed) {
+        m_disabled = true;
+    }
+
     if (m_disabled) {
         return;
     }
@@ -112,6 +146,8 @@ void HistoryService::handleInterval()
         return;
     }
 
+    ensureDayIndex();
+
     if (!m_initialDumpDone) {
         performInitialDumpToFlash();
         m_initialDumpDone = true;
@@ -120,51 +156,223 @@ void HistoryService::handleInterval()
     bool nextDay = writeNewestHistoryDataPoint();
 
     if (nextDay) {
-        auto timestamp = Device::get().getLocalTime().toTimestamp() - 43200;
-        sumUpDayAndWriteToFlash(timestamp);
+        sumUpDayAndWriteToFlash(m_dayIndex.at(1));
     }
 }
 
 void HistoryService::loadNewestHistoryFromEeprom()
 {
-    auto eepromDriver = Device::get().getEepromDriver();
-    if (!eepromDriver->readObject(getEepromAddress(0), m_newestHistory)) {
+    loadGeneration();
+
+    if (!loadBlockSummaries()) {
         Device::get().setError(Device::ErrorCode::EEPROM_ERROR);
         m_disabled = true;
         return;
     }
 
-    m_newestHistoryWriteIndex = findNewestHistoryWriteIndex();
+    if (!m_blockSummaries.at(findNewestBlock()).pointCount) {
+        migrateLegacyEepromHistory();
+        loadBlockSummaries();
+    }
+
+    m_writeBlock = findNewestBlock();
+
+    if (!Device::get().getEepromQueue().readObject(getEepromAddress(m_writeBlock), m_openBlock)) {
+        m_openBlock.clear();
+    }
+
+    m_blockWriter.open(m_openBlock, m_generation);
 }
 
-std::uint32_t HistoryService::findNewestHistoryWriteIndex() const
+void HistoryService::loadGeneration()
 {
-    std::uint32_t lastTimestamp = 0;
+    RingHeader header {};
+
+    if (!Device::get().getEepromQueue().readObject(RING_HEADER_ADDR, header)) {
+        return;
+    }
 
-    for (std::size_t i = 0; i < m_newestHistory.size(); ++i) {
-        auto& entry = m_newestHistory.at(i);
+    // Rings written before the header existed are generation zero
+    if (header.magic == RING_HEADER_MAGIC && header.checksum == calculateRingHeaderChecksum(header)) {
+        m_generation = header.generation;
+    }
+}
 
-        if (!isEntryValid(entry)) {
-            // Set write index to first invalid cell
-            return i;
+bool HistoryService::loadBlockSummaries()
+{
+    auto& queue = Device::get().getEepromQueue();
+
+    for (std::size_t i = 0; i < m_blockSummaries.size(); ++i) {
+        if (!queue.readObject(getEepromAddress(i), m_readBlock)) {
+            return false;
         }
 
-        if (entry.timestamp <= lastTimestamp) {
-            // Set write index to first timestamp incontinuity
-            return i;
+        updateBlockSummary(i, m_readBlock);
+    }
+
+    return true;
+}
+
+std::uint32_t HistoryService::findNewestBlock() const
+{
+    // Blocks are started in ring order, so the newest one has the latest
+    // first data point
+    std::uint32_t newestBlock = 0;
+    std::uint32_t newestTimestamp = 0;
+    bool found = false;
+
+    for (std::size_t i = 0; i < m_blockSummaries.size(); ++i) {
+        auto& summary = m_blockSummaries.at(i);
+
+        if (summary.pointCount && (!found || summary.firstTimestamp > newestTimestamp)) {
+            newestBlock = i;
+            newestTimestamp = summary.firstTimestamp;
+            found = true;
         }
+    }
 
-        lastTimestamp = entry.timestamp;
+    return newestBlock;
+}
+
+const MinuteBlock* HistoryService::readBlock(std::uint32_t block)
+{
+    if (block == m_writeBlock) {
+        return &m_openBlock;
+    }
+
+    if (!m_blockSummaries.at(block).pointCount) {
+        return nullptr;
+    }
+
+    // Valid until the next call. Blocks are read for queries, which go
+    // ahead of the background writes.
+    if (!Device::get().getEepromQueue().readObject(getEepromAddress(block), m_readBlock, EepromQueue::Priority::INTERACTIVE)
+        || !m_readBlock.isValid(m_generation)) {
+        return nullptr;
     }
 
-    // If timestamps are monotonic and there are no empty cells,
-    // the buffer just wrapped around
-    return 0;
+    return &m_readBlock;
 }
 
-std::uint16_t HistoryService::getEepromAddress(std::size_t index) const
+void HistoryService::updateBlockSummary(std::uint32_t block, const MinuteBlock& data)
 {
-    return NEWEST_HISTORY_ADDR + index * sizeof(EepromHistoryEntry);
+    auto& summary = m_blockSummaries.at(block);
+    summary = {};
+
+    if (data.isValid(m_generation)) {
+        summary.firstTimestamp = data.header.firstTimestamp;
+        summary.pointCount = data.header.pointCount;
+        summary.usedBytes = data.getWriteSize();
+    }
+}
+
+std::uint16_t HistoryService::getEepromAddress(std::size_t block) const
+{
+    return NEWEST_HISTORY_ADDR + block * sizeof(MinuteBlock);
+}
+
+void HistoryService::migrateLegacyEepromHistory()
+{
+    // Older firmware stored one plain entry per minute in the ring area.
+    // The converted blocks would overwrite entries not read yet, so they
+    // are collected in an unused area first.
+    auto legacyPage = reinterpret_cast<const std::array<LegacyEepromEntry, LEGACY_ENTRIES_PER_PAGE>*>(&m_readBlock);
+    std::uint32_t cachedPage = INVALID_VALUE;
+
+    auto readLegacyEntry = [&](std::uint32_t index, LegacyEepromEntry& entry) {
+        auto page = index / LEGACY_ENTRIES_PER_PAGE;
+
+        if (page != cachedPage) {
+            if (!Device::get().getEepromQueue().readObject(NEWEST_HISTORY_ADDR + page * EepromDriver::EEPROM_PAGE_SIZE_BYTES,
+                    m_readBlock, EepromQueue::Priority::BACKGROUND)) {
+                return false;
+            }
+
+            cachedPage = page;
+        }
+
+        entry = legacyPage->at(index % LEGACY_ENTRIES_PER_PAGE);
+        return true;
+    };
+
+    std::uint32_t oldestIndex = 0;
+    std::uint32_t lastTimestamp = 0;
+    bool found = false;
+
+    for (std::uint32_t i = 0; i < LEGACY_ENTRY_COUNT; ++i) {
+        LegacyEepromEntry entry {};
+        if (!readLegacyEntry(i, entry)) {
+            return;
+        }
+
+        // Writes continued at the first invalid entry or timestamp
+        // incontinuity, so the oldest entry is there
+        if (!isLegacyEntryValid(entry) || entry.timestamp <= lastTimestamp) {
+            oldestIndex = i;
+            break;
+        }
+
+        lastTimestamp = entry.timestamp;
+        found = true;
+    }
+
+    if (!found) {
+        return;
+    }
+
+    std::uint32_t migratedBlocks = 0;
+    MinuteBlock::Writer writer;
+
+    auto writeMigratedBlock = [&] {
+        m_openBlock.seal(m_generation);
+
+        Device::get().getEepromQueue().writeObject(MIGRATION_ADDR + (migratedBlocks % MIGRATION_BLOCK_COUNT) * sizeof(MinuteBlock),
+            m_openBlock, EepromQueue::Priority::BACKGROUND);
+
+        ++migratedBlocks;
+    };
+
+    m_openBlock.clear();
+    writer.open(m_openBlock, m_generation);
+
+    for (std::uint32_t i = 0; i < LEGACY_ENTRY_COUNT; ++i) {
+        LegacyEepromEntry entry {};
+        if (!readLegacyEntry((oldestIndex + i) % LEGACY_ENTRY_COUNT, entry)) {
+            break;
+        }
+
+        if (!isLegacyEntryValid(entry)) {
+            continue;
+        }
+
+        EepromHistoryEntry point { entry.timestamp, entry.totalMl, entry.volumeMl };
+        if (!writer.append(point)) {
+            writeMigratedBlock();
+            m_openBlock.clear();
+            writer.open(m_openBlock, m_generation);
+            writer.append(point);
+        }
+    }
+
+    if (!writer.isEmpty()) {
+        writeMigratedBlock();
+    }
+
+    // The newest blocks are kept if the area wrapped around
+    auto count = std::min(migratedBlocks, MIGRATION_BLOCK_COUNT);
+
+    for (std::uint32_t i = 0; i < count; ++i) {
+        auto source = (migratedBlocks - count + i) % MIGRATION_BLOCK_COUNT;
+
+        auto& queue = Device::get().getEepromQueue();
+        if (!queue.readObject(MIGRATION_ADDR + source * sizeof(MinuteBlock), m_readBlock, EepromQueue::Priority::BACKGROUND)) {
+            break;
+        }
+
+        queue.writeObject(getEepromAddress(i), m_readBlock, EepromQueue::Priority::BACKGROUND);
+    }
+
+    m_eepromWriteCount += migratedBlocks + count;
 }
 
 bool HistoryService::writeNewestHistoryDataPoint()
@@ -173,7 +381,6 @@ bool HistoryService::writeNewestHistoryDataPoint()
     auto currentTotalVolume
         = Device::get().getFlowMeterService()->getTotalVolumeInMl();
     auto timestamp = utcTime.toTimestamp();
-    auto localTime = Device::get().getLocalTimeForUtcTimestamp(timestamp);
 
     if (timestamp <= m_newestHistoryLastTimestamp) {
         return false;
@@ -182,117 +389,325 @@ bool HistoryService::writeNewestHistoryDataPoint()
     std::uint32_t volumeDelta = currentTotalVolume - m_lastTotalVolume;
     m_lastTotalVolume = currentTotalVolume;
 
-    auto& entry = m_newestHistory.at(m_newestHistoryWriteIndex);
-    entry.timestamp = timestamp;
-    entry.totalMl = currentTotalVolume;
-    entry.volumeMl = volumeDelta;
-    entry.checksum = calculateEntryChecksum(entry);
+    EepromHistoryEntry point { timestamp, currentTotalVolume, volumeDelta };
+    appendDataPoint(point);
 
-    {
-        auto eepromDriver = Device::get().getEepromDriver();
-        eepromDriver->enableWrites();
-        if (!eepromDriver->writeSmallObject(
-                getEepromAddress(m_newestHistoryWriteIndex), entry)) {
+    bool nextDay = addToDayIndex(m_writeBlock, point);
 
-            Device::get().setError(Device::ErrorCode::EEPROM_ERROR);
-            m_disabled = true;
+    m_newestHistoryLastTimestamp = timestamp;
+
+    // The block stays staged in RAM until it is full or the oldest staged
+    // data point reaches the flush window
+    if (!m_stagedSinceTimestamp) {
+        m_stagedSinceTimestamp = timestamp;
+    }
+
+    writePowerFailMarker(timestamp, currentTotalVolume);
+
+    if (timestamp - m_stagedSinceTimestamp >= MAX_STAGED_SECONDS) {
+        flushNewestHistory();
+    }
+
+    return nextDay;
+}
+
+void HistoryService::appendDataPoint(const EepromHistoryEntry& point)
+{
+    if (!m_blockWriter.append(point)) {
+        // Full, or the data point does not continue the block
+        flushNewestHistory();
+        startNextBlock();
+        m_blockWriter.append(point);
+    }
+
+    m_openBlock.seal(m_generation);
+    updateBlockSummary(m_writeBlock, m_openBlock);
+}
+
+void HistoryService::startNextBlock()
+{
+    m_writeBlock = (m_writeBlock + 1) % m_blockSummaries.size();
+
+    // The oldest block is dropped, an indexed day starting in it loses
+    // its first data points
+    bool rebuild = false;
+    for (auto& day : m_dayIndex) {
+        if (day.count && day.firstBlock == m_writeBlock) {
+            rebuild = true;
         }
-        eepromDriver->disableWrites();
     }
 
-    ++m_newestHistoryWriteIndex;
-    if (m_newestHistoryWriteIndex >= m_newestHistory.size()) {
-        m_newestHistoryWriteIndex = 0;
+    m_openBlock.clear();
+    m_blockWriter.open(m_openBlock, m_generation);
+    updateBlockSummary(m_writeBlock, m_openBlock);
+
+    if (rebuild) {
+        rebuildDayIndex();
     }
+}
 
-    auto prevDayTime = Device::get().getLocalTimeForUtcTimestamp(
-        m_newestHistoryLastTimestamp);
-    m_newestHistoryLastTimestamp = timestamp;
-    return !areTheSameDay(localTime, prevDayTime);
+void HistoryService::flushNewestHistory()
+{
+    if (!m_stagedSinceTimestamp) {
+        return;
+    }
+
+    // The used part of the block always fits in one page write. The queue
+    // keeps a copy, so the block can take new data points right away.
+    if (!Device::get().getEepromQueue().write(getEepromAddress(m_writeBlock), &m_openBlock,
+            m_openBlock.getWriteSize(), EepromQueue::Priority::NORMAL,
+            &HistoryService::eepromWriteFinished, this)) {
+
+        Device::get().setError(Device::ErrorCode::EEPROM_ERROR);
+        m_disabled = true;
+    }
+
+    ++m_eepromWriteCount;
+    m_stagedSinceTimestamp = 0;
+}
+
+void HistoryService::eepromWriteFinished(void* context, bool success)
+{
+    if (!success) {
+        Device::get().setError(Device::ErrorCode::EEPROM_ERROR);
+        static_cast<HistoryService*>(context)->m_eepromWriteFailed = true;
+    }
+}
+
+HistoryService::EepromHistoryStats HistoryService::getEepromHistoryStats() const
+{
+    EepromHistoryStats stats {};
+    stats.oldestTimestamp = INVALID_VALUE;
+
+    for (auto& summary : m_blockSummaries) {
+        if (!summary.pointCount) {
+            continue;
+        }
+
+        stats.dataPoints += summary.pointCount;
+        ++stats.usedBlocks;
+        stats.usedBytes += summary.usedBytes;
+        stats.oldestTimestamp = std::min(stats.oldestTimestamp, summary.firstTimestamp);
+    }
+
+    if (!stats.usedBlocks) {
+        stats.oldestTimestamp = 0;
+    }
+
+    return stats;
 }
 
-std::uint32_t HistoryService::calculateEntryChecksum(const EepromHistoryEntry& entry)
+void HistoryService::writeDiagnostics(ArduinoJson::JsonObject out) const
 {
-    return entry.timestamp ^ entry.totalMl ^ entry.volumeMl ^ 0x89ABCDEF;
+    auto stats = getEepromHistoryStats();
+
+    out["flash_load_ms"] = m_flashLoadTimeMs;
+    out["eeprom_writes"] = m_eepromWriteCount;
+    out["eeprom_points"] = stats.dataPoints;
+    out["eeprom_blocks"] = stats.usedBlocks;
+    out["eeprom_bytes"] = stats.usedBytes;
+    out["eeprom_oldest"] = stats.oldestTimestamp;
+    out["eeprom_query_ms"] = m_lastQueryTimeMs;
 }
 
-bool HistoryService::isEntryValid(const EepromHistoryEntry& entry)
+bool HistoryService::readPowerFailMarker(PowerFailMarker& marker)
+{
+    marker.timestamp = HAL_RTCEx_BKUPRead(&hrtc, POWER_FAIL_MARKER_REG);
+    marker.totalMl = HAL_RTCEx_BKUPRead(&hrtc, POWER_FAIL_MARKER_REG + 1);
+    marker.checksum = HAL_RTCEx_BKUPRead(&hrtc, POWER_FAIL_MARKER_REG + 2);
+
+    return marker.checksum == calculateMarkerChecksum(marker);
+}
+
+void HistoryService::writePowerFailMarker(std::uint32_t timestamp, std::uint32_t totalMl)
+{
+    // Backup registers survive resets and, with a backup battery, power
+    // loss, without wearing out the EEPROM
+    PowerFailMarker marker {};
+    marker.timestamp = timestamp;
+    marker.totalMl = totalMl;
+    marker.checksum = calculateMarkerChecksum(marker);
+
+    HAL_RTCEx_BKUPWrite(&hrtc, POWER_FAIL_MARKER_REG, marker.timestamp);
+    HAL_RTCEx_BKUPWrite(&hrtc, POWER_FAIL_MARKER_REG + 1, marker.totalMl);
+    HAL_RTCEx_BKUPWrite(&hrtc, POWER_FAIL_MARKER_REG + 2, marker.checksum);
+}
+
+std::uint32_t HistoryService::calculateMarkerChecksum(const PowerFailMarker& marker)
+{
+    return marker.timestamp ^ marker.totalMl ^ 0x5E1F0A27;
+}
+
+bool HistoryService::isLegacyEntryValid(const LegacyEepromEntry& entry)
 {
     return entry.timestamp != INVALID_VALUE
         && entry.totalMl != INVALID_VALUE
         && entry.volumeMl != INVALID_VALUE
-        && entry.checksum == calculateEntryChecksum(entry);
+        && entry.checksum == (entry.timestamp ^ entry.totalMl ^ entry.volumeMl ^ 0x89ABCDEF);
 }
 
-void HistoryService::performInitialDumpToFlash()
+std::uint32_t HistoryService::calculateRingHeaderChecksum(const RingHeader& header)
 {
-    auto utcTime = Device::get().getUtcTime();
-    auto currentTimestamp = utcTime.toTimestamp();
-    auto localTime = Device::get().getLocalTimeForUtcTimestamp(currentTimestamp);
-    std::uint32_t latestTimestamp = 0;
-
-    for (auto& entry : m_newestHistory) {
-        if (!isEntryValid(entry)) {
-            continue;
-        }
+    return header.magic ^ header.generation ^ 0x2C7E41B9;
+}
 
-        if (entry.timestamp > latestTimestamp) {
-            latestTimestamp = entry.timestamp;
+UtcTime HistoryService::getLocalTimeForEntry(std::uint32_t timestamp)
+{
+    // Zone offsets only change on quarter-hour boundaries, so consecutive
+    // entries share a single timezone conversion. Two slots are cached,
+    // as writes touch both the newest and the oldest end of the ring.
+    auto slot = timestamp / LOCAL_OFFSET_SLOT_SECONDS;
+
+    for (auto& cached : m_localOffsets) {
+        if (cached.slot == slot) {
+            return UtcTime { timestamp + cached.offset };
         }
     }
 
-    if (currentTimestamp < latestTimestamp) {
-        return;
-    }
+    auto& cached = m_localOffsets.at(m_nextLocalOffset);
+    m_nextLocalOffset = (m_nextLocalOffset + 1) % m_localOffsets.size();
 
-    // If the latest timestamp is before today, we dump data, otherwise not
+    auto slotTimestamp = slot * LOCAL_OFFSET_SLOT_SECONDS;
+    auto slotLocalTime = Device::get().getLocalTimeForUtcTimestamp(slotTimestamp);
+
+    cached.slot = slot;
+    cached.offset = static_cast<std::int32_t>(slotLocalTime.toTimestamp() - slotTimestamp);
+
+    return UtcTime { timestamp + cached.offset };
+}
 
-    auto latestTime = Device::get().getLocalTimeForUtcTimestamp(latestTimestamp);
-    if (!areTheSameDay(latestTime, localTime)) {
-        sumUpDayAndWriteToFlash(latestTimestamp);
+void HistoryService::ensureDayIndex()
+{
+    if (m_dayIndexTimezoneRevision != Device::get().getLocalTimezoneRevision()) {
+        rebuildDayIndex();
     }
 }
 
-void HistoryService::sumUpDayAndWriteToFlash(std::uint32_t localTimestamp)
+void HistoryService::rebuildDayIndex()
 {
-    UtcTime localTime(localTimestamp);
-    FlashHistoryEntry historyEntry {};
-    historyEntry.fromTimestamp = INVALID_VALUE;
+    m_dayIndex = {};
+    m_dayIndexTimezoneRevision = Device::get().getLocalTimezoneRevision();
+    m_localOffsets = {};
 
-    for (auto& entry : m_newestHistory) {
-        if (!isEntryValid(entry)) {
+    // Only the newest blocks can hold data of the indexed days
+    auto startBlock = m_writeBlock;
+    std::uint32_t newestTimestamp = INVALID_VALUE;
+
+    for (std::size_t back = 0; back < m_blockSummaries.size(); ++back) {
+        auto block = (m_writeBlock + m_blockSummaries.size() - back) % m_blockSummaries.size();
+        auto& summary = m_blockSummaries.at(block);
+
+        if (!summary.pointCount) {
             continue;
         }
 
-        auto entryTime = Device::get().getLocalTimeForUtcTimestamp(entry.timestamp);
-        if (!areTheSameDay(localTime, entryTime)) {
-            continue;
+        if (newestTimestamp == INVALID_VALUE) {
+            newestTimestamp = summary.firstTimestamp;
         }
 
-        int hour = entryTime.getHour();
-        if (hour < 0 || hour >= 24) {
-            continue;
+        startBlock = block;
+        if (summary.firstTimestamp + DAY_INDEX_SECONDS <= newestTimestamp) {
+            break;
         }
+    }
 
-        historyEntry.hourVolumesMl.at(hour) += entry.volumeMl;
+    // Walk from the oldest of them to the newest one
+    for (auto block = startBlock;; block = (block + 1) % m_blockSummaries.size()) {
+        if (auto data = readBlock(block)) {
+            MinuteBlock::Reader reader(*data);
+            EepromHistoryEntry point {};
+
+            while (reader.next(point)) {
+                addToDayIndex(block, point);
+            }
+        }
 
-        if (entry.timestamp < historyEntry.fromTimestamp) {
-            historyEntry.fromTimestamp = entry.timestamp;
+        if (block == m_writeBlock) {
+            break;
         }
+    }
+}
+
+bool HistoryService::addToDayIndex(std::uint32_t block, const EepromHistoryEntry& point)
+{
+    auto entryTime = getLocalTimeForEntry(point.timestamp);
+    auto& newestDay = m_dayIndex.at(0);
+    bool nextDay = false;
+
+    if (!newestDay.isSameDay(entryTime)) {
+        nextDay = newestDay.count != 0;
+
+        m_dayIndex.at(1) = newestDay;
+        newestDay = DayIndexEntry {};
+        newestDay.year = entryTime.getYear();
+        newestDay.month = entryTime.getMonth();
+        newestDay.day = entryTime.getDay();
+    }
+
+    if (!newestDay.count) {
+        newestDay.firstBlock = block;
+        newestDay.fromTimestamp = point.timestamp;
+    }
+
+    ++newestDay.count;
+    newestDay.toTimestamp = point.timestamp;
+
+    int hour = entryTime.getHour();
+    if (hour >= 0 && hour < 24) {
+        newestDay.hourVolumesMl.at(hour) += point.volumeMl;
+    }
+
+    return nextDay;
+}
 
-        if (entry.timestamp > historyEntry.toTimestamp) {
-            historyEntry.toTimestamp = entry.timestamp;
+const HistoryService::DayIndexEntry* HistoryService::findDayIndexEntry(const UtcTime& localTime) const
+{
+    for (auto& day : m_dayIndex) {
+        if (day.count && day.isSameDay(localTime)) {
+            return &day;
         }
     }
 
-    if (historyEntry.fromTimestamp == INVALID_VALUE) {
+    return nullptr;
+}
+
+void HistoryService::performInitialDumpToFlash()
+{
+    auto& newestDay = m_dayIndex.at(0);
+    if (!newestDay.count) {
+        return;
+    }
+
+    auto utcTime = Device::get().getUtcTime();
+    auto currentTimestamp = utcTime.toTimestamp();
+    auto localTime = Device::get().getLocalTimeForUtcTimestamp(currentTimestamp);
+
+    if (currentTimestamp < newestDay.toTimestamp) {
+        return;
+    }
+
+    // If the latest timestamp is before today, we dump data, otherwise not
+
+    if (!newestDay.isSameDay(localTime)) {
+        sumUpDayAndWriteToFlash(newestDay);
+    }
+}
+
+void HistoryService::sumUpDayAndWriteToFlash(const DayIndexEntry& day)
+{
+    if (!day.count) {
         // No data found
         return;
     }
 
-    historyEntry.year = localTime.getYear();
-    historyEntry.month = localTime.getMonth();
-    historyEntry.day = localTime.getDay();
+    FlashHistoryEntry historyEntry {};
+    historyEntry.year = day.year;
+    historyEntry.month = day.month;
+    historyEntry.day = day.day;
+    historyEntry.fromTimestamp = day.fromTimestamp;
+    historyEntry.toTimestamp = day.toTimestamp;
+    historyEntry.hourVolumesMl = day.hourVolumesMl;
+    historyEntry.cumulativeMl = m_flashCumulativeMl + getDayTotal(historyEntry);
     historyEntry.crc = calculateFlashEntryCrc(historyEntry);
 
     if (m_flashDataUpToTimestamp > historyEntry.fromTimestamp) {
@@ -300,81 +715,372 @@ void HistoryService::sumUpDayAndWriteToFlash(std::uint32_t localTimestamp)
     }
 
     m_flashDataUpToTimestamp = historyEntry.toTimestamp;
+    m_flashCumulativeMl = historyEntry.cumulativeMl;
 
     {
-        auto flashDriver = Device::get().getFlashDriver();
-        if (!flashDriver->writeObject(m_flashWriteIndex++, historyEntry)) {
+        auto flashStore = Device::get().getFlashStore();
+        if (!flashStore->appendObject(FLASH_STREAM, historyEntry)) {
             Device::get().setError(Device::ErrorCode::FLASH_ERROR);
             m_disabled = true;
+            return;
         }
     }
+
+    addDayToRollups(historyEntry);
 }
 
-std::uint32_t HistoryService::calculateFlashEntryCrc(const FlashHistoryEntry& entry)
+template <typename T>
+std::uint32_t HistoryService::calculateFlashEntryCrc(const T& entry)
 {
+    static_assert(offsetof(T, crc) == sizeof(T) - sizeof(std::uint32_t),
+        "The CRC covers every word before it");
+
     portDISABLE_INTERRUPTS();
     auto crc = HAL_CRC_Calculate(&hcrc,
         const_cast<std::uint32_t*>(reinterpret_cast<const std::uint32_t*>(&entry)),
-        sizeof(FlashHistoryEntry) / sizeof(std::uint32_t) - 1);
+        sizeof(T) / sizeof(std::uint32_t) - 1);
     portENABLE_INTERRUPTS();
 
     return crc;
 }
 
-bool HistoryService::isFlashEntryOk(const FlashHistoryEntry& entry)
+template <typename T>
+bool HistoryService::isFlashEntryOk(const T& entry)
 {
     return entry.crc == calculateFlashEntryCrc(entry);
 }
 
-void HistoryService::findFlashWriteIndex()
+std::uint32_t HistoryService::getDayTotal(const FlashHistoryEntry& day)
+{
+    std::uint32_t totalMl = 0;
+    for (auto volumeMl : day.hourVolumesMl) {
+        totalMl += volumeMl;
+    }
+
+    return totalMl;
+}
+
+void HistoryService::mountFlashHistory()
 {
-    auto flashDriver = Device::get().getFlashDriver();
-    m_flashWriteIndex = 0;
+    auto flashStore = Device::get().getFlashStore();
+
     m_flashDataUpToTimestamp = 0;
+    m_flashCumulativeMl = 0;
+
+    // The last valid record holds the newest data and running total
+    auto firstRecord = flashStore->getFirstRecord(FLASH_STREAM);
+
+    for (auto record = flashStore->getEndRecord(FLASH_STREAM); record > firstRecord; --record) {
+        if (auto entry = flashStore->getRecordObject<FlashHistoryEntry>(FLASH_STREAM, record - 1)) {
+            m_flashDataUpToTimestamp = entry->toTimestamp;
+            m_flashCumulativeMl = entry->cumulativeMl;
+            break;
+        }
+    }
 
-    while (m_flashWriteIndex < FlashDriver::FLASH_PAGE_COUNT) {
-        auto pageAddr = flashDriver->getPageAddress(m_flashWriteIndex);
-        auto pageWordAddr = reinterpret_cast<std::uint32_t*>(pageAddr);
-        bool empty = true;
+    migrateLegacyFlashHistory(flashStore);
+}
+
+void HistoryService::mountRollups()
+{
+    int lastRollupKey = -1;
+
+    {
+        auto flashStore = Device::get().getFlashStore();
+        auto endRecord = flashStore->getEndRecord(FlashStore::Stream::ROLLUPS);
 
-        for (size_t i = 0; i < FlashDriver::FLASH_PAGE_SIZE / sizeof(std::uint32_t); ++i) {
-            if (pageWordAddr[i] != INVALID_VALUE) {
-                empty = false;
+        for (auto record = flashStore->getFirstRecord(FlashStore::Stream::ROLLUPS); record < endRecord; ++record) {
+            auto rollup = flashStore->getRecordObject<MonthRollupEntry>(FlashStore::Stream::ROLLUPS, record);
+            if (!rollup) {
+                continue;
+            }
+
+            auto key = getMonthKey(rollup->year, rollup->month);
+            if (key < 0) {
+                continue;
+            }
+
+            m_monthTotalsMl.at(key) = rollup->totalMl;
+            m_monthDays.at(key) = rollup->days;
+            lastRollupKey = std::max(lastRollupKey, key);
+        }
+    }
+
+    for (std::size_t key = 0; key < m_monthTotalsMl.size(); ++key) {
+        m_yearTotalsMl.at(key / 12) += m_monthTotalsMl.at(key);
+        m_yearDays.at(key / 12) += m_monthDays.at(key);
+    }
+
+    // Days after the last rollup, normally only the current month. If a
+    // rollup was lost, the month is summed up and written again here.
+    std::uint32_t firstRecord = 0;
+    std::uint32_t endRecord = 0;
+
+    {
+        auto flashStore = Device::get().getFlashStore();
+        auto oldestRecord = flashStore->getFirstRecord(FLASH_STREAM);
+        endRecord = flashStore->getEndRecord(FLASH_STREAM);
+        firstRecord = endRecord;
+
+        while (firstRecord > oldestRecord) {
+            auto day = flashStore->getRecordObject<FlashHistoryEntry>(FLASH_STREAM, firstRecord - 1);
+            if (day && getMonthKey(day->year, day->month) <= lastRollupKey) {
                 break;
             }
+
+            --firstRecord;
+        }
+    }
+
+    for (auto record = firstRecord; record < endRecord; ++record) {
+        FlashHistoryEntry day {};
+
+        {
+            auto flashStore = Device::get().getFlashStore();
+            auto entry = flashStore->getRecordObject<FlashHistoryEntry>(FLASH_STREAM, record);
+            if (!entry) {
+                continue;
+            }
+
+            day = *entry;
         }
 
-        if (empty) {
+        addDayToRollups(day);
+    }
+}
+
+void HistoryService::addDayToRollups(const FlashHistoryEntry& day)
+{
+    auto key = getMonthKey(day.year, day.month);
+    if (key < 0) {
+        return;
+    }
+
+    if (m_openMonthKey >= 0 && key != m_openMonthKey) {
+        writeMonthRollup(m_openMonthKey);
+    }
+
+    m_openMonthKey = key;
+
+    auto dayTotalMl = getDayTotal(day);
+
+    m_monthTotalsMl.at(key) += dayTotalMl;
+    ++m_monthDays.at(key);
+    m_yearTotalsMl.at(key / 12) += dayTotalMl;
+    ++m_yearDays.at(key / 12);
+}
+
+void HistoryService::writeMonthRollup(int monthKey)
+{
+    MonthRollupEntry rollup {};
+    rollup.year = ROLLUP_FIRST_YEAR + monthKey / 12;
+    rollup.month = monthKey % 12 + 1;
+    rollup.totalMl = m_monthTotalsMl.at(monthKey);
+    rollup.days = m_monthDays.at(monthKey);
+
+    auto flashStore = Device::get().getFlashStore();
+    if (!flashStore->appendObject(FlashStore::Stream::ROLLUPS, rollup)) {
+        Device::get().setError(Device::ErrorCode::FLASH_ERROR);
+    }
+}
+
+int HistoryService::getMonthKey(int year, int month)
+{
+    if (year < ROLLUP_FIRST_YEAR || year >= ROLLUP_FIRST_YEAR + ROLLUP_YEARS || month < 1 || month > 12) {
+        return -1;
+    }
+
+    return (year - ROLLUP_FIRST_YEAR) * 12 + month - 1;
+}
+
+bool HistoryService::getPeriodTotal(int year, int month, std::uint32_t& totalMl, std::uint32_t& days) const
+{
+    if (month == 0) {
+        auto key = getMonthKey(year, 1);
+        if (key < 0) {
+            return false;
+        }
+
+        totalMl = m_yearTotalsMl.at(key / 12);
+        days = m_yearDays.at(key / 12);
+        return true;
+    }
+
+    auto key = getMonthKey(year, month);
+    if (key < 0) {
+        return false;
+    }
+
+    totalMl = m_monthTotalsMl.at(key);
+    days = m_monthDays.at(key);
+    return true;
+}
+
+void HistoryService::migrateLegacyFlashHistory(ScopedResource<FlashStore>& flashStore)
+{
+    // Older firmware wrote one entry per page from the start of the flash.
+    // The store erases those sectors last, so they are still readable
+    // until every entry has been copied.
+    const std::uint8_t* flashBase = nullptr;
+    {
+        auto flashDriver = Device::get().getFlashDriver();
+        flashBase = reinterpret_cast<const std::uint8_t*>(flashDriver->getBasePtr());
+    }
+
+    auto getLegacyEntry = [flashBase](std::size_t page) {
+        return reinterpret_cast<const LegacyFlashHistoryEntry*>(flashBase + page * FlashDriver::FLASH_PAGE_SIZE);
+    };
+
+    if (!isFlashEntryOk(*getLegacyEntry(0))) {
+        return;
+    }
+
+    for (std::size_t page = 0; page < FlashDriver::FLASH_PAGE_COUNT; ++page) {
+        auto legacyEntry = getLegacyEntry(page);
+
+        if (isFlashPageEmpty(legacyEntry)) {
             break;
         }
 
-        auto entryPtr = reinterpret_cast<const FlashHistoryEntry*>(pageWordAddr);
-        if (isFlashEntryOk(*entryPtr)) {
-            if (m_flashDataUpToTimestamp < entryPtr->toTimestamp) {
-                m_flashDataUpToTimestamp = entryPtr->toTimestamp;
-            }
+        // Copied before an interrupted migration
+        if (m_flashDataUpToTimestamp > legacyEntry->fromTimestamp) {
+            continue;
+        }
+
+        if (!isFlashEntryOk(*legacyEntry)) {
+            continue;
+        }
+
+        // The flash is not memory-mapped while the record is written
+        FlashHistoryEntry entry {};
+        entry.year = legacyEntry->year;
+        entry.month = legacyEntry->month;
+        entry.day = legacyEntry->day;
+        entry.fromTimestamp = legacyEntry->fromTimestamp;
+        entry.toTimestamp = legacyEntry->toTimestamp;
+        entry.hourVolumesMl = legacyEntry->hourVolumesMl;
+        entry.cumulativeMl = m_flashCumulativeMl + getDayTotal(entry);
+        entry.crc = calculateFlashEntryCrc(entry);
+
+        if (!flashStore->appendObject(FLASH_STREAM, entry)) {
+            return;
         }
 
-        ++m_flashWriteIndex;
+        m_flashDataUpToTimestamp = entry.toTimestamp;
+        m_flashCumulativeMl = entry.cumulativeMl;
     }
+}
 
-    if (m_flashWriteIndex == FlashDriver::FLASH_PAGE_COUNT) {
-        m_disabled = true;
+bool HistoryService::isFlashPageEmpty(const LegacyFlashHistoryEntry* entry)
+{
+    auto pageWordAddr = reinterpret_cast<const std::uint32_t*>(entry);
+
+    for (size_t i = 0; i < FlashDriver::FLASH_PAGE_SIZE / sizeof(std::uint32_t); ++i) {
+        if (pageWordAddr[i] != INVALID_VALUE) {
+            return false;
+        }
     }
+
+    return true;
 }
 
-void HistoryService::clearEepromHistory()
+std::uint32_t HistoryService::findFirstFlashRecord(
+    ScopedResource<FlashStore>& flashStore, std::uint32_t fromTimestamp)
+{
+    // First record that can contain an entry ending at or after fromTimestamp
+    return findFlashRecord(flashStore, [fromTimestamp](const FlashHistoryEntry& entry) {
+        return entry.toTimestamp < fromTimestamp;
+    });
+}
+
+std::uint32_t HistoryService::findFlashRecord(ScopedResource<FlashStore>& flashStore,
+    const std::function<bool(const FlashHistoryEntry&)>& isBefore)
 {
-    auto eepromDriver = Device::get().getEepromDriver();
-    eepromDriver->enableWrites();
+    // Valid records are ordered by time, find the first record whose
+    // entry is not before the searched one. Invalid records are skipped
+    // over towards the end of the range.
+    auto low = flashStore->getFirstRecord(FLASH_STREAM);
+    auto high = flashStore->getEndRecord(FLASH_STREAM);
+
+    while (low < high) {
+        auto middle = low + (high - low) / 2;
+        auto record = middle;
+        const FlashHistoryEntry* entry = nullptr;
+
+        while (record < high && !(entry = flashStore->getRecordObject<FlashHistoryEntry>(FLASH_STREAM, record))) {
+            ++record;
+        }
 
-    for (std::size_t i = 0; i < m_newestHistory.size(); ++i) {
-        m_newestHistory.at(i).checksum ^= 0xFFFFFFFF;
+        if (entry && isBefore(*entry)) {
+            low = record + 1;
+        } else {
+            high = middle;
+        }
+    }
 
-        eepromDriver->writeSmallObject(getEepromAddress(i), m_newestHistory.at(i));
+    return low;
+}
+
+void HistoryService::getRangeTotal(std::uint32_t fromTimestamp, std::uint32_t toTimestamp, std::uint32_t& totalMl)
+{
+    totalMl = 0;
+
+    if (fromTimestamp > toTimestamp) {
+        return;
     }
 
-    eepromDriver->disableWrites();
+    auto flashStore = Device::get().getFlashStore();
+    auto firstRecord = findFirstFlashRecord(flashStore, fromTimestamp);
+    auto endRecord = findFlashRecord(flashStore, [toTimestamp](const FlashHistoryEntry& entry) {
+        return entry.fromTimestamp <= toTimestamp;
+    });
+
+    std::uint32_t firstBeforeMl = 0;
+    bool firstFound = false;
+
+    for (; firstRecord < endRecord; ++firstRecord) {
+        if (auto entry = flashStore->getRecordObject<FlashHistoryEntry>(FLASH_STREAM, firstRecord)) {
+            firstBeforeMl = entry->cumulativeMl - getDayTotal(*entry);
+            firstFound = true;
+            break;
+        }
+    }
+
+    if (!firstFound) {
+        return;
+    }
+
+    for (; endRecord > firstRecord; --endRecord) {
+        if (auto entry = flashStore->getRecordObject<FlashHistoryEntry>(FLASH_STREAM, endRecord - 1)) {
+            // Running totals wrap around, the difference is still exact
+            totalMl = entry->cumulativeMl - firstBeforeMl;
+            return;
+        }
+    }
+}
+
+void HistoryService::clearEepromHistory()
+{
+    // Blocks of the previous generation fail their CRC from now on and
+    // are overwritten as the ring advances
+    RingHeader header {};
+    header.magic = RING_HEADER_MAGIC;
+    header.generation = m_generation + 1;
+    header.checksum = calculateRingHeaderChecksum(header);
+
+    if (!Device::get().getEepromQueue().writeObject(RING_HEADER_ADDR, header)) {
+        Device::get().setError(Device::ErrorCode::EEPROM_ERROR);
+        return;
+    }
+
+    ++m_eepromWriteCount;
+    m_generation = header.generation;
+    m_blockSummaries = {};
+    m_openBlock.clear();
+    m_blockWriter.open(m_openBlock, m_generation);
+    m_stagedSinceTimestamp = 0;
+
+    rebuildDayIndex();
 }
 
 }
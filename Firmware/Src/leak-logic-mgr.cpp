@@ -119,10 +119,7 @@ void LeakLogicManager::saveConfiguration() const
 {
     const auto serializedConfig = getCriteriaString();
     auto configService = Device::get().getConfigService();
-    auto& config = configService->getCurrentConfig();
-
-    config.leakLogicConfig = serializedConfig;
-
+    configService->setLeakLogicConfig(serializedConfig);
     configService->commit();
 }
 
@@ -0,0 +1,256 @@
+#include <minute-block.hpp>
+
+#include <FreeRTOS.h>
+
+#include <crc.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace lg {
+
+static std::size_t readVarint(const std::uint8_t* data, std::size_t size, std::uint64_t& value)
+{
+    value = 0;
+
+    for (std::size_t i = 0; i < size && i < 10; ++i) {
+        value |= static_cast<std::uint64_t>(data[i] & 0x7F) << (7 * i);
+
+        if (!(data[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static std::size_t writeVarint(std::uint8_t* data, std::uint64_t value)
+{
+    std::size_t size = 0;
+
+    while (value >= 0x80) {
+        data[size++] = static_cast<std::uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+
+    data[size++] = static_cast<std::uint8_t>(value);
+    return size;
+}
+
+void MinuteBlock::clear()
+{
+    header = {};
+    payload = {};
+}
+
+void MinuteBlock::seal(std::uint32_t generation)
+{
+    header.crc = calculateCrc() ^ generation;
+}
+
+bool MinuteBlock::isValid(std::uint32_t generation) const
+{
+    return header.length <= PAYLOAD_SIZE && header.pointCount
+        && header.crc == (calculateCrc() ^ generation);
+}
+
+std::size_t MinuteBlock::getWriteSize() const
+{
+    auto words = (std::min<std::size_t>(header.length, PAYLOAD_SIZE) + sizeof(std::uint32_t) - 1) / sizeof(std::uint32_t);
+    return sizeof(Header) + words * sizeof(std::uint32_t);
+}
+
+bool MinuteBlock::readToken(std::size_t offset, Token& token) const
+{
+    std::uint64_t value = 0;
+    auto size = readVarint(payload.data() + offset, header.length - offset, value);
+    if (!size) {
+        return false;
+    }
+
+    token.kind = static_cast<TokenKind>(value & 0x03);
+    token.gap = MINUTE_SECONDS;
+    value >>= 2;
+
+    if (token.kind == TokenKind::RUN) {
+        ++value;
+    } else if (token.kind == TokenKind::GAP) {
+        std::uint64_t gap = 0;
+        auto gapSize = readVarint(payload.data() + offset + size, header.length - offset - size, gap);
+        if (!gapSize || !gap || gap > std::numeric_limits<std::uint32_t>::max()) {
+            return false;
+        }
+
+        token.gap = gap;
+        size += gapSize;
+    } else if (token.kind != TokenKind::MINUTE) {
+        return false;
+    }
+
+    if (value > std::numeric_limits<std::uint32_t>::max()) {
+        return false;
+    }
+
+    token.value = value;
+    token.size = size;
+    return true;
+}
+
+bool MinuteBlock::writeToken(std::size_t offset, const Token& token)
+{
+    // Longest token: two bits of kind and a volume, followed by a gap
+    std::array<std::uint8_t, 10> buffer {};
+
+    std::uint64_t value = token.kind == TokenKind::RUN ? token.value - 1 : token.value;
+    auto size = writeVarint(buffer.data(), value << 2 | static_cast<std::uint64_t>(token.kind));
+
+    if (token.kind == TokenKind::GAP) {
+        size += writeVarint(buffer.data() + size, token.gap);
+    }
+
+    if (offset + size > PAYLOAD_SIZE) {
+        return false;
+    }
+
+    std::copy_n(buffer.begin(), size, payload.begin() + offset);
+    header.length = offset + size;
+    return true;
+}
+
+std::uint32_t MinuteBlock::calculateCrc() const
+{
+    auto words = (getWriteSize() - sizeof(header.crc)) / sizeof(std::uint32_t);
+
+    portDISABLE_INTERRUPTS();
+    auto crc = HAL_CRC_Calculate(&hcrc,
+        const_cast<std::uint32_t*>(&header.firstTimestamp), words);
+    portENABLE_INTERRUPTS();
+
+    return crc;
+}
+
+MinuteBlock::Reader::Reader(const MinuteBlock& block)
+    : m_block(block)
+{
+    m_point.timestamp = block.header.firstTimestamp - MINUTE_SECONDS;
+    m_point.totalMl = block.header.baseTotalMl;
+}
+
+bool MinuteBlock::Reader::next(DataPoint& point)
+{
+    if (m_runLeft) {
+        --m_runLeft;
+        m_point.timestamp += MINUTE_SECONDS;
+        m_point.volumeMl = 0;
+        point = m_point;
+        return true;
+    }
+
+    Token token {};
+    if (m_offset >= m_block.header.length || !m_block.readToken(m_offset, token)) {
+        return false;
+    }
+
+    m_offset += token.size;
+    m_point.timestamp += token.gap;
+
+    if (token.kind == TokenKind::RUN) {
+        m_runLeft = token.value - 1;
+        m_point.volumeMl = 0;
+    } else {
+        m_point.volumeMl = token.value;
+        m_point.totalMl += token.value;
+    }
+
+    point = m_point;
+    return true;
+}
+
+void MinuteBlock::Writer::open(MinuteBlock& block, std::uint32_t generation)
+{
+    m_block = &block;
+    m_lastTokenOffset = 0;
+    m_lastTokenIsRun = false;
+
+    if (!block.isValid(generation)) {
+        block.clear();
+        return;
+    }
+
+    // Bytes after the CRC covered words were never written in this cycle
+    std::fill(block.payload.begin() + block.header.length, block.payload.end(), 0);
+
+    Token token {};
+    for (std::size_t offset = 0; offset < block.header.length; offset += token.size) {
+        if (!block.readToken(offset, token)) {
+            break;
+        }
+
+        m_lastTokenOffset = offset;
+        m_lastTokenIsRun = token.kind == TokenKind::RUN;
+    }
+
+    Reader reader(block);
+    while (reader.next(m_lastPoint)) { }
+}
+
+bool MinuteBlock::Writer::append(const DataPoint& point)
+{
+    auto& header = m_block->header;
+
+    if (!header.pointCount) {
+        header.firstTimestamp = point.timestamp;
+        header.baseTotalMl = point.totalMl - point.volumeMl;
+        m_lastPoint.timestamp = point.timestamp - MINUTE_SECONDS;
+        m_lastPoint.totalMl = header.baseTotalMl;
+    }
+
+    if (point.timestamp <= m_lastPoint.timestamp
+        || point.totalMl != m_lastPoint.totalMl + point.volumeMl
+        || header.pointCount == std::numeric_limits<std::uint16_t>::max()) {
+
+        return false;
+    }
+
+    auto gap = point.timestamp - m_lastPoint.timestamp;
+
+    if (gap == MINUTE_SECONDS && !point.volumeMl && m_lastTokenIsRun) {
+        // The run is always the last token, so it can grow in place
+        Token run {};
+        if (!m_block->readToken(m_lastTokenOffset, run)) {
+            return false;
+        }
+
+        ++run.value;
+        if (!m_block->writeToken(m_lastTokenOffset, run)) {
+            return false;
+        }
+    } else {
+        Token token {};
+        token.gap = gap;
+        token.value = point.volumeMl;
+
+        if (gap != MINUTE_SECONDS) {
+            token.kind = TokenKind::GAP;
+        } else if (!point.volumeMl) {
+            token.kind = TokenKind::RUN;
+            token.value = 1;
+        } else {
+            token.kind = TokenKind::MINUTE;
+        }
+
+        std::size_t offset = header.length;
+        if (!m_block->writeToken(offset, token)) {
+            return false;
+        }
+
+        m_lastTokenOffset = offset;
+        m_lastTokenIsRun = token.kind == TokenKind::RUN;
+    }
+
+    ++header.pointCount;
+    m_lastPoint = point;
+    return true;
+}
+
+};
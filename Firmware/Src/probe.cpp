@@ -13,14 +13,6 @@ static bool isPaired(const ConfigService::ProbeId& probeId)
     return probeId != ConfigService::INVALID_PROBE_ID;
 }
 
-static bool isProbeValid(
-    const ConfigService::ProbeId& probeId, const ProbeMessage& probeMessage)
-{
-    return probeId.word1 == probeMessage.uid1
-        && probeId.word2 == probeMessage.uid2
-        && probeId.word3 == probeMessage.uid3;
-}
-
 void ProbeService::initialize()
 {
     m_probePairedSequence.Append({ BuzzerService::Note::Gb6, 200 });
@@ -109,7 +101,7 @@ bool ProbeService::unpairProbe(std::uint8_t masterAddress)
             return false;
         }
 
-        currentConfig.pairedProbes.at(masterAddress) = ConfigService::INVALID_PROBE_ID;
+        config->setPairedProbe(masterAddress, ConfigService::INVALID_PROBE_ID);
         config->commit();
     }
 
@@ -144,7 +136,7 @@ bool ProbeService::setProbeIgnored(std::uint8_t masterAddress, bool ignored)
             return false;
         }
 
-        currentConfig.ignoredProbes.at(masterAddress) = ignored;
+        config->setProbeIgnored(masterAddress, ignored);
         config->commit();
     }
 
@@ -272,12 +264,8 @@ bool ProbeService::handlePairingPacket(const ProbeMessage& packet, std::int32_t
         return false;
     }
 
-    auto& probeId = currentConfig.pairedProbes.at(packet.dipId);
-    probeId.word1 = packet.uid1;
-    probeId.word2 = packet.uid2;
-    probeId.word3 = packet.uid3;
-
-    currentConfig.ignoredProbes.at(packet.dipId) = false;
+    config->setPairedProbe(packet.dipId, ConfigService::ProbeId { packet.uid1, packet.uid2, packet.uid3 });
+    config->setProbeIgnored(packet.dipId, false);
 
     config->commit();
 
@@ -306,13 +294,8 @@ bool ProbeService::handlePairingPacket(const ProbeMessage& packet, std::int32_t
 
 void ProbeService::handlePingPacket(const ProbeMessage& packet, std::int32_t rssi)
 {
-    auto config = Device::get().getConfigService();
-    auto& currentConfig = config->getCurrentConfig();
-
-    if (!isProbeValid(currentConfig.pairedProbes.at(packet.dipId), packet)) {
-        return;
-    }
-
+    // The paired probe list mirrors the paired probes of the config, so the
+    // packet is checked without the config lock
     auto* probe = findProbeForPacket(packet);
     if (!probe) {
         return;
@@ -330,13 +313,6 @@ void ProbeService::handlePingPacket(const ProbeMessage& packet, std::int32_t rss
 
 void ProbeService::handleAlarmPacket(const ProbeMessage& packet, std::int32_t rssi)
 {
-    auto config = Device::get().getConfigService();
-    auto& currentConfig = config->getCurrentConfig();
-
-    if (!isProbeValid(currentConfig.pairedProbes.at(packet.dipId), packet)) {
-        return;
-    }
-
     auto* probe = findProbeForPacket(packet);
     if (!probe) {
         return;
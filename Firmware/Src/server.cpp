@@ -150,6 +150,27 @@ void Server::addGeneralRoutes()
         addJsonHeader(res);
         res << R"({"status":"ok"})";
     });
+
+    m_server.get("/diagnostics", [this](Request& req, Response& res) {
+        if (!checkAuthorization(req, res)) {
+            return;
+        }
+
+        ArduinoJson::StaticJsonDocument<DIAGNOSTICS_DOCUMENT_SIZE> doc;
+
+        Device::get().getConfigService()->writeDiagnostics(doc.createNestedObject("config"));
+
+        auto eeprom = doc.createNestedObject("eeprom");
+        Device::get().getEepromDriver()->writeDiagnostics(eeprom);
+        Device::get().getEepromQueue().writeDiagnostics(eeprom);
+
+        Device::get().getEspAtDriver().writeDiagnostics(doc.createNestedObject("esp"));
+        Device::get().getFlashStore()->writeDiagnostics(doc.createNestedObject("flash_store"));
+        Device::get().getHistoryService()->writeDiagnostics(doc.createNestedObject("history"));
+
+        addJsonHeader(res);
+        ArduinoJson::serializeJson(doc, res);
+    });
 }
 
 void Server::addBlockRoutes()
@@ -260,15 +281,19 @@ void Server::addBlockRoutes()
             weeklySchedule.at(i) = value;
         }
 
+        std::uint32_t generation = 0;
         {
             auto configService = Device::get().getConfigService();
-            auto& currentConfig = configService->getCurrentConfig();
-            currentConfig.weeklySchedule = weeklySchedule;
-            configService->commit();
+            configService->setWeeklySchedule(weeklySchedule);
+            generation = configService->commit();
         }
 
         Device::get().getValveService()->update();
 
+        if (!Device::get().waitForConfigCommit(generation, CONFIG_COMMIT_TIMEOUT)) {
+            return respondConfigNotStored(res);
+        }
+
         res.status(HttpStatusCode::NoContent_204);
     });
 
@@ -369,22 +394,27 @@ void Server::addConfigRoutes()
             return respondBadRequest(res);
         }
 
+        std::uint32_t generation = 0;
         {
             auto configService = Device::get().getConfigService();
-            auto& currentConfig = configService->getCurrentConfig();
-            currentConfig.wifiSsid = doc["ssid"].as<const char*>();
-            currentConfig.wifiPassword = doc["passphrase"].as<const char*>();
-            currentConfig.impulsesPerLiter = doc["flow_meter_impulses"].as<std::uint32_t>();
-            currentConfig.timezoneId = doc["timezone_id"].as<std::uint32_t>();
+            configService->setWifiSsid(doc["ssid"].as<const char*>());
+            configService->setWifiPassword(doc["passphrase"].as<const char*>());
+            configService->setImpulsesPerLiter(doc["flow_meter_impulses"].as<std::uint32_t>());
+            configService->setTimezoneId(doc["timezone_id"].as<std::uint32_t>());
             StaticString<2> valveType = doc["valve_type"].as<const char*>();
-            currentConfig.valveTypeNC = valveType == STR("nc");
-            configService->commit();
+            configService->setValveTypeNC(valveType == STR("nc"));
+            generation = configService->commit();
 
-            Device::get().setLocalTimezone(currentConfig.timezoneId);
+            Device::get().setLocalTimezone(configService->getCurrentConfig().timezoneId);
         }
 
         Device::get().getNetworkManager()->reloadCredentialsOneShot();
         Device::get().getValveService()->update();
+
+        if (!Device::get().waitForConfigCommit(generation, CONFIG_COMMIT_TIMEOUT)) {
+            return respondConfigNotStored(res);
+        }
+
         res.status(HttpStatusCode::NoContent_204);
     });
 
@@ -405,11 +435,15 @@ void Server::addConfigRoutes()
             return respondBadRequest(res);
         }
 
+        std::uint32_t generation = 0;
         {
             auto configService = Device::get().getConfigService();
-            auto& currentConfig = configService->getCurrentConfig();
-            currentConfig.adminPassword = doc["password"].as<const char*>();
-            configService->commit();
+            configService->setAdminPassword(doc["password"].as<const char*>());
+            generation = configService->commit();
+        }
+
+        if (!Device::get().waitForConfigCommit(generation, CONFIG_COMMIT_TIMEOUT)) {
+            return respondConfigNotStored(res);
         }
 
         res.status(HttpStatusCode::NoContent_204);
@@ -730,6 +764,113 @@ void Server::addWaterRoutes()
 
         res << "}}";
     });
+
+    m_server.get("/water-totals/:1", [this](Request& req, Response& res) {
+        if (!checkAuthorization(req, res)) {
+            return;
+        }
+
+        // Rollups are kept up to date as days are written, nothing is
+        // summed up here
+        int year = req.params.at(1);
+        std::uint32_t yearMl = 0, yearDays = 0;
+        std::array<std::uint32_t, 12> monthMl {}, monthDays {};
+
+        {
+            auto historyService = Device::get().getHistoryService();
+            if (!historyService->getPeriodTotal(year, 0, yearMl, yearDays)) {
+                return respondBadRequest(res);
+            }
+
+            for (int month = 1; month <= 12; ++month) {
+                historyService->getPeriodTotal(year, month, monthMl.at(month - 1), monthDays.at(month - 1));
+            }
+        }
+
+        addJsonHeader(res);
+        res << R"({"year":)";
+        res << year;
+        res << R"(,"total_volume":)";
+        res << yearMl;
+        res << R"(,"days":)";
+        res << yearDays;
+        res << R"(,"months":[)";
+
+        for (std::size_t i = 0; i < monthMl.size(); ++i) {
+            if (i) {
+                res << ',';
+            }
+
+            res << R"({"total_volume":)";
+            res << monthMl.at(i);
+            res << R"(,"days":)";
+            res << monthDays.at(i);
+            res << '}';
+        }
+
+        res << "]}";
+    });
+
+    m_server.post("/water-usage/ranges", [this](Request& req, Response& res) {
+        if (!checkAuthorization(req, res)) {
+            return;
+        }
+
+        static constexpr auto MAX_RANGES = 32U;
+
+        ArduinoJson::StaticJsonDocument<2048> doc;
+        auto error = ArduinoJson::deserializeJson(
+            doc, req.body.begin(), req.body.GetSize());
+
+        if (error != ArduinoJson::DeserializationError::Ok) {
+            return respondBadRequest(res);
+        }
+
+        if (!doc["ranges"].is<ArduinoJson::JsonArray>()) {
+            return respondBadRequest(res);
+        }
+
+        auto ranges = doc["ranges"].as<ArduinoJson::JsonArray>();
+        if (ranges.size() > MAX_RANGES) {
+            return respondBadRequest(res);
+        }
+
+        for (auto range : ranges) {
+            if (!range.is<ArduinoJson::JsonArray>() || range.size() != 2
+                || !range[0].is<std::uint32_t>() || !range[1].is<std::uint32_t>()) {
+                return respondBadRequest(res);
+            }
+        }
+
+        // Every range costs two index lookups, nothing is summed up here
+        std::array<std::uint32_t, MAX_RANGES> totalsMl {};
+        {
+            auto historyService = Device::get().getHistoryService();
+            for (std::size_t i = 0; i < ranges.size(); ++i) {
+                historyService->getRangeTotal(
+                    ranges[i][0].as<std::uint32_t>(), ranges[i][1].as<std::uint32_t>(), totalsMl.at(i));
+            }
+        }
+
+        addJsonHeader(res);
+        res << R"({"totals":[)";
+
+        for (std::size_t i = 0; i < ranges.size(); ++i) {
+            if (i) {
+                res << ',';
+            }
+
+            res << R"({"from":)";
+            res << ranges[i][0].as<std::uint32_t>();
+            res << R"(,"to":)";
+            res << ranges[i][1].as<std::uint32_t>();
+            res << R"(,"total_volume":)";
+            res << totalsMl.at(i);
+            res << '}';
+        }
+
+        res << "]}";
+    });
 }
 
 bool Server::checkAuthorization(Request& req, Response& res)
@@ -753,7 +894,7 @@ bool Server::checkAuthorization(Request& req, Response& res)
     }
 
     StaticString<64> expectedCredentials = "root:";
-    expectedCredentials += Device::get().getConfigService()->getCurrentConfig().adminPassword;
+    expectedCredentials += Device::get().getConfigSnapshot().adminPassword;
 
     std::array<char, 128> out {};
     base64_encode(reinterpret_cast<const unsigned char*>(expectedCredentials.begin()),
@@ -788,4 +929,12 @@ void Server::respondBadRequest(Response& res)
     res << R"({"status":"bad request"})";
 }
 
+void Server::respondConfigNotStored(Response& res)
+{
+    // The change is in effect, the writer keeps retrying to store it
+    addJsonHeader(res);
+    res.status(HttpStatusCode::InternalServerError_500);
+    res << R"({"status":"config not stored"})";
+}
+
 };
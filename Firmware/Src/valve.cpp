@@ -104,15 +104,12 @@ void ValveService::handleInterval()
 
 auto ValveService::checkIfBlockedBySchedule(const UtcTime& currentTime) -> ScheduleBlockState
 {
-    auto config = Device::get().getConfigService();
-    auto& currentConfig = config->getCurrentConfig();
-
     int weekdayId = static_cast<int>(currentTime.getWeekDay());
     if (weekdayId >= UtcTime::DAY_PER_WEEK) {
         return ScheduleBlockState::DISABLED;
     }
 
-    std::uint32_t configWord = currentConfig.weeklySchedule.at(weekdayId);
+    std::uint32_t configWord = Device::get().getConfigSnapshot().weeklySchedule.at(weekdayId);
 
     if (!(configWord & ConfigService::BLOCKADE_ENABLED_FLAG)) {
         m_scheduleBypass = false;
@@ -134,14 +131,9 @@ auto ValveService::checkIfBlockedBySchedule(const UtcTime& currentTime) -> Sched
 
 void ValveService::updatePinState()
 {
-    bool isNc = false;
+    bool isNc = Device::get().getConfigSnapshot().valveTypeNC;
     GPIO_PinState targetState = GPIO_PIN_RESET;
 
-    {
-        auto config = Device::get().getConfigService();
-        isNc = config->getCurrentConfig().valveTypeNC;
-    }
-
     if (isValveBlocked()) {
         targetState = isNc ? GPIO_PIN_RESET : GPIO_PIN_SET;
     } else {
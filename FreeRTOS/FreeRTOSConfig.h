@@ -15,7 +15,7 @@ your application. */
 #define configTICK_TYPE_WIDTH_IN_BITS           TICK_TYPE_WIDTH_32_BITS
 #define configIDLE_SHOULD_YIELD                 1
 #define configUSE_TASK_NOTIFICATIONS            1
-#define configTASK_NOTIFICATION_ARRAY_ENTRIES   3
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES   6 /* See the *_NOTIFY_INDEX constants */
 #define configUSE_MUTEXES                       1
 #define configUSE_RECURSIVE_MUTEXES             0
 #define configUSE_COUNTING_SEMAPHORES           0
@@ -127,6 +127,22 @@ your application. */
 #define xPortPendSVHandler PendSV_Handler
 #define xPortSysTickHandler SysTick_Handler
 
+/* Host build (FreeRTOS POSIX port) overrides. */
+#ifdef LG_HOST_BUILD
+/* Task stacks are declared with configSTACK_DEPTH_TYPE elements and have to
+match StackType_t, which is 64-bit wide on the POSIX port. */
+#undef configSTACK_DEPTH_TYPE
+#define configSTACK_DEPTH_TYPE                  StackType_t
+
+#undef configUSE_PORT_OPTIMISED_TASK_SELECTION
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION 0
+
+#ifdef __cplusplus
+extern "C"
+#endif
+void vAssertCalled( const char * pcFile, int ulLine );
+#endif
+
 /* A header file that defines trace macro can be included here. */
 
 #endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,152 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <stm32f7xx_hal.h>
+
+namespace lg::host {
+
+// Peripheral emulation used by the host build. Everything in here that
+// touches FreeRTOS objects must be called from a FreeRTOS task, the POSIX
+// port does not allow kernel calls from foreign threads.
+
+void initializePeripherals();
+
+// Interrupts
+
+void runAsIrq(const std::function<void()>& handler);
+void startIrqTask();
+
+// GPIO
+
+void setInputPin(GPIO_TypeDef* port, std::uint16_t pin, GPIO_PinState state);
+[[nodiscard]] GPIO_PinState getOutputPin(GPIO_TypeDef* port, std::uint16_t pin);
+void triggerExti(std::uint16_t pin);
+
+// RTC
+
+void setRtcTimestamp(std::uint32_t timestamp);
+[[nodiscard]] std::uint32_t getRtcTimestamp();
+void pollRtcAlarm();
+
+// EEPROM (24LC512 on I2C2)
+
+struct EepromStats {
+    std::uint32_t readTransactions;
+    std::uint32_t writeTransactions;
+    std::uint32_t bytesRead;
+    std::uint32_t bytesWritten;
+    std::uint32_t busyNacks;
+    std::uint32_t busTimeUs; // Modelled time on the 400 kHz bus
+};
+
+// Loads a 64 KB image file as the EEPROM contents, writes go straight to
+// the file. A missing or short file is padded with erased bytes.
+bool openEepromImage(const char* path);
+
+[[nodiscard]] EepromStats getEepromStats();
+void resetEepromStats();
+// Prints the queueing delay and throughput of the firmware EEPROM queue
+// to stderr every period
+void startEepromReport(std::uint32_t periodMs);
+
+// QSPI flash (W25Q64)
+
+struct FlashStats {
+    std::uint32_t pagePrograms;
+    std::uint32_t sectorErases;
+    std::uint32_t blockErases;
+    std::uint32_t bytesProgrammed;
+    std::uint32_t statusPolls;
+    std::uint32_t overwriteAttempts; // Programs that tried to set a cleared bit
+};
+
+struct FlashTimings {
+    std::chrono::microseconds pageProgram;
+    std::chrono::microseconds sectorErase;
+    std::chrono::microseconds blockErase;
+    std::chrono::microseconds chipErase;
+};
+
+void initializeQspiFlash();
+// Maps a 4 MB image file as the flash contents, programs and erases go
+// straight to the file. A missing or short file is padded with erased bytes.
+bool openFlashImage(const char* path);
+
+[[nodiscard]] FlashStats getFlashStats();
+void resetFlashStats();
+// Defaults to the typical datasheet timings
+void setFlashTimings(const FlashTimings& timings);
+void pollQspi();
+
+// UART (ESP-AT module on USART1)
+
+using UartTxHandler = std::function<void(const std::uint8_t* data, std::size_t size)>;
+
+struct UartStats {
+    std::uint32_t bytesReceived;
+    std::uint32_t bytesSent;
+    std::uint32_t rxEvents; // IDLE line, half and full transfer interrupts
+    // From the last received byte to the next transmission of the firmware
+    std::uint32_t turnarounds;
+    std::uint64_t turnaroundTimeUs;
+    std::uint32_t maxTurnaroundUs;
+};
+
+void setUartTxHandler(UartTxHandler handler);
+// Received as one burst, the line goes idle after the last byte
+void uartReceive(const std::uint8_t* data, std::size_t size);
+
+[[nodiscard]] UartStats getUartStats();
+void resetUartStats();
+// Prints the UART turnaround and how long each class of AT commands
+// waited for the module to stderr every period
+void startEspReport(std::uint32_t periodMs);
+
+// Runs the ESP-AT receive tokenizer over a file of bytes recorded from the
+// module and prints the parsing throughput. Does not need the scheduler.
+bool runEspAtBenchmark(const char* tracePath);
+
+// Fake ESP-AT module on the other end of the UART
+
+struct FakeModemStats {
+    std::uint32_t commands;
+    std::uint32_t sends; // Completed CIPSEND transfers
+    std::uint32_t sendBytes;
+    std::uint32_t injectedErrors;
+    std::uint32_t droppedCommands;
+    std::uint32_t connections;
+    std::uint32_t refusedConnections; // No free link for a scripted request
+};
+
+// Answers the AT commands of the firmware at the pace of the UART. The
+// optional script adds replies, error injection, unsolicited output,
+// recorded traces and incoming HTTP requests, see README.md.
+bool startFakeModem(const char* scriptPath);
+[[nodiscard]] bool isFakeModemStarted();
+[[nodiscard]] FakeModemStats getFakeModemStats();
+
+// History
+
+// Appends the given number of days to the flash history of a blank chip
+// and prints the time of one week queries and range totals next to a scan
+// of every record. Does not need the scheduler.
+bool runFlashHistoryBenchmark(std::uint32_t days);
+// Packs a file of recorded minute data points into minute blocks, prints
+// the encode and decode throughput and the space saved. Does not need the
+// scheduler.
+bool runMinuteBlockBenchmark(const char* tracePath);
+// Fills the EEPROM ring with the newest blocks of a minute trace, boots
+// the history service on it and prints its RAM use, the latency of the
+// query of today and the cost of clearing the ring. Does not need the
+// scheduler.
+bool runMinuteRingBenchmark(const char* tracePath);
+
+// Timers
+
+void addFlowImpulses(std::uint16_t count);
+void pollTimers();
+
+};
@@ -0,0 +1,563 @@
+/**
+ * Host replacement for the STM32F7 HAL.
+ *
+ * Only the subset of the HAL used by Firmware/ is declared here. Types keep
+ * the field names of the real HAL so that the firmware sources compile
+ * unchanged, the peripherals themselves are emulated in Host/Src.
+ */
+#ifndef __STM32F7xx_HAL_H
+#define __STM32F7xx_HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Common --------------------------------------------------------------------*/
+
+typedef enum {
+    HAL_OK = 0x00U,
+    HAL_ERROR = 0x01U,
+    HAL_BUSY = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+#define __NOP() \
+    do {        \
+    } while (0)
+
+typedef enum {
+    EXTI0_IRQn = 6,
+    EXTI9_5_IRQn = 23,
+    I2C1_EV_IRQn = 31,
+    I2C2_EV_IRQn = 33,
+    USART1_IRQn = 37,
+    EXTI15_10_IRQn = 40,
+    RTC_Alarm_IRQn = 41,
+    QUADSPI_IRQn = 92,
+    TIM7_IRQn = 55,
+} IRQn_Type;
+
+void HAL_Delay(uint32_t Delay);
+uint32_t HAL_GetTick(void);
+uint32_t HAL_GetUIDw0(void);
+uint32_t HAL_GetUIDw1(void);
+uint32_t HAL_GetUIDw2(void);
+uint32_t HAL_RCC_GetSysClockFreq(void);
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn);
+
+/* The FreeRTOS POSIX port has no notion of an interrupt context, the host
+ * IRQ emulation provides it instead (see Host/Src/irq.cpp). */
+long xPortIsInsideInterrupt(void);
+
+typedef struct {
+    volatile uint32_t IDCODE;
+    volatile uint32_t CR;
+    volatile uint32_t APB1FZ;
+    volatile uint32_t APB2FZ;
+} DBGMCU_TypeDef;
+
+extern DBGMCU_TypeDef hostDbgmcu;
+#define DBGMCU (&hostDbgmcu)
+
+/* GPIO ----------------------------------------------------------------------*/
+
+typedef struct {
+    volatile uint32_t IDR;
+    volatile uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+#define GPIO_PIN_All ((uint16_t)0xFFFF)
+
+#define HOST_GPIO_PORT_COUNT 11
+
+extern GPIO_TypeDef hostGpio[HOST_GPIO_PORT_COUNT];
+
+#define GPIOA (&hostGpio[0])
+#define GPIOB (&hostGpio[1])
+#define GPIOC (&hostGpio[2])
+#define GPIOD (&hostGpio[3])
+#define GPIOE (&hostGpio[4])
+#define GPIOF (&hostGpio[5])
+#define GPIOG (&hostGpio[6])
+#define GPIOH (&hostGpio[7])
+#define GPIOI (&hostGpio[8])
+#define GPIOJ (&hostGpio[9])
+#define GPIOK (&hostGpio[10])
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_TogglePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin);
+
+/* CRC -----------------------------------------------------------------------*/
+
+typedef struct {
+    volatile uint32_t DR;
+} CRC_TypeDef;
+
+typedef struct {
+    CRC_TypeDef* Instance;
+} CRC_HandleTypeDef;
+
+uint32_t HAL_CRC_Calculate(CRC_HandleTypeDef* hcrc, uint32_t pBuffer[], uint32_t BufferLength);
+
+/* DMA -----------------------------------------------------------------------*/
+
+typedef struct {
+    volatile uint32_t CR;
+    volatile uint32_t NDTR;
+    volatile uint32_t PAR;
+    volatile uint32_t M0AR;
+} DMA_Stream_TypeDef;
+
+typedef enum {
+    HAL_DMA_STATE_RESET = 0x00U,
+    HAL_DMA_STATE_READY = 0x01U,
+    HAL_DMA_STATE_BUSY = 0x02U,
+    HAL_DMA_STATE_TIMEOUT = 0x03U,
+    HAL_DMA_STATE_ERROR = 0x04U,
+    HAL_DMA_STATE_ABORT = 0x05U
+} HAL_DMA_StateTypeDef;
+
+typedef struct __DMA_HandleTypeDef {
+    DMA_Stream_TypeDef* Instance;
+    volatile HAL_DMA_StateTypeDef State;
+    void* Parent;
+} DMA_HandleTypeDef;
+
+#define __HAL_DMA_GET_COUNTER(__HANDLE__) ((__HANDLE__)->Instance->NDTR)
+
+HAL_DMA_StateTypeDef HAL_DMA_GetState(DMA_HandleTypeDef* hdma);
+
+/* RTC -----------------------------------------------------------------------*/
+
+typedef struct {
+    uint8_t Hours;
+    uint8_t Minutes;
+    uint8_t Seconds;
+    uint8_t TimeFormat;
+    uint32_t SubSeconds;
+    uint32_t SecondFraction;
+    uint32_t DayLightSaving;
+    uint32_t StoreOperation;
+} RTC_TimeTypeDef;
+
+typedef struct {
+    uint8_t WeekDay;
+    uint8_t Month;
+    uint8_t Date;
+    uint8_t Year;
+} RTC_DateTypeDef;
+
+typedef struct {
+    RTC_TimeTypeDef AlarmTime;
+    uint32_t AlarmMask;
+    uint32_t AlarmSubSecondMask;
+    uint32_t AlarmDateWeekDaySel;
+    uint8_t AlarmDateWeekDay;
+    uint32_t Alarm;
+} RTC_AlarmTypeDef;
+
+typedef struct {
+    void* Instance;
+} RTC_HandleTypeDef;
+
+#define RTC_FORMAT_BIN 0x00000000U
+#define RTC_FORMAT_BCD 0x00000001U
+#define FORMAT_BIN RTC_FORMAT_BIN
+#define FORMAT_BCD RTC_FORMAT_BCD
+
+#define RTC_WEEKDAY_MONDAY ((uint8_t)0x01)
+#define RTC_WEEKDAY_TUESDAY ((uint8_t)0x02)
+#define RTC_WEEKDAY_WEDNESDAY ((uint8_t)0x03)
+#define RTC_WEEKDAY_THURSDAY ((uint8_t)0x04)
+#define RTC_WEEKDAY_FRIDAY ((uint8_t)0x05)
+#define RTC_WEEKDAY_SATURDAY ((uint8_t)0x06)
+#define RTC_WEEKDAY_SUNDAY ((uint8_t)0x07)
+
+#define RTC_ALARM_A 0x00000100U
+#define RTC_ALARM_B 0x00000200U
+
+#define RTC_ALARMMASK_NONE 0x00000000U
+#define RTC_ALARMMASK_DATEWEEKDAY 0x80000000U
+#define RTC_ALARMMASK_HOURS 0x00800000U
+#define RTC_ALARMMASK_MINUTES 0x00008000U
+#define RTC_ALARMMASK_SECONDS 0x00000080U
+#define RTC_ALARMMASK_ALL 0x80808080U
+
+#define RTC_ALARMSUBSECONDMASK_ALL 0x00000000U
+
+#define RTC_SMOOTHCALIB_PERIOD_32SEC 0x00000000U
+#define RTC_SMOOTHCALIB_PLUSPULSES_SET 0x00008000U
+#define RTC_SMOOTHCALIB_PLUSPULSES_RESET 0x00000000U
+
+HAL_StatusTypeDef HAL_RTC_SetTime(RTC_HandleTypeDef* hrtc, RTC_TimeTypeDef* sTime, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_GetTime(RTC_HandleTypeDef* hrtc, RTC_TimeTypeDef* sTime, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_SetDate(RTC_HandleTypeDef* hrtc, RTC_DateTypeDef* sDate, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_GetDate(RTC_HandleTypeDef* hrtc, RTC_DateTypeDef* sDate, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_SetAlarm_IT(RTC_HandleTypeDef* hrtc, RTC_AlarmTypeDef* sAlarm, uint32_t Format);
+HAL_StatusTypeDef HAL_RTCEx_SetSmoothCalib(RTC_HandleTypeDef* hrtc,
+    uint32_t SmoothCalibPeriod, uint32_t SmoothCalibPlusPulses, uint32_t SmoothCalibMinusPulsesValue);
+void HAL_RTC_AlarmIRQHandler(RTC_HandleTypeDef* hrtc);
+
+/* Backup registers, retained across resets like the VBAT domain */
+#define RTC_BKP_DR0 0x00U
+#define RTC_BKP_DR1 0x01U
+#define RTC_BKP_DR2 0x02U
+#define RTC_BKP_DR3 0x03U
+#define RTC_BKP_DR4 0x04U
+#define RTC_BKP_DR5 0x05U
+#define RTC_BKP_DR6 0x06U
+#define RTC_BKP_DR7 0x07U
+#define RTC_BKP_DR8 0x08U
+#define RTC_BKP_DR9 0x09U
+#define RTC_BKP_DR10 0x0AU
+#define RTC_BKP_DR11 0x0BU
+#define RTC_BKP_DR12 0x0CU
+#define RTC_BKP_DR13 0x0DU
+#define RTC_BKP_DR14 0x0EU
+#define RTC_BKP_DR15 0x0FU
+#define RTC_BKP_DR16 0x10U
+#define RTC_BKP_DR17 0x11U
+#define RTC_BKP_DR18 0x12U
+#define RTC_BKP_DR19 0x13U
+#define RTC_BKP_DR20 0x14U
+#define RTC_BKP_DR21 0x15U
+#define RTC_BKP_DR22 0x16U
+#define RTC_BKP_DR23 0x17U
+#define RTC_BKP_DR24 0x18U
+#define RTC_BKP_DR25 0x19U
+#define RTC_BKP_DR26 0x1AU
+#define RTC_BKP_DR27 0x1BU
+#define RTC_BKP_DR28 0x1CU
+#define RTC_BKP_DR29 0x1DU
+#define RTC_BKP_DR30 0x1EU
+#define RTC_BKP_DR31 0x1FU
+
+void HAL_RTCEx_BKUPWrite(RTC_HandleTypeDef* hrtc, uint32_t BackupRegister, uint32_t Data);
+uint32_t HAL_RTCEx_BKUPRead(RTC_HandleTypeDef* hrtc, uint32_t BackupRegister);
+
+/* I2C -----------------------------------------------------------------------*/
+
+typedef struct {
+    volatile uint32_t CR1;
+    volatile uint32_t CR2;
+    volatile uint32_t ISR;
+    volatile uint32_t ICR;
+} I2C_TypeDef;
+
+typedef enum {
+    HAL_I2C_STATE_RESET = 0x00U,
+    HAL_I2C_STATE_READY = 0x20U,
+    HAL_I2C_STATE_BUSY = 0x24U,
+    HAL_I2C_STATE_BUSY_TX = 0x21U,
+    HAL_I2C_STATE_BUSY_RX = 0x22U,
+    HAL_I2C_STATE_LISTEN = 0x28U,
+    HAL_I2C_STATE_ABORT = 0x60U,
+    HAL_I2C_STATE_TIMEOUT = 0xA0U,
+    HAL_I2C_STATE_ERROR = 0xE0U
+} HAL_I2C_StateTypeDef;
+
+typedef struct __I2C_HandleTypeDef {
+    I2C_TypeDef* Instance;
+    volatile HAL_I2C_StateTypeDef State;
+    volatile uint32_t ErrorCode;
+    DMA_HandleTypeDef* hdmatx;
+    DMA_HandleTypeDef* hdmarx;
+} I2C_HandleTypeDef;
+
+#define I2C_MEMADD_SIZE_8BIT 0x00000001U
+#define I2C_MEMADD_SIZE_16BIT 0x00000002U
+
+#define HAL_I2C_ERROR_NONE 0x00000000U
+#define HAL_I2C_ERROR_AF 0x00000004U
+
+HAL_StatusTypeDef HAL_I2C_Master_Transmit(I2C_HandleTypeDef* hi2c, uint16_t DevAddress,
+    uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Master_Transmit_IT(I2C_HandleTypeDef* hi2c, uint16_t DevAddress,
+    uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_IsDeviceReady(I2C_HandleTypeDef* hi2c, uint16_t DevAddress,
+    uint32_t Trials, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef* hi2c, uint16_t DevAddress, uint16_t MemAddress,
+    uint16_t MemAddSize, uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef* hi2c, uint16_t DevAddress, uint16_t MemAddress,
+    uint16_t MemAddSize, uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef* hi2c, uint16_t DevAddress, uint16_t MemAddress,
+    uint16_t MemAddSize, uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef* hi2c, uint16_t DevAddress, uint16_t MemAddress,
+    uint16_t MemAddSize, uint8_t* pData, uint16_t Size);
+HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef* hi2c);
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef* hi2c);
+void HAL_I2C_EV_IRQHandler(I2C_HandleTypeDef* hi2c);
+
+/* QUADSPI -------------------------------------------------------------------*/
+
+typedef struct {
+    volatile uint32_t CR;
+    volatile uint32_t SR;
+} QUADSPI_TypeDef;
+
+typedef enum {
+    HAL_QSPI_STATE_RESET = 0x00U,
+    HAL_QSPI_STATE_READY = 0x01U,
+    HAL_QSPI_STATE_BUSY = 0x02U,
+    HAL_QSPI_STATE_BUSY_INDIRECT_TX = 0x12U,
+    HAL_QSPI_STATE_BUSY_INDIRECT_RX = 0x22U,
+    HAL_QSPI_STATE_BUSY_AUTO_POLLING = 0x42U,
+    HAL_QSPI_STATE_BUSY_MEM_MAPPED = 0x82U,
+    HAL_QSPI_STATE_ABORT = 0x08U,
+    HAL_QSPI_STATE_ERROR = 0x04U
+} HAL_QSPI_StateTypeDef;
+
+typedef struct {
+    QUADSPI_TypeDef* Instance;
+    volatile HAL_QSPI_StateTypeDef State;
+    volatile uint32_t ErrorCode;
+} QSPI_HandleTypeDef;
+
+typedef struct {
+    uint32_t Instruction;
+    uint32_t Address;
+    uint32_t AlternateBytes;
+    uint32_t AddressSize;
+    uint32_t AlternateBytesSize;
+    uint32_t DummyCycles;
+    uint32_t InstructionMode;
+    uint32_t AddressMode;
+    uint32_t AlternateByteMode;
+    uint32_t DataMode;
+    uint32_t NbData;
+    uint32_t DdrMode;
+    uint32_t DdrHoldHalfCycle;
+    uint32_t SIOOMode;
+} QSPI_CommandTypeDef;
+
+typedef struct {
+    uint32_t Match;
+    uint32_t Mask;
+    uint32_t Interval;
+    uint32_t StatusBytesSize;
+    uint32_t MatchMode;
+    uint32_t AutomaticStop;
+} QSPI_AutoPollingTypeDef;
+
+typedef struct {
+    uint32_t TimeOutPeriod;
+    uint32_t TimeOutActivation;
+} QSPI_MemoryMappedTypeDef;
+
+#define HAL_QPSI_TIMEOUT_DEFAULT_VALUE 5000U
+
+#define QSPI_INSTRUCTION_NONE 0x00000000U
+#define QSPI_INSTRUCTION_1_LINE 0x00000100U
+#define QSPI_INSTRUCTION_2_LINES 0x00000200U
+#define QSPI_INSTRUCTION_4_LINES 0x00000300U
+
+#define QSPI_ADDRESS_NONE 0x00000000U
+#define QSPI_ADDRESS_1_LINE 0x00000400U
+#define QSPI_ADDRESS_2_LINES 0x00000800U
+#define QSPI_ADDRESS_4_LINES 0x00000C00U
+
+#define QSPI_ADDRESS_8_BITS 0x00000000U
+#define QSPI_ADDRESS_16_BITS 0x00001000U
+#define QSPI_ADDRESS_24_BITS 0x00002000U
+#define QSPI_ADDRESS_32_BITS 0x00003000U
+
+#define QSPI_ALTERNATE_BYTES_NONE 0x00000000U
+#define QSPI_ALTERNATE_BYTES_1_LINE 0x00004000U
+#define QSPI_ALTERNATE_BYTES_2_LINES 0x00008000U
+#define QSPI_ALTERNATE_BYTES_4_LINES 0x0000C000U
+
+#define QSPI_DATA_NONE 0x00000000U
+#define QSPI_DATA_1_LINE 0x01000000U
+#define QSPI_DATA_2_LINES 0x02000000U
+#define QSPI_DATA_4_LINES 0x03000000U
+
+#define QSPI_DDR_MODE_DISABLE 0x00000000U
+#define QSPI_DDR_HHC_ANALOG_DELAY 0x00000000U
+#define QSPI_SIOO_INST_EVERY_CMD 0x00000000U
+
+#define QSPI_MATCH_MODE_AND 0x00000000U
+#define QSPI_MATCH_MODE_OR 0x00800000U
+#define QSPI_AUTOMATIC_STOP_DISABLE 0x00000000U
+#define QSPI_AUTOMATIC_STOP_ENABLE 0x00400000U
+#define QSPI_TIMEOUT_COUNTER_DISABLE 0x00000000U
+#define QSPI_TIMEOUT_COUNTER_ENABLE 0x00000008U
+
+/* Base address of the memory-mapped QSPI window, backed by the flash emulator */
+extern uint8_t* hostQspiMemory;
+#define QSPI_BASE ((uintptr_t)hostQspiMemory)
+
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef* hqspi, QSPI_CommandTypeDef* cmd, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef* hqspi, uint8_t* pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef* hqspi, uint8_t* pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_AutoPolling(QSPI_HandleTypeDef* hqspi, QSPI_CommandTypeDef* cmd,
+    QSPI_AutoPollingTypeDef* cfg, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef* hqspi, QSPI_CommandTypeDef* cmd,
+    QSPI_MemoryMappedTypeDef* cfg);
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef* hqspi);
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef* hqspi, QSPI_CommandTypeDef* cmd,
+    QSPI_AutoPollingTypeDef* cfg);
+void HAL_QSPI_IRQHandler(QSPI_HandleTypeDef* hqspi);
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef* hqspi);
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef* hqspi);
+
+/* SPI -----------------------------------------------------------------------*/
+
+typedef struct {
+    volatile uint32_t CR1;
+    volatile uint32_t SR;
+    volatile uint32_t DR;
+} SPI_TypeDef;
+
+typedef enum {
+    HAL_SPI_STATE_RESET = 0x00U,
+    HAL_SPI_STATE_READY = 0x01U,
+    HAL_SPI_STATE_BUSY = 0x02U,
+    HAL_SPI_STATE_BUSY_TX = 0x03U,
+    HAL_SPI_STATE_BUSY_RX = 0x04U,
+    HAL_SPI_STATE_BUSY_TX_RX = 0x05U,
+    HAL_SPI_STATE_ERROR = 0x06U,
+    HAL_SPI_STATE_ABORT = 0x07U
+} HAL_SPI_StateTypeDef;
+
+typedef struct __SPI_HandleTypeDef {
+    SPI_TypeDef* Instance;
+    volatile HAL_SPI_StateTypeDef State;
+} SPI_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef* hspi, uint8_t* pTxData, uint8_t* pRxData,
+    uint16_t Size, uint32_t Timeout);
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef* hspi);
+
+/* TIM -----------------------------------------------------------------------*/
+
+typedef struct {
+    volatile uint32_t CR1;
+    volatile uint32_t DIER;
+    volatile uint32_t SR;
+    volatile uint32_t CNT;
+    volatile uint32_t PSC;
+    volatile uint32_t ARR;
+    volatile uint32_t CCR1;
+    volatile uint32_t CCR2;
+    volatile uint32_t CCR3;
+    volatile uint32_t CCR4;
+} TIM_TypeDef;
+
+typedef struct {
+    uint32_t Prescaler;
+    uint32_t CounterMode;
+    uint32_t Period;
+    uint32_t ClockDivision;
+    uint32_t RepetitionCounter;
+    uint32_t AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+
+typedef struct __TIM_HandleTypeDef {
+    TIM_TypeDef* Instance;
+    TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+#define TIM_CHANNEL_1 0x00000000U
+#define TIM_CHANNEL_2 0x00000004U
+#define TIM_CHANNEL_3 0x00000008U
+#define TIM_CHANNEL_4 0x0000000CU
+
+#define TIM_CR1_CEN 0x00000001U
+#define TIM_DIER_UIE 0x00000001U
+#define TIM_FLAG_UPDATE 0x00000001U
+
+#define __HAL_TIM_SET_PRESCALER(__HANDLE__, __PRESC__) ((__HANDLE__)->Instance->PSC = (__PRESC__))
+#define __HAL_TIM_SET_COUNTER(__HANDLE__, __COUNTER__) ((__HANDLE__)->Instance->CNT = (__COUNTER__))
+#define __HAL_TIM_GET_COUNTER(__HANDLE__) ((__HANDLE__)->Instance->CNT)
+#define __HAL_TIM_SET_AUTORELOAD(__HANDLE__, __AUTORELOAD__) \
+    do {                                                     \
+        (__HANDLE__)->Instance->ARR = (__AUTORELOAD__);      \
+        (__HANDLE__)->Init.Period = (__AUTORELOAD__);        \
+    } while (0)
+#define __HAL_TIM_GET_AUTORELOAD(__HANDLE__) ((__HANDLE__)->Instance->ARR)
+#define __HAL_TIM_SetAutoreload __HAL_TIM_SET_AUTORELOAD
+#define __HAL_TIM_GetAutoreload __HAL_TIM_GET_AUTORELOAD
+#define __HAL_TIM_CLEAR_FLAG(__HANDLE__, __FLAG__) ((__HANDLE__)->Instance->SR = ~(__FLAG__))
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef* htim, uint32_t Channel);
+void HAL_TIM_IRQHandler(TIM_HandleTypeDef* htim);
+
+/* UART ----------------------------------------------------------------------*/
+
+typedef struct {
+    volatile uint32_t CR1;
+    volatile uint32_t CR3;
+    volatile uint32_t ISR;
+    volatile uint32_t ICR;
+} USART_TypeDef;
+
+typedef enum {
+    HAL_UART_STATE_RESET = 0x00U,
+    HAL_UART_STATE_READY = 0x20U,
+    HAL_UART_STATE_BUSY = 0x24U,
+    HAL_UART_STATE_BUSY_TX = 0x21U,
+    HAL_UART_STATE_BUSY_RX = 0x22U,
+    HAL_UART_STATE_BUSY_TX_RX = 0x23U,
+    HAL_UART_STATE_TIMEOUT = 0xA0U,
+    HAL_UART_STATE_ERROR = 0xE0U
+} HAL_UART_StateTypeDef;
+
+typedef struct __UART_HandleTypeDef {
+    USART_TypeDef* Instance;
+    const uint8_t* pTxBuffPtr;
+    uint16_t TxXferSize;
+    uint8_t* pRxBuffPtr;
+    uint16_t RxXferSize;
+    DMA_HandleTypeDef* hdmatx;
+    DMA_HandleTypeDef* hdmarx;
+    volatile HAL_UART_StateTypeDef gState;
+    volatile HAL_UART_StateTypeDef RxState;
+} UART_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart, const uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef* huart, uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef* huart, uint8_t* pData, uint16_t Size);
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef* huart, uint16_t Size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32F7xx_HAL_H */
@@ -0,0 +1,46 @@
+/**
+ * Host replacement for the STM32F7 I2C low-layer driver.
+ */
+#ifndef __STM32F7xx_LL_I2C_H
+#define __STM32F7xx_LL_I2C_H
+
+#include "stm32f7xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define I2C_ISR_BUSY 0x00008000U
+#define I2C_ISR_STOPF 0x00000020U
+#define I2C_ISR_NACKF 0x00000010U
+
+static inline uint32_t LL_I2C_IsActiveFlag_BUSY(I2C_TypeDef* I2Cx)
+{
+    return (I2Cx->ISR & I2C_ISR_BUSY) == I2C_ISR_BUSY;
+}
+
+static inline uint32_t LL_I2C_IsActiveFlag_STOP(I2C_TypeDef* I2Cx)
+{
+    return (I2Cx->ISR & I2C_ISR_STOPF) == I2C_ISR_STOPF;
+}
+
+static inline uint32_t LL_I2C_IsActiveFlag_NACK(I2C_TypeDef* I2Cx)
+{
+    return (I2Cx->ISR & I2C_ISR_NACKF) == I2C_ISR_NACKF;
+}
+
+static inline void LL_I2C_ClearFlag_STOP(I2C_TypeDef* I2Cx)
+{
+    I2Cx->ISR = I2Cx->ISR & ~I2C_ISR_STOPF;
+}
+
+static inline void LL_I2C_ClearFlag_NACK(I2C_TypeDef* I2Cx)
+{
+    I2Cx->ISR = I2Cx->ISR & ~I2C_ISR_NACKF;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32F7xx_LL_I2C_H */
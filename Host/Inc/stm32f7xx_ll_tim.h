@@ -0,0 +1,32 @@
+/**
+ * Host replacement for the STM32F7 TIM low-layer driver.
+ */
+#ifndef __STM32F7xx_LL_TIM_H
+#define __STM32F7xx_LL_TIM_H
+
+#include "stm32f7xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline uint32_t LL_TIM_GetCounter(TIM_TypeDef* TIMx)
+{
+    return TIMx->CNT;
+}
+
+static inline void LL_TIM_SetCounter(TIM_TypeDef* TIMx, uint32_t Counter)
+{
+    TIMx->CNT = Counter;
+}
+
+static inline uint32_t LL_TIM_IsActiveFlag_UPDATE(TIM_TypeDef* TIMx)
+{
+    return (TIMx->SR & TIM_FLAG_UPDATE) == TIM_FLAG_UPDATE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32F7xx_LL_TIM_H */
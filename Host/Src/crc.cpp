@@ -0,0 +1,23 @@
+#include <host.hpp>
+
+// The CRC unit runs with the reset configuration: CRC-32 polynomial
+// 0x04C11DB7, initial value 0xFFFFFFFF, no reflection, words fed MSB first.
+
+static constexpr std::uint32_t CRC_POLYNOMIAL = 0x04C11DB7;
+static constexpr std::uint32_t CRC_INITIAL_VALUE = 0xFFFFFFFF;
+
+extern "C" uint32_t HAL_CRC_Calculate(CRC_HandleTypeDef* hcrc, uint32_t pBuffer[], uint32_t BufferLength)
+{
+    std::uint32_t crc = CRC_INITIAL_VALUE;
+
+    for (std::uint32_t i = 0; i < BufferLength; ++i) {
+        crc ^= pBuffer[i];
+
+        for (int bit = 0; bit < 32; ++bit) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ CRC_POLYNOMIAL : (crc << 1);
+        }
+    }
+
+    hcrc->Instance->DR = crc;
+    return crc;
+}
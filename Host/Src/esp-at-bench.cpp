@@ -0,0 +1,98 @@
+#include <host.hpp>
+
+#include <drivers/esp-at-tokenizer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace lg::host {
+
+using Clock = std::chrono::steady_clock;
+
+// Same as the receive buffer of the driver
+static constexpr auto RX_BUFFER_SIZE = 16384U;
+// Bytes the emulated DMA writes between two runs of the tokenizer
+static constexpr auto DMA_BURST_SIZE = 256U;
+static constexpr auto BENCHMARK_DURATION = std::chrono::seconds(1);
+
+// Accepts everything, like a driver with a request waiting for a prompt
+class CountingHandler : public EspAtTokenizer::Handler {
+public:
+    std::uint64_t lines {};
+    std::uint64_t notifications {};
+    std::uint64_t prompts {};
+    std::uint64_t dataBytes {};
+
+    void gotLine(std::string_view) override { ++lines; }
+    bool gotNotification(std::string_view header) override
+    {
+        ++notifications;
+        return header == "+MQTTSUB:";
+    }
+    bool gotInputHeader(int, std::size_t) override { return true; }
+    void gotData(int, const char*, std::size_t size) override { dataBytes += size; }
+    bool gotPrompt() override
+    {
+        ++prompts;
+        return true;
+    }
+};
+
+bool runEspAtBenchmark(const char* tracePath)
+{
+    std::ifstream file(tracePath, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::vector<char> trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (trace.empty()) {
+        return false;
+    }
+
+    static std::array<char, RX_BUFFER_SIZE> rxBuffer {};
+    CountingHandler handler;
+    EspAtTokenizer tokenizer(rxBuffer.data(), rxBuffer.size(), handler);
+
+    std::size_t writeIndex = 0;
+    std::uint64_t bytes = 0;
+    std::uint32_t passes = 0;
+    Clock::duration parseTime {};
+
+    while (parseTime < BENCHMARK_DURATION) {
+        for (std::size_t offset = 0; offset < trace.size();) {
+            // A burst ends at the end of the trace or the end of the buffer
+            auto size = std::min({ std::size_t(DMA_BURST_SIZE), trace.size() - offset, rxBuffer.size() - writeIndex });
+            std::copy_n(trace.begin() + offset, size, rxBuffer.begin() + writeIndex);
+
+            offset += size;
+            writeIndex = (writeIndex + size) % rxBuffer.size();
+
+            auto start = Clock::now();
+            tokenizer.process(writeIndex);
+            parseTime += Clock::now() - start;
+        }
+
+        bytes += trace.size();
+        ++passes;
+    }
+
+    auto parseTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(parseTime).count();
+
+    std::printf("%s: %zu bytes x %u passes, %.1f MB/s parsed\n",
+        tracePath, trace.size(), passes, static_cast<double>(bytes) / parseTimeUs);
+    std::printf("  per pass: %llu lines, %llu notifications, %llu prompts, %llu data bytes\n",
+        static_cast<unsigned long long>(handler.lines / passes),
+        static_cast<unsigned long long>(handler.notifications / passes),
+        static_cast<unsigned long long>(handler.prompts / passes),
+        static_cast<unsigned long long>(handler.dataBytes / passes));
+
+    return true;
+}
+
+};
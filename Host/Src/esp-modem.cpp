@@ -0,0 +1,537 @@
+#include <host.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <FreeRTOS.h>
+#include <stream_buffer.h>
+#include <task.h>
+
+namespace lg::host {
+
+// Behaves like an ESP32 running ESP-AT with CIPMUX=1: answers the commands
+// the driver uses, accepts data after a CIPSEND prompt and opens client
+// connections on its own when a script asks for it.
+
+static constexpr auto MODEM_LINK_COUNT = 5;
+static constexpr auto MODEM_CLOSE_ALL_LINKS = 5;
+// Start bit, eight data bits and a stop bit
+static constexpr auto MODEM_BITS_PER_BYTE = 10U;
+static constexpr auto MODEM_MAX_LINE_SIZE = 2048U;
+static constexpr auto MODEM_TIME_UPDATE_DELAY_MS = 1000U;
+
+struct ModemRule {
+    enum class Kind {
+        REPLY,
+        FAIL,
+        DROP
+    };
+
+    Kind kind;
+    std::string prefix;
+    std::uint32_t value; // Delay of a reply, percentage otherwise
+    std::string text;
+};
+
+struct ModemEvent {
+    enum class Kind {
+        OUTPUT,
+        REQUEST
+    };
+
+    Kind kind;
+    TickType_t due;
+    TickType_t period; // Zero if the event happens once
+    std::string text;
+};
+
+struct ModemOutput {
+    TickType_t due;
+    std::string bytes;
+};
+
+static std::uint32_t s_modemBaudRate = 115200;
+static std::uint32_t s_modemChunkSize = 64;
+static std::uint32_t s_modemLatencyMs = 2;
+static std::mt19937 s_modemRandom {};
+
+static std::vector<ModemRule> s_modemRules;
+static std::vector<ModemEvent> s_modemEvents;
+static std::deque<ModemOutput> s_modemOutputs;
+
+static bool s_modemStarted {};
+static bool s_modemEcho = true;
+static std::array<bool, MODEM_LINK_COUNT> s_modemLinks {};
+static int s_modemNextLink {};
+static std::string s_modemLine;
+static std::size_t s_modemSendRemaining {};
+static std::size_t s_modemSendSize {};
+// Time on the line up to which the bytes sent so far are busy
+static std::uint64_t s_modemLineFreeUs {};
+static FakeModemStats s_modemStats {};
+
+static StreamBufferHandle_t s_modemRxStream {};
+static StaticStreamBuffer_t s_modemRxStreamBuffer {};
+static std::array<std::uint8_t, 4096> s_modemRxStreamStorage {};
+static std::array<configSTACK_DEPTH_TYPE, 2048> s_modemTaskStack {};
+static StaticTask_t s_modemTaskTcb {};
+
+static std::string unescape(const std::string& text)
+{
+    std::string out;
+
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            out += text[i];
+            continue;
+        }
+
+        switch (text[++i]) {
+        case 'r':
+            out += '\r';
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        case 'x':
+            if (i + 2 < text.size()) {
+                out += static_cast<char>(std::strtoul(text.substr(i + 1, 2).c_str(), nullptr, 16));
+                i += 2;
+            }
+            break;
+        default:
+            out += text[i];
+            break;
+        }
+    }
+
+    return out;
+}
+
+static bool chance(std::uint32_t percent)
+{
+    return std::uniform_int_distribution<std::uint32_t>(0, 99)(s_modemRandom) < percent;
+}
+
+static void queueOutput(std::uint32_t delayMs, std::string bytes)
+{
+    // Kept in order, a later response never overtakes an earlier one
+    TickType_t due = xTaskGetTickCount() + delayMs;
+    if (!s_modemOutputs.empty()) {
+        due = std::max(due, s_modemOutputs.back().due);
+    }
+
+    s_modemOutputs.push_back({ due, std::move(bytes) });
+}
+
+static void transmit(const std::string& bytes)
+{
+    for (std::size_t offset = 0; offset < bytes.size();) {
+        auto size = std::min<std::size_t>(s_modemChunkSize, bytes.size() - offset);
+
+        // The chunk arrives once its last byte is through the line
+        std::uint64_t nowUs = static_cast<std::uint64_t>(xTaskGetTickCount()) * 1000;
+        s_modemLineFreeUs = std::max(s_modemLineFreeUs, nowUs)
+            + size * MODEM_BITS_PER_BYTE * 1000000ULL / s_modemBaudRate;
+
+        if (s_modemLineFreeUs >= nowUs + 1000) {
+            vTaskDelay((s_modemLineFreeUs - nowUs) / 1000);
+        }
+
+        uartReceive(reinterpret_cast<const std::uint8_t*>(bytes.data()) + offset, size);
+        offset += size;
+    }
+}
+
+static std::string formatSntpTime()
+{
+    std::array<char, 32> buffer {};
+    std::time_t now = std::time(nullptr);
+    std::strftime(buffer.data(), buffer.size(), "%a %b %d %H:%M:%S %Y", std::gmtime(&now));
+
+    return buffer.data();
+}
+
+static int parseLinkId(const std::string& command, std::size_t offset)
+{
+    return offset < command.size() ? std::atoi(command.c_str() + offset) : -1;
+}
+
+static std::string closeLink(int linkId)
+{
+    s_modemLinks.at(linkId) = false;
+    return std::to_string(linkId) + ",CLOSED\r\n";
+}
+
+static std::string answerCommand(const std::string& command)
+{
+    if (command == "ATE0" || command == "ATE1") {
+        s_modemEcho = command == "ATE1";
+        return "\r\nOK\r\n";
+    }
+
+    if (command.starts_with("AT+CIPSEND=")) {
+        auto linkId = parseLinkId(command, 11);
+        auto comma = command.find(',');
+
+        if (linkId < 0 || linkId >= MODEM_LINK_COUNT || !s_modemLinks.at(linkId) || comma == std::string::npos) {
+            return "link is not valid\r\n\r\nERROR\r\n";
+        }
+
+        s_modemSendSize = std::strtoul(command.c_str() + comma + 1, nullptr, 10);
+        s_modemSendRemaining = s_modemSendSize;
+        return "\r\nOK\r\n> ";
+    }
+
+    if (command.starts_with("AT+CIPCLOSE=")) {
+        auto linkId = parseLinkId(command, 12);
+
+        if (linkId == MODEM_CLOSE_ALL_LINKS) {
+            std::string response;
+            for (int i = 0; i < MODEM_LINK_COUNT; ++i) {
+                if (s_modemLinks.at(i)) {
+                    response += closeLink(i);
+                }
+            }
+
+            return response + "\r\nOK\r\n";
+        }
+
+        if (linkId < 0 || linkId >= MODEM_LINK_COUNT || !s_modemLinks.at(linkId)) {
+            return "UNLINK\r\n\r\nERROR\r\n";
+        }
+
+        return closeLink(linkId) + "\r\nOK\r\n";
+    }
+
+    if (command.starts_with("AT+CWJAP=")) {
+        return "WIFI CONNECTED\r\nWIFI GOT IP\r\n\r\nOK\r\n";
+    }
+
+    if (command == "AT+CWJAP?") {
+        return "+CWJAP:\"LeakGuard\",\"02:00:00:00:00:01\",6,-55,0,1,3,0,1\r\n\r\nOK\r\n";
+    }
+
+    if (command == "AT+CWQAP") {
+        return "WIFI DISCONNECT\r\n\r\nOK\r\n";
+    }
+
+    if (command == "AT+CWLAP") {
+        return "+CWLAP:(3,\"LeakGuard\",-55,\"02:00:00:00:00:01\",6,-1,-1,4,4,7,0)\r\n"
+               "+CWLAP:(4,\"Neighbour\",-78,\"02:00:00:00:00:02\",11,-1,-1,4,4,7,0)\r\n"
+               "\r\nOK\r\n";
+    }
+
+    if (command == "AT+CIPSTA?") {
+        return "+CIPSTA:ip:\"192.168.1.50\"\r\n"
+               "+CIPSTA:gateway:\"192.168.1.1\"\r\n"
+               "+CIPSTA:netmask:\"255.255.255.0\"\r\n"
+               "\r\nOK\r\n";
+    }
+
+    if (command == "AT+CIPSTAMAC?") {
+        return "+CIPSTAMAC:\"02:00:00:00:00:10\"\r\n\r\nOK\r\n";
+    }
+
+    if (command == "AT+CIPAPMAC?") {
+        return "+CIPAPMAC:\"02:00:00:00:00:11\"\r\n\r\nOK\r\n";
+    }
+
+    if (command == "AT+CIPSNTPTIME?") {
+        return "+CIPSNTPTIME:" + formatSntpTime() + "\r\nOK\r\n";
+    }
+
+    if (command.starts_with("AT+CIPSNTPCFG=")) {
+        s_modemEvents.push_back({ ModemEvent::Kind::OUTPUT,
+            xTaskGetTickCount() + MODEM_TIME_UPDATE_DELAY_MS, 0, "+TIME_UPDATED\r\n" });
+        return "\r\nOK\r\n";
+    }
+
+    if (command.starts_with("AT+MQTTCONN=")) {
+        return "+MQTTCONNECTED:0,1,\"broker\",\"1883\",\"\",1\r\n\r\nOK\r\n";
+    }
+
+    // Settings the driver does not read back
+    if (command == "AT" || command.starts_with("AT+")) {
+        return "\r\nOK\r\n";
+    }
+
+    return "\r\nERROR\r\n";
+}
+
+static void handleCommand(const std::string& command)
+{
+    ++s_modemStats.commands;
+
+    if (s_modemEcho) {
+        queueOutput(0, command + "\r\n");
+    }
+
+    for (auto& rule : s_modemRules) {
+        if (!command.starts_with(rule.prefix)) {
+            continue;
+        }
+
+        if (rule.kind == ModemRule::Kind::DROP && chance(rule.value)) {
+            ++s_modemStats.droppedCommands;
+            return;
+        }
+
+        if (rule.kind == ModemRule::Kind::FAIL && chance(rule.value)) {
+            ++s_modemStats.injectedErrors;
+            queueOutput(s_modemLatencyMs, "\r\nERROR\r\n");
+            return;
+        }
+
+        if (rule.kind == ModemRule::Kind::REPLY) {
+            queueOutput(rule.value, rule.text);
+            return;
+        }
+    }
+
+    queueOutput(s_modemLatencyMs, answerCommand(command));
+}
+
+static void receiveByte(char c)
+{
+    if (s_modemSendRemaining) {
+        if (--s_modemSendRemaining == 0) {
+            ++s_modemStats.sends;
+            s_modemStats.sendBytes += s_modemSendSize;
+            queueOutput(s_modemLatencyMs,
+                "\r\nRecv " + std::to_string(s_modemSendSize) + " bytes\r\n\r\nSEND OK\r\n");
+        }
+
+        return;
+    }
+
+    if (s_modemLine.size() < MODEM_MAX_LINE_SIZE) {
+        s_modemLine += c;
+    }
+
+    if (c == '\n') {
+        while (!s_modemLine.empty() && (s_modemLine.back() == '\n' || s_modemLine.back() == '\r')) {
+            s_modemLine.pop_back();
+        }
+
+        handleCommand(s_modemLine);
+        s_modemLine.clear();
+    }
+}
+
+static void openConnection(const std::string& request)
+{
+    for (int i = 0; i < MODEM_LINK_COUNT; ++i) {
+        int linkId = (s_modemNextLink + i) % MODEM_LINK_COUNT;
+
+        if (!s_modemLinks.at(linkId)) {
+            s_modemLinks.at(linkId) = true;
+            s_modemNextLink = linkId + 1;
+            ++s_modemStats.connections;
+
+            auto link = std::to_string(linkId);
+            queueOutput(0, link + ",CONNECT\r\n+IPD," + link + "," + std::to_string(request.size()) + ":" + request);
+            return;
+        }
+    }
+
+    ++s_modemStats.refusedConnections;
+}
+
+static void runEvents(TickType_t now)
+{
+    for (std::size_t i = 0; i < s_modemEvents.size();) {
+        auto& event = s_modemEvents.at(i);
+
+        if (static_cast<std::int32_t>(now - event.due) < 0) {
+            ++i;
+            continue;
+        }
+
+        if (event.kind == ModemEvent::Kind::REQUEST) {
+            openConnection(event.text);
+        } else {
+            queueOutput(0, event.text);
+        }
+
+        if (event.period) {
+            event.due += event.period;
+            ++i;
+        } else {
+            s_modemEvents.erase(s_modemEvents.begin() + i);
+        }
+    }
+}
+
+static TickType_t getTimeToNextDue(TickType_t now)
+{
+    TickType_t timeout = portMAX_DELAY;
+
+    auto consider = [&](TickType_t due) {
+        auto remaining = static_cast<std::int32_t>(due - now);
+        timeout = std::min<TickType_t>(timeout, std::max(remaining, 0));
+    };
+
+    for (auto& event : s_modemEvents) {
+        consider(event.due);
+    }
+
+    if (!s_modemOutputs.empty()) {
+        consider(s_modemOutputs.front().due);
+    }
+
+    return timeout;
+}
+
+static void modemTaskMain(void*)
+{
+    std::array<char, 256> buffer {};
+
+    // Scripted times count from the start of the scheduler
+    for (auto& event : s_modemEvents) {
+        event.due += xTaskGetTickCount();
+    }
+
+    while (true) {
+        auto now = xTaskGetTickCount();
+        runEvents(now);
+
+        while (!s_modemOutputs.empty()
+            && static_cast<std::int32_t>(xTaskGetTickCount() - s_modemOutputs.front().due) >= 0) {
+
+            auto output = std::move(s_modemOutputs.front());
+            s_modemOutputs.pop_front();
+            transmit(output.bytes);
+        }
+
+        auto size = xStreamBufferReceive(s_modemRxStream, buffer.data(), buffer.size(),
+            getTimeToNextDue(xTaskGetTickCount()));
+
+        for (std::size_t i = 0; i < size; ++i) {
+            receiveByte(buffer.at(i));
+        }
+    }
+}
+
+static bool loadModemScript(const char* path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+        std::istringstream stream(line);
+        std::string directive;
+        stream >> directive;
+
+        if (directive.empty() || directive.starts_with('#')) {
+            continue;
+        }
+
+        std::string prefix;
+        std::uint32_t value = 0;
+
+        if (directive == "reply" || directive == "fail" || directive == "drop") {
+            stream >> prefix;
+        }
+
+        stream >> value;
+
+        std::string text;
+        std::getline(stream >> std::ws, text);
+        text = unescape(text);
+
+        if (!stream && !stream.eof()) {
+            std::fprintf(stderr, "%s:%d: cannot parse \"%s\"\n", path, lineNumber, line.c_str());
+            return false;
+        }
+
+        if (directive == "baud" && value) {
+            s_modemBaudRate = value;
+        } else if (directive == "chunk" && value) {
+            s_modemChunkSize = value;
+        } else if (directive == "latency") {
+            s_modemLatencyMs = value;
+        } else if (directive == "seed") {
+            s_modemRandom.seed(value);
+        } else if (directive == "reply") {
+            s_modemRules.push_back({ ModemRule::Kind::REPLY, prefix, value, text });
+        } else if (directive == "fail") {
+            s_modemRules.push_back({ ModemRule::Kind::FAIL, prefix, value, {} });
+        } else if (directive == "drop") {
+            s_modemRules.push_back({ ModemRule::Kind::DROP, prefix, value, {} });
+        } else if (directive == "at") {
+            s_modemEvents.push_back({ ModemEvent::Kind::OUTPUT, value, 0, text });
+        } else if (directive == "every" && value) {
+            s_modemEvents.push_back({ ModemEvent::Kind::OUTPUT, value, value, text });
+        } else if (directive == "request" && value) {
+            s_modemEvents.push_back({ ModemEvent::Kind::REQUEST, value, value, text });
+        } else if (directive == "replay") {
+            std::ifstream trace(text, std::ios::binary);
+            if (!trace) {
+                std::fprintf(stderr, "%s:%d: cannot read trace %s\n", path, lineNumber, text.c_str());
+                return false;
+            }
+
+            s_modemEvents.push_back({ ModemEvent::Kind::OUTPUT, value, 0,
+                std::string((std::istreambuf_iterator<char>(trace)), std::istreambuf_iterator<char>()) });
+        } else {
+            std::fprintf(stderr, "%s:%d: unknown directive \"%s\"\n", path, lineNumber, directive.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool startFakeModem(const char* scriptPath)
+{
+    if (scriptPath && !loadModemScript(scriptPath)) {
+        return false;
+    }
+
+    s_modemRxStream = xStreamBufferCreateStatic(
+        s_modemRxStreamStorage.size(), 1, s_modemRxStreamStorage.data(), &s_modemRxStreamBuffer);
+
+    // The firmware transmits from its own tasks, the modem task answers
+    setUartTxHandler([](const std::uint8_t* data, std::size_t size) {
+        xStreamBufferSend(s_modemRxStream, data, size, portMAX_DELAY);
+    });
+
+    xTaskCreateStatic(
+        &modemTaskMain /* Task function */,
+        "Host ESP Modem" /* Task name */,
+        s_modemTaskStack.size() /* Stack size */,
+        nullptr /* Parameters */,
+        configMAX_PRIORITIES - 2 /* Priority */,
+        s_modemTaskStack.data() /* Task stack address */,
+        &s_modemTaskTcb /* Task control block */
+    );
+
+    s_modemStarted = true;
+    return true;
+}
+
+bool isFakeModemStarted()
+{
+    return s_modemStarted;
+}
+
+FakeModemStats getFakeModemStats()
+{
+    return s_modemStats;
+}
+
+};
@@ -0,0 +1,50 @@
+#include <host.hpp>
+
+GPIO_TypeDef hostGpio[HOST_GPIO_PORT_COUNT] = {
+    // Inputs idle high (pull-ups), outputs start low
+    { 0xFFFF, 0 }, { 0xFFFF, 0 }, { 0xFFFF, 0 }, { 0xFFFF, 0 },
+    { 0xFFFF, 0 }, { 0xFFFF, 0 }, { 0xFFFF, 0 }, { 0xFFFF, 0 },
+    { 0xFFFF, 0 }, { 0xFFFF, 0 }, { 0xFFFF, 0 },
+};
+
+extern "C" GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+    return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+extern "C" void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    if (PinState == GPIO_PIN_SET) {
+        GPIOx->ODR = GPIOx->ODR | GPIO_Pin;
+    } else {
+        GPIOx->ODR = GPIOx->ODR & ~static_cast<std::uint32_t>(GPIO_Pin);
+    }
+}
+
+extern "C" void HAL_GPIO_TogglePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+    GPIOx->ODR = GPIOx->ODR ^ GPIO_Pin;
+}
+
+namespace lg::host {
+
+void setInputPin(GPIO_TypeDef* port, std::uint16_t pin, GPIO_PinState state)
+{
+    if (state == GPIO_PIN_SET) {
+        port->IDR = port->IDR | pin;
+    } else {
+        port->IDR = port->IDR & ~static_cast<std::uint32_t>(pin);
+    }
+}
+
+GPIO_PinState getOutputPin(GPIO_TypeDef* port, std::uint16_t pin)
+{
+    return (port->ODR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void triggerExti(std::uint16_t pin)
+{
+    runAsIrq([pin] { HAL_GPIO_EXTI_Callback(pin); });
+}
+
+};
@@ -0,0 +1,136 @@
+#include <host.hpp>
+
+#include <device.hpp>
+#include <history.hpp>
+#include <utc.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+namespace lg::host {
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr auto DAY_SECONDS = 24 * 3600U;
+static constexpr auto QUERY_DAYS = 7U;
+static constexpr auto FIRST_DAY_TIMESTAMP = 1704067200U; // 2024-01-01
+static constexpr auto BENCHMARK_DURATION = std::chrono::seconds(1);
+
+static HistoryService::FlashHistoryEntry makeFlashDay(std::uint32_t day, std::uint32_t& cumulativeMl)
+{
+    HistoryService::FlashHistoryEntry entry {};
+    entry.fromTimestamp = FIRST_DAY_TIMESTAMP + day * DAY_SECONDS;
+    entry.toTimestamp = entry.fromTimestamp + DAY_SECONDS - 60;
+
+    UtcTime date(entry.fromTimestamp);
+    entry.year = date.getYear();
+    entry.month = date.getMonth();
+    entry.day = date.getDay();
+
+    for (std::size_t hour = 0; hour < entry.hourVolumesMl.size(); ++hour) {
+        entry.hourVolumesMl[hour] = (day + hour) % 5 * 1000;
+        cumulativeMl += entry.hourVolumesMl[hour];
+    }
+
+    entry.cumulativeMl = cumulativeMl;
+    return entry;
+}
+
+// Every record overlapping the range, the way queries worked before the
+// bisection over the record numbers
+static std::uint32_t scanFlashHistory(std::uint32_t fromTimestamp, std::uint32_t toTimestamp)
+{
+    auto flashStore = Device::get().getFlashStore();
+    auto endRecord = flashStore->getEndRecord(FlashStore::Stream::HISTORY);
+    std::uint32_t matches = 0;
+
+    for (auto i = flashStore->getFirstRecord(FlashStore::Stream::HISTORY); i < endRecord; ++i) {
+        auto entry = flashStore->getRecordObject<HistoryService::FlashHistoryEntry>(FlashStore::Stream::HISTORY, i);
+        if (entry && entry->toTimestamp >= fromTimestamp && entry->fromTimestamp <= toTimestamp) {
+            ++matches;
+        }
+    }
+
+    return matches;
+}
+
+bool runFlashHistoryBenchmark(std::uint32_t days)
+{
+    if (days < QUERY_DAYS) {
+        return false;
+    }
+
+    // Only the queries are timed, appends do not have to wait for the chip
+    setFlashTimings({});
+
+    Device::get().getFlashDriver()->initialize();
+    Device::get().getFlashStore()->initialize();
+
+    std::uint32_t cumulativeMl = 0;
+
+    for (std::uint32_t day = 0; day < days; ++day) {
+        auto flashStore = Device::get().getFlashStore();
+
+        if (!flashStore->appendObject(FlashStore::Stream::HISTORY, makeFlashDay(day, cumulativeMl))) {
+            return false;
+        }
+
+        flashStore->maintain();
+    }
+
+    auto history = Device::get().getHistoryService();
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<std::uint32_t> firstDay(0, days - QUERY_DAYS);
+    std::uint32_t queries = 0, scans = 0;
+    Clock::duration queryTime {}, rangeTime {}, scanTime {};
+
+    while (queryTime + rangeTime + scanTime < BENCHMARK_DURATION) {
+        auto from = FIRST_DAY_TIMESTAMP + firstDay(random) * DAY_SECONDS;
+        auto to = from + QUERY_DAYS * DAY_SECONDS - 1;
+        std::uint32_t found = 0, foundMl = 0, totalMl = 0;
+
+        auto start = Clock::now();
+        history->forEachFlashHistoryEntry(from, to,
+            [&found, &foundMl](std::size_t, const HistoryService::FlashHistoryEntry& entry) {
+                ++found;
+                for (auto volumeMl : entry.hourVolumesMl) {
+                    foundMl += volumeMl;
+                }
+            });
+        queryTime += Clock::now() - start;
+
+        start = Clock::now();
+        history->getRangeTotal(from, to, totalMl);
+        rangeTime += Clock::now() - start;
+        ++queries;
+
+        if (totalMl != foundMl) {
+            std::fprintf(stderr, "Range total and query disagree\n");
+            return false;
+        }
+
+        // The scan is slow on long histories, a few runs are enough
+        if (scans < queries / 16 + 1) {
+            start = Clock::now();
+            if (scanFlashHistory(from, to) != found) {
+                std::fprintf(stderr, "Query and scan disagree\n");
+                return false;
+            }
+            scanTime += Clock::now() - start;
+            ++scans;
+        }
+    }
+
+    auto toUs = [](Clock::duration time, std::uint32_t count) {
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count()) / count / 1000;
+    };
+
+    std::printf("%u days: one week query %.2f us, range total %.2f us, scan of all records %.2f us\n",
+        days, toUs(queryTime, queries), toUs(rangeTime, queries), toUs(scanTime, scans));
+
+    return true;
+}
+
+};
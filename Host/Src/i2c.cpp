@@ -0,0 +1,314 @@
+#include <host.hpp>
+
+#include <device.hpp>
+#include <drivers/eeprom.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <i2c.h>
+#include <main.h>
+#include <stm32f7xx_ll_i2c.h>
+
+extern "C" void I2C2_EV_IRQHandler(void);
+
+namespace lg::host {
+
+using Clock = std::chrono::steady_clock;
+
+// 24LC512: 64 KiB, 128 B pages, 5 ms self-timed write cycle during which
+// the device does not acknowledge its address.
+static constexpr auto EEPROM_ADDRESS = EepromDriver::I2C_ADDRESS;
+static constexpr auto EEPROM_SIZE = EepromDriver::EEPROM_SIZE_BYTES;
+static constexpr auto EEPROM_PAGE_SIZE = EepromDriver::EEPROM_PAGE_SIZE_BYTES;
+static constexpr auto EEPROM_WRITE_CYCLE = std::chrono::milliseconds(5);
+// Nine clocks per byte at 400 kHz, plus the device and address bytes
+static constexpr auto I2C_BYTE_TIME = std::chrono::nanoseconds(22500);
+static constexpr auto I2C_TRANSACTION_OVERHEAD = 3;
+
+static std::array<std::uint8_t, EEPROM_SIZE> s_eeprom = [] {
+    std::array<std::uint8_t, EEPROM_SIZE> memory {};
+    memory.fill(0xFF);
+    return memory;
+}();
+
+static Clock::time_point s_eepromBusyUntil {};
+static EepromStats s_eepromStats {};
+static int s_eepromImageFd = -1;
+
+static std::uint32_t s_eepromReportPeriodMs {};
+static std::array<configSTACK_DEPTH_TYPE, 1024> s_eepromReportTaskStack {};
+static StaticTask_t s_eepromReportTaskTcb {};
+
+static bool isEeprom(const I2C_HandleTypeDef* hi2c, std::uint16_t address)
+{
+    return hi2c == &hi2c2 && address == EEPROM_ADDRESS;
+}
+
+static bool isEepromBusy()
+{
+    return Clock::now() < s_eepromBusyUntil;
+}
+
+// Holds the caller for as long as the transfer would take on the bus
+static void occupyBus(std::uint16_t size)
+{
+    auto busTime = I2C_BYTE_TIME * (size + I2C_TRANSACTION_OVERHEAD);
+    s_eepromStats.busTimeUs += std::chrono::duration_cast<std::chrono::microseconds>(busTime).count();
+    std::this_thread::sleep_for(busTime);
+}
+
+static bool eepromWrite(std::uint16_t address, const std::uint8_t* data, std::uint16_t size)
+{
+    if (isEepromBusy()) {
+        ++s_eepromStats.busyNacks;
+        return false;
+    }
+
+    ++s_eepromStats.writeTransactions;
+    occupyBus(size);
+
+    // A write-protected device still acknowledges, but does not start a write cycle
+    if (getOutputPin(EEPROM_WP_GPIO_Port, EEPROM_WP_Pin) == GPIO_PIN_SET) {
+        return true;
+    }
+
+    // The address counter wraps around within the page
+    std::uint16_t pageStart = address & ~(EEPROM_PAGE_SIZE - 1);
+
+    for (std::uint16_t i = 0; i < size; ++i) {
+        std::uint16_t offset = (address + i) & (EEPROM_PAGE_SIZE - 1);
+        s_eeprom.at(pageStart + offset) = data[i];
+    }
+
+    if (s_eepromImageFd >= 0) {
+        pwrite(s_eepromImageFd, s_eeprom.data() + pageStart, EEPROM_PAGE_SIZE, pageStart);
+    }
+
+    s_eepromStats.bytesWritten += size;
+    s_eepromBusyUntil = Clock::now() + EEPROM_WRITE_CYCLE;
+    return true;
+}
+
+static bool eepromRead(std::uint16_t address, std::uint8_t* data, std::uint16_t size)
+{
+    if (isEepromBusy()) {
+        ++s_eepromStats.busyNacks;
+        return false;
+    }
+
+    ++s_eepromStats.readTransactions;
+    occupyBus(size);
+
+    // Sequential reads wrap around the whole array
+    for (std::uint16_t i = 0; i < size; ++i) {
+        data[i] = s_eeprom.at(static_cast<std::uint16_t>(address + i));
+    }
+
+    s_eepromStats.bytesRead += size;
+    return true;
+}
+
+static void completeDma(I2C_HandleTypeDef* hi2c, HAL_I2C_StateTypeDef state)
+{
+    if (hi2c != &hi2c2) {
+        // Nothing on the host listens for the I2C1 interrupt
+        hi2c->State = HAL_I2C_STATE_READY;
+        return;
+    }
+
+    hi2c->State = state;
+    hi2c->Instance->ISR = hi2c->Instance->ISR | I2C_ISR_STOPF;
+    runAsIrq(&I2C2_EV_IRQHandler);
+}
+
+bool openEepromImage(const char* path)
+{
+    auto fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    // A new or shorter image is padded with erased bytes
+    auto size = pread(fd, s_eeprom.data(), EEPROM_SIZE, 0);
+    if (size < 0) {
+        close(fd);
+        return false;
+    }
+
+    std::fill(s_eeprom.begin() + size, s_eeprom.end(), 0xFF);
+
+    if (pwrite(fd, s_eeprom.data(), EEPROM_SIZE, 0) != static_cast<ssize_t>(EEPROM_SIZE)) {
+        close(fd);
+        return false;
+    }
+
+    if (s_eepromImageFd >= 0) {
+        close(s_eepromImageFd);
+    }
+
+    s_eepromImageFd = fd;
+    return true;
+}
+
+EepromStats getEepromStats()
+{
+    return s_eepromStats;
+}
+
+void resetEepromStats()
+{
+    s_eepromStats = {};
+}
+
+static void eepromReportTaskMain(void*)
+{
+    while (true) {
+        vTaskDelay(s_eepromReportPeriodMs);
+
+        auto queue = Device::get().getEepromQueue().getStats();
+        auto requests = queue.reads + queue.writes + queue.mergedWrites;
+        auto bytes = queue.bytesRead + queue.bytesWritten;
+
+        std::fprintf(stderr,
+            "EEPROM queue: %u reads, %u writes (%u merged), queue delay avg %u ms max %u ms, "
+            "max %u queued, %u B/s while busy, bus %u us, %u busy NACKs\n",
+            queue.reads, queue.writes, queue.mergedWrites,
+            requests ? queue.queueDelayMs / requests : 0, queue.maxQueueDelayMs, queue.maxQueued,
+            queue.busyTimeMs ? static_cast<std::uint32_t>(static_cast<std::uint64_t>(bytes) * 1000 / queue.busyTimeMs) : 0,
+            s_eepromStats.busTimeUs, s_eepromStats.busyNacks);
+    }
+}
+
+void startEepromReport(std::uint32_t periodMs)
+{
+    s_eepromReportPeriodMs = periodMs;
+
+    xTaskCreateStatic(
+        &eepromReportTaskMain /* Task function */,
+        "Host EEPROM Rep" /* Task name */,
+        s_eepromReportTaskStack.size() /* Stack size */,
+        nullptr /* Parameters */,
+        1 /* Priority */,
+        s_eepromReportTaskStack.data() /* Task stack address */,
+        &s_eepromReportTaskTcb /* Task control block */
+    );
+}
+
+};
+
+using namespace lg;
+
+extern "C" HAL_StatusTypeDef HAL_I2C_Master_Transmit(I2C_HandleTypeDef*, uint16_t, uint8_t*, uint16_t, uint32_t)
+{
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef* hi2c, uint16_t DevAddress,
+    uint16_t MemAddress, uint16_t, uint8_t* pData, uint16_t Size, uint32_t)
+{
+    if (!host::isEeprom(hi2c, DevAddress)) {
+        return HAL_OK;
+    }
+
+    return host::eepromWrite(MemAddress, pData, Size) ? HAL_OK : HAL_ERROR;
+}
+
+extern "C" HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef* hi2c, uint16_t DevAddress,
+    uint16_t MemAddress, uint16_t, uint8_t* pData, uint16_t Size, uint32_t)
+{
+    if (!host::isEeprom(hi2c, DevAddress)) {
+        return HAL_ERROR;
+    }
+
+    return host::eepromRead(MemAddress, pData, Size) ? HAL_OK : HAL_ERROR;
+}
+
+extern "C" HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef* hi2c, uint16_t DevAddress,
+    uint16_t MemAddress, uint16_t, uint8_t* pData, uint16_t Size)
+{
+    if (hi2c->State != HAL_I2C_STATE_READY) {
+        return HAL_BUSY;
+    }
+
+    if (host::isEeprom(hi2c, DevAddress) && !host::eepromWrite(MemAddress, pData, Size)) {
+        return HAL_ERROR;
+    }
+
+    host::completeDma(hi2c, HAL_I2C_STATE_BUSY_TX);
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef* hi2c, uint16_t DevAddress,
+    uint16_t MemAddress, uint16_t, uint8_t* pData, uint16_t Size)
+{
+    if (hi2c->State != HAL_I2C_STATE_READY) {
+        return HAL_BUSY;
+    }
+
+    if (!host::isEeprom(hi2c, DevAddress) || !host::eepromRead(MemAddress, pData, Size)) {
+        return HAL_ERROR;
+    }
+
+    host::completeDma(hi2c, HAL_I2C_STATE_BUSY_RX);
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_I2C_Master_Transmit_IT(I2C_HandleTypeDef* hi2c, uint16_t DevAddress,
+    uint8_t*, uint16_t Size)
+{
+    if (hi2c->State != HAL_I2C_STATE_READY) {
+        return HAL_BUSY;
+    }
+
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+
+    // Only address probes are sent to the EEPROM this way
+    if (host::isEeprom(hi2c, DevAddress) && Size == 0 && host::isEepromBusy()) {
+        ++host::s_eepromStats.busyNacks;
+        hi2c->ErrorCode = HAL_I2C_ERROR_AF;
+    }
+
+    host::completeDma(hi2c, HAL_I2C_STATE_BUSY_TX);
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_I2C_IsDeviceReady(I2C_HandleTypeDef* hi2c, uint16_t DevAddress,
+    uint32_t Trials, uint32_t)
+{
+    if (!host::isEeprom(hi2c, DevAddress)) {
+        return HAL_ERROR;
+    }
+
+    for (uint32_t i = 0; i < Trials; ++i) {
+        if (!host::isEepromBusy()) {
+            return HAL_OK;
+        }
+
+        ++host::s_eepromStats.busyNacks;
+    }
+
+    return HAL_ERROR;
+}
+
+extern "C" HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef* hi2c)
+{
+    return hi2c->State;
+}
+
+extern "C" uint32_t HAL_I2C_GetError(I2C_HandleTypeDef* hi2c)
+{
+    return hi2c->ErrorCode;
+}
+
+extern "C" void HAL_I2C_EV_IRQHandler(I2C_HandleTypeDef* hi2c)
+{
+    hi2c->Instance->ISR = hi2c->Instance->ISR & ~I2C_ISR_STOPF;
+    hi2c->State = HAL_I2C_STATE_READY;
+}
@@ -0,0 +1,57 @@
+#include <host.hpp>
+
+#include <array>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+namespace lg::host {
+
+static constexpr auto IRQ_POLL_PERIOD_MS = 1;
+
+// Every FreeRTOS task runs on its own pthread, so "being inside an
+// interrupt" is tracked per thread.
+static thread_local bool s_insideIrq = false;
+
+static std::array<configSTACK_DEPTH_TYPE, 1024> s_irqTaskStack {};
+static StaticTask_t s_irqTaskTcb {};
+
+static void irqTaskMain(void*)
+{
+    while (true) {
+        vTaskDelay(IRQ_POLL_PERIOD_MS);
+
+        pollRtcAlarm();
+        pollTimers();
+        pollQspi();
+    }
+}
+
+void runAsIrq(const std::function<void()>& handler)
+{
+    bool wasInsideIrq = s_insideIrq;
+    s_insideIrq = true;
+    handler();
+    s_insideIrq = wasInsideIrq;
+}
+
+void startIrqTask()
+{
+    // Emulated interrupts must preempt everything else, as on the target
+    xTaskCreateStatic(
+        &irqTaskMain /* Task function */,
+        "Host IRQ" /* Task name */,
+        s_irqTaskStack.size() /* Stack size */,
+        nullptr /* Parameters */,
+        configMAX_PRIORITIES - 1 /* Priority */,
+        s_irqTaskStack.data() /* Task stack address */,
+        &s_irqTaskTcb /* Task control block */
+    );
+}
+
+};
+
+extern "C" long xPortIsInsideInterrupt(void)
+{
+    return lg::host::s_insideIrq ? pdTRUE : pdFALSE;
+}
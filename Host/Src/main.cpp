@@ -0,0 +1,112 @@
+#include <host.hpp>
+
+#include <rtos.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+int main()
+{
+    lg::host::initializePeripherals();
+
+    // Benchmarks the ESP-AT receive path on a recorded trace and exits
+    if (auto trace = std::getenv("LG_AT_BENCH")) {
+        if (!lg::host::runEspAtBenchmark(trace)) {
+            std::fprintf(stderr, "Cannot read AT trace %s\n", trace);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // Times flash history queries on a history of this many days and exits
+    if (auto days = std::getenv("LG_HISTORY_BENCH")) {
+        if (!lg::host::runFlashHistoryBenchmark(std::strtoul(days, nullptr, 10))) {
+            std::fprintf(stderr, "Flash history benchmark failed\n");
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // Benchmarks the minute block coding on a recorded flow trace and exits
+    if (auto trace = std::getenv("LG_MINUTE_BENCH")) {
+        if (!lg::host::runMinuteBlockBenchmark(trace)) {
+            std::fprintf(stderr, "Cannot read minute trace %s\n", trace);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // Boots the history service on an EEPROM ring filled from a recorded
+    // flow trace, times the query of today and exits
+    if (auto trace = std::getenv("LG_RING_BENCH")) {
+        if (!lg::host::runMinuteRingBenchmark(trace)) {
+            std::fprintf(stderr, "Cannot load minute trace %s into the ring\n", trace);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (auto image = std::getenv("LG_FLASH_IMAGE")) {
+        if (!lg::host::openFlashImage(image)) {
+            std::fprintf(stderr, "Cannot open flash image %s\n", image);
+            return 1;
+        }
+    }
+
+    if (auto image = std::getenv("LG_EEPROM_IMAGE")) {
+        if (!lg::host::openEepromImage(image)) {
+            std::fprintf(stderr, "Cannot open EEPROM image %s\n", image);
+            return 1;
+        }
+    }
+
+    // Seconds between two reports of the EEPROM queue
+    if (auto period = std::getenv("LG_EEPROM_REPORT")) {
+        if (auto seconds = std::strtoul(period, nullptr, 10)) {
+            lg::host::startEepromReport(seconds * 1000);
+        }
+    }
+
+    // Seconds between two reports of the ESP-AT UART and command queue
+    if (auto period = std::getenv("LG_ESP_REPORT")) {
+        if (auto seconds = std::strtoul(period, nullptr, 10)) {
+            lg::host::startEspReport(seconds * 1000);
+        }
+    }
+
+    // Script for the fake ESP-AT module, empty for the built-in answers only
+    if (auto script = std::getenv("LG_ESP_MODEM")) {
+        if (!lg::host::startFakeModem(*script ? script : nullptr)) {
+            std::fprintf(stderr, "Cannot load ESP modem script %s\n", script);
+            return 1;
+        }
+    }
+
+    // Program, sector, block and chip erase times in microseconds
+    if (auto timings = std::getenv("LG_FLASH_TIMINGS")) {
+        unsigned long pageProgram = 0, sectorErase = 0, blockErase = 0, chipErase = 0;
+
+        if (std::sscanf(timings, "%lu,%lu,%lu,%lu", &pageProgram, &sectorErase, &blockErase, &chipErase) != 4) {
+            std::fprintf(stderr, "LG_FLASH_TIMINGS expects four comma separated values\n");
+            return 1;
+        }
+
+        lg::host::setFlashTimings({
+            .pageProgram = std::chrono::microseconds(pageProgram),
+            .sectorErase = std::chrono::microseconds(sectorErase),
+            .blockErase = std::chrono::microseconds(blockErase),
+            .chipErase = std::chrono::microseconds(chipErase),
+        });
+    }
+
+    lg::host::startIrqTask();
+
+    // Does not return, the scheduler takes over the process
+    rtos_main();
+
+    return 0;
+}
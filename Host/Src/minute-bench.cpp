@@ -0,0 +1,240 @@
+#include <host.hpp>
+
+#include <device.hpp>
+#include <history.hpp>
+#include <minute-block.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace lg::host {
+
+using Clock = std::chrono::steady_clock;
+
+// Size of the data point the firmware stored before the minute blocks
+static constexpr auto LEGACY_ENTRY_SIZE = 16U;
+// Same as the EEPROM ring of the history service
+static constexpr auto RING_BLOCK_COUNT = 256U;
+static constexpr auto RING_ADDR = 0x8000U;
+// RAM the firmware used to mirror the minute history in
+static constexpr auto LEGACY_MIRROR_SIZE = 2048U * LEGACY_ENTRY_SIZE;
+static constexpr auto RING_QUERY_COUNT = 20U;
+static constexpr auto BENCHMARK_DURATION = std::chrono::seconds(1);
+static constexpr auto DAY_SECONDS = 24 * 3600;
+
+// One data point per line as "<timestamp> <volume ml>", the running total
+// is summed up from the volumes. Lines starting with # are skipped.
+static bool readMinuteTrace(const char* tracePath, std::vector<MinuteBlock::DataPoint>& points)
+{
+    std::ifstream file(tracePath);
+    if (!file) {
+        return false;
+    }
+
+    std::uint32_t totalMl = 0;
+    std::string line;
+
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::uint32_t timestamp = 0, volumeMl = 0;
+        if (!(fields >> timestamp >> volumeMl)) {
+            return false;
+        }
+
+        totalMl += volumeMl;
+        points.push_back({ timestamp, totalMl, volumeMl });
+    }
+
+    return !points.empty();
+}
+
+// Fills blocks the same way the history service does: a point that does
+// not fit seals the block and starts the next one
+static void encodeMinuteTrace(const std::vector<MinuteBlock::DataPoint>& points, std::vector<MinuteBlock>& blocks)
+{
+    MinuteBlock::Writer writer;
+    blocks.clear();
+
+    for (const auto& point : points) {
+        if (blocks.empty() || !writer.append(point)) {
+            if (!blocks.empty()) {
+                blocks.back().seal(0);
+            }
+
+            blocks.emplace_back();
+            writer.open(blocks.back(), 0);
+            writer.append(point);
+        }
+    }
+
+    blocks.back().seal(0);
+}
+
+bool runMinuteBlockBenchmark(const char* tracePath)
+{
+    std::vector<MinuteBlock::DataPoint> points;
+    if (!readMinuteTrace(tracePath, points)) {
+        return false;
+    }
+
+    std::vector<MinuteBlock> blocks;
+    std::uint32_t encodePasses = 0;
+    Clock::duration encodeTime {};
+
+    while (encodeTime < BENCHMARK_DURATION) {
+        auto start = Clock::now();
+        encodeMinuteTrace(points, blocks);
+        encodeTime += Clock::now() - start;
+        ++encodePasses;
+    }
+
+    std::size_t mismatches = 0;
+    std::uint32_t decodePasses = 0;
+    Clock::duration decodeTime {};
+
+    while (decodeTime < BENCHMARK_DURATION) {
+        std::size_t index = 0;
+        MinuteBlock::DataPoint point {};
+
+        auto start = Clock::now();
+        for (const auto& block : blocks) {
+            MinuteBlock::Reader reader(block);
+            while (reader.next(point)) {
+                if (index >= points.size() || point.timestamp != points[index].timestamp
+                    || point.totalMl != points[index].totalMl) {
+                    ++mismatches;
+                }
+                ++index;
+            }
+        }
+        mismatches += points.size() - std::min(index, points.size());
+        decodeTime += Clock::now() - start;
+        ++decodePasses;
+    }
+
+    std::size_t payloadBytes = 0;
+    for (const auto& block : blocks) {
+        payloadBytes += block.header.length;
+    }
+
+    auto encodeTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(encodeTime).count();
+    auto decodeTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(decodeTime).count();
+    auto pageBytes = blocks.size() * sizeof(MinuteBlock);
+    auto legacyBytes = points.size() * LEGACY_ENTRY_SIZE;
+    auto traceSeconds = points.back().timestamp - points.front().timestamp + 60;
+    auto secondsPerBlock = static_cast<double>(traceSeconds) / blocks.size();
+
+    std::printf("%s: %zu data points in %zu blocks, %u encode and %u decode passes\n",
+        tracePath, points.size(), blocks.size(), encodePasses, decodePasses);
+    std::printf("  encode %.2f M points/s, decode %.2f M points/s (%.1f MB/s of pages)\n",
+        static_cast<double>(points.size()) * encodePasses / encodeTimeUs,
+        static_cast<double>(points.size()) * decodePasses / decodeTimeUs,
+        static_cast<double>(pageBytes) * decodePasses / decodeTimeUs);
+    std::printf("  %.2f payload bytes and %.2f page bytes per point, %.1fx smaller than %u byte entries\n",
+        static_cast<double>(payloadBytes) / points.size(),
+        static_cast<double>(pageBytes) / points.size(),
+        static_cast<double>(legacyBytes) / pageBytes, LEGACY_ENTRY_SIZE);
+    std::printf("  %u blocks hold %.1f days of this trace\n",
+        RING_BLOCK_COUNT, secondsPerBlock * RING_BLOCK_COUNT / DAY_SECONDS);
+
+    if (mismatches) {
+        std::printf("  %zu decoded data points differ from the trace\n", mismatches / decodePasses);
+    }
+
+    return true;
+}
+
+bool runMinuteRingBenchmark(const char* tracePath)
+{
+    std::vector<MinuteBlock::DataPoint> points;
+    if (!readMinuteTrace(tracePath, points)) {
+        return false;
+    }
+
+    std::vector<MinuteBlock> blocks;
+    encodeMinuteTrace(points, blocks);
+
+    // The ring keeps the newest blocks, written in ring order like the
+    // history service does. Without a ring header they are generation 0.
+    auto firstBlock = blocks.size() > RING_BLOCK_COUNT ? blocks.size() - RING_BLOCK_COUNT : 0;
+
+    // The trace ends now, so its last day is today
+    setRtcTimestamp(points.back().timestamp + 60);
+
+    Device::get().getEepromDriver()->initialize();
+    Device::get().getEepromQueue().initialize();
+
+    for (auto i = firstBlock; i < blocks.size(); ++i) {
+        auto address = RING_ADDR + (i - firstBlock) * sizeof(MinuteBlock);
+        if (!Device::get().getEepromQueue().writeSync(address, &blocks[i], sizeof(MinuteBlock))) {
+            return false;
+        }
+    }
+
+    Device::get().getFlashDriver()->initialize();
+    Device::get().getFlashStore()->initialize();
+    Device::get().setLocalTimezone("London");
+
+    auto history = Device::get().getHistoryService();
+
+    auto start = Clock::now();
+    history->initialize();
+    auto bootTime = Clock::now() - start;
+
+    std::size_t todayPoints = 0;
+    std::uint32_t eepromTimeMs = 0;
+    Clock::duration queryTime {};
+
+    for (std::uint32_t i = 0; i < RING_QUERY_COUNT; ++i) {
+        todayPoints = 0;
+
+        start = Clock::now();
+        history->forEachNewestHistoryEntry([&todayPoints](std::size_t, const MinuteBlock::DataPoint&) {
+            ++todayPoints;
+        });
+        queryTime += Clock::now() - start;
+        eepromTimeMs += history->getLastQueryTimeMs();
+    }
+
+    auto stats = history->getEepromHistoryStats();
+
+    // A clear only writes the ring header, the query finds nothing after it
+    resetEepromStats();
+    start = Clock::now();
+    history->clearEepromHistory();
+    auto clearTime = Clock::now() - start;
+    auto clearWrites = getEepromStats().writeTransactions;
+
+    std::size_t clearedPoints = 0;
+    history->forEachNewestHistoryEntry([&clearedPoints](std::size_t, const MinuteBlock::DataPoint&) {
+        ++clearedPoints;
+    });
+
+    auto toMs = [](Clock::duration time) {
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(time).count()) / 1000;
+    };
+
+    std::printf("%s: %u data points in %u of %u ring blocks, %.1f days\n",
+        tracePath, stats.dataPoints, stats.usedBlocks, RING_BLOCK_COUNT,
+        static_cast<double>(points.back().timestamp - stats.oldestTimestamp) / DAY_SECONDS);
+    std::printf("  RAM: history service %zu bytes, the %u byte mirror of older firmware held %u data points\n",
+        sizeof(HistoryService), LEGACY_MIRROR_SIZE, LEGACY_MIRROR_SIZE / LEGACY_ENTRY_SIZE);
+    std::printf("  boot %.1f ms, today query %.1f ms for %zu data points (%.1f ms reading the EEPROM)\n",
+        toMs(bootTime), toMs(queryTime) / RING_QUERY_COUNT, todayPoints,
+        static_cast<double>(eepromTimeMs) / RING_QUERY_COUNT);
+    std::printf("  clear %.1f ms in %u EEPROM writes, %zu data points left\n",
+        toMs(clearTime), clearWrites, clearedPoints);
+
+    return true;
+}
+
+};
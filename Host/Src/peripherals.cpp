@@ -0,0 +1,88 @@
+#include <host.hpp>
+
+#include <crc.h>
+#include <i2c.h>
+#include <quadspi.h>
+#include <rtc.h>
+#include <spi.h>
+#include <tim.h>
+#include <usart.h>
+
+// Peripheral handles normally defined by the CubeMX sources in Core/Src
+
+CRC_HandleTypeDef hcrc;
+I2C_HandleTypeDef hi2c1;
+I2C_HandleTypeDef hi2c2;
+QSPI_HandleTypeDef hqspi;
+RTC_HandleTypeDef hrtc;
+SPI_HandleTypeDef hspi1;
+TIM_HandleTypeDef htim1;
+TIM_HandleTypeDef htim3;
+TIM_HandleTypeDef htim7;
+UART_HandleTypeDef huart1;
+DMA_HandleTypeDef hdma_usart1_rx;
+DMA_HandleTypeDef hdma_usart1_tx;
+
+DBGMCU_TypeDef hostDbgmcu;
+
+namespace lg::host {
+
+static CRC_TypeDef s_crc;
+static I2C_TypeDef s_i2c1;
+static I2C_TypeDef s_i2c2;
+static QUADSPI_TypeDef s_quadspi;
+static SPI_TypeDef s_spi1;
+static TIM_TypeDef s_tim1;
+static TIM_TypeDef s_tim3;
+static TIM_TypeDef s_tim7;
+static USART_TypeDef s_usart1;
+static DMA_Stream_TypeDef s_usart1RxStream;
+static DMA_Stream_TypeDef s_usart1TxStream;
+
+static void initializeTimer(TIM_HandleTypeDef& htim, TIM_TypeDef* instance,
+    std::uint32_t prescaler, std::uint32_t period)
+{
+    htim.Instance = instance;
+    htim.Init.Prescaler = prescaler;
+    htim.Init.Period = period;
+    instance->PSC = prescaler;
+    instance->ARR = period;
+}
+
+void initializePeripherals()
+{
+    // Mirrors the MX_*_Init() configuration from Core/Src
+
+    hcrc.Instance = &s_crc;
+
+    hi2c1.Instance = &s_i2c1;
+    hi2c1.State = HAL_I2C_STATE_READY;
+    hi2c2.Instance = &s_i2c2;
+    hi2c2.State = HAL_I2C_STATE_READY;
+
+    hqspi.Instance = &s_quadspi;
+    hqspi.State = HAL_QSPI_STATE_READY;
+    initializeQspiFlash();
+
+    hspi1.Instance = &s_spi1;
+    hspi1.State = HAL_SPI_STATE_READY;
+
+    initializeTimer(htim1, &s_tim1, 0, 65535);
+    initializeTimer(htim3, &s_tim3, 0, 899);
+    initializeTimer(htim7, &s_tim7, 65535, 65535);
+
+    hdma_usart1_rx.Instance = &s_usart1RxStream;
+    hdma_usart1_rx.State = HAL_DMA_STATE_READY;
+    hdma_usart1_rx.Parent = &huart1;
+    hdma_usart1_tx.Instance = &s_usart1TxStream;
+    hdma_usart1_tx.State = HAL_DMA_STATE_READY;
+    hdma_usart1_tx.Parent = &huart1;
+
+    huart1.Instance = &s_usart1;
+    huart1.hdmarx = &hdma_usart1_rx;
+    huart1.hdmatx = &hdma_usart1_tx;
+    huart1.gState = HAL_UART_STATE_READY;
+    huart1.RxState = HAL_UART_STATE_READY;
+}
+
+};
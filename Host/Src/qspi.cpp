@@ -0,0 +1,479 @@
+#include <host.hpp>
+
+#include <drivers/flash.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" void QUADSPI_IRQHandler(void);
+
+uint8_t* hostQspiMemory {};
+
+namespace lg::host {
+
+using Clock = std::chrono::steady_clock;
+
+// W25Q64JV command set, see the constants in Firmware/Src/drivers/flash.cpp
+static constexpr std::uint8_t WRITE_STATUS_REG_CMD = 0x01;
+static constexpr std::uint8_t PAGE_PROG_CMD = 0x02;
+static constexpr std::uint8_t READ_CMD = 0x03;
+static constexpr std::uint8_t READ_STATUS_REG_CMD = 0x05;
+static constexpr std::uint8_t WRITE_ENABLE_CMD = 0x06;
+static constexpr std::uint8_t FAST_READ_CMD = 0x0B;
+static constexpr std::uint8_t WRITE_STATUS_REG3_CMD = 0x11;
+static constexpr std::uint8_t READ_STATUS_REG3_CMD = 0x15;
+static constexpr std::uint8_t SECTOR_ERASE_CMD = 0x20;
+static constexpr std::uint8_t WRITE_STATUS_REG2_CMD = 0x31;
+static constexpr std::uint8_t QUAD_IN_FAST_PROG_CMD = 0x32;
+static constexpr std::uint8_t READ_STATUS_REG2_CMD = 0x35;
+static constexpr std::uint8_t VOLATILE_SR_WRITE_ENABLE = 0x50;
+static constexpr std::uint8_t RESET_ENABLE_CMD = 0x66;
+static constexpr std::uint8_t QUAD_OUT_FAST_READ_CMD = 0x6B;
+static constexpr std::uint8_t RESET_EXECUTE_CMD = 0x99;
+static constexpr std::uint8_t CHIP_ERASE_CMD = 0xC7;
+static constexpr std::uint8_t BLOCK_ERASE_CMD = 0xD8;
+static constexpr std::uint8_t QUAD_IN_OUT_FAST_READ_CMD = 0xEB;
+
+static constexpr std::uint8_t SR1_BUSY = 0x01;
+static constexpr std::uint8_t SR1_WEL = 0x02;
+
+static constexpr std::uint32_t BLOCK_SIZE = 65536;
+
+static constexpr auto STATUS_POLL_INTERVAL = std::chrono::microseconds(50);
+
+struct FlashState {
+    std::uint8_t statusReg1;
+    std::uint8_t statusReg2;
+    std::uint8_t statusReg3;
+    bool resetEnabled;
+    bool volatileWriteEnabled;
+    bool memoryMapped;
+    Clock::time_point busyUntil;
+    QSPI_CommandTypeDef pendingCommand;
+
+    // Interrupt-driven auto-polling in progress
+    bool autoPolling;
+    bool statusMatched;
+    std::uint8_t pollInstruction;
+    QSPI_AutoPollingTypeDef pollConfig;
+};
+
+static constexpr std::uint32_t FLASH_SIZE = FlashDriver::FLASH_SIZE;
+
+// The flash contents live in a file mapped twice: the emulator view is
+// always writable, the firmware view at QSPI_BASE is only readable in
+// memory-mapped mode, so a read during a write session faults like on
+// the target
+static std::uint8_t* s_flash {};
+static std::uint8_t* s_firmwareView {};
+static int s_flashFd = -1;
+static FlashState s_state {};
+static FlashStats s_flashStats {};
+
+// Typical timings from the datasheet
+static FlashTimings s_timings {
+    .pageProgram = std::chrono::microseconds(400),
+    .sectorErase = std::chrono::milliseconds(45),
+    .blockErase = std::chrono::milliseconds(150),
+    .chipErase = std::chrono::seconds(10),
+};
+
+static bool isBusy()
+{
+    return Clock::now() < s_state.busyUntil;
+}
+
+static std::uint8_t readStatus(std::uint8_t instruction)
+{
+    switch (instruction) {
+    case READ_STATUS_REG_CMD:
+        return (s_state.statusReg1 & ~SR1_BUSY) | (isBusy() ? SR1_BUSY : 0);
+    case READ_STATUS_REG2_CMD:
+        return s_state.statusReg2;
+    case READ_STATUS_REG3_CMD:
+        return s_state.statusReg3;
+    default:
+        return 0xFF;
+    }
+}
+
+static void writeStatus(std::uint8_t instruction, std::uint8_t value)
+{
+    if (!s_state.volatileWriteEnabled && !(s_state.statusReg1 & SR1_WEL)) {
+        return;
+    }
+
+    switch (instruction) {
+    case WRITE_STATUS_REG_CMD:
+        s_state.statusReg1 = (s_state.statusReg1 & (SR1_BUSY | SR1_WEL)) | (value & ~(SR1_BUSY | SR1_WEL));
+        break;
+    case WRITE_STATUS_REG2_CMD:
+        s_state.statusReg2 = value;
+        break;
+    case WRITE_STATUS_REG3_CMD:
+        s_state.statusReg3 = value;
+        break;
+    }
+
+    s_state.volatileWriteEnabled = false;
+    s_state.statusReg1 &= ~SR1_WEL;
+}
+
+static bool consumeWriteEnable()
+{
+    if (isBusy() || !(s_state.statusReg1 & SR1_WEL)) {
+        return false;
+    }
+
+    s_state.statusReg1 &= ~SR1_WEL;
+    return true;
+}
+
+static void erase(std::uint32_t address, std::uint32_t size, Clock::duration time)
+{
+    address &= ~(size - 1);
+
+    if (address + size > FLASH_SIZE) {
+        return;
+    }
+
+    std::fill_n(s_flash + address, size, 0xFF);
+    s_state.busyUntil = Clock::now() + time;
+}
+
+static void program(std::uint32_t address, const std::uint8_t* data, std::uint32_t size)
+{
+    // Programming can only clear bits, the address wraps within the page
+    std::uint32_t pageStart = address & ~(FlashDriver::FLASH_PAGE_SIZE - 1);
+
+    if (pageStart >= FLASH_SIZE) {
+        return;
+    }
+
+    bool overwrite = false;
+
+    for (std::uint32_t i = 0; i < size; ++i) {
+        std::uint32_t offset = (address + i) & (FlashDriver::FLASH_PAGE_SIZE - 1);
+        auto& cell = s_flash[pageStart + offset];
+
+        overwrite |= (cell & data[i]) != data[i];
+        cell &= data[i];
+    }
+
+    if (overwrite) {
+        ++s_flashStats.overwriteAttempts;
+    }
+
+    ++s_flashStats.pagePrograms;
+    s_flashStats.bytesProgrammed += size;
+    s_state.busyUntil = Clock::now() + s_timings.pageProgram;
+}
+
+static void executeCommand(const QSPI_CommandTypeDef& cmd)
+{
+    auto instruction = static_cast<std::uint8_t>(cmd.Instruction);
+
+    if (instruction != RESET_EXECUTE_CMD) {
+        s_state.resetEnabled = false;
+    }
+
+    switch (instruction) {
+    case RESET_ENABLE_CMD:
+        s_state.resetEnabled = true;
+        break;
+    case RESET_EXECUTE_CMD:
+        if (s_state.resetEnabled) {
+            s_state.statusReg1 = 0;
+            s_state.statusReg2 = 0;
+            s_state.statusReg3 = 0x60;
+            s_state.volatileWriteEnabled = false;
+        }
+        s_state.resetEnabled = false;
+        break;
+    case WRITE_ENABLE_CMD:
+        if (!isBusy()) {
+            s_state.statusReg1 |= SR1_WEL;
+        }
+        break;
+    case VOLATILE_SR_WRITE_ENABLE:
+        s_state.volatileWriteEnabled = true;
+        break;
+    case SECTOR_ERASE_CMD:
+        if (consumeWriteEnable()) {
+            ++s_flashStats.sectorErases;
+            erase(cmd.Address, FlashDriver::FLASH_SECTOR_SIZE, s_timings.sectorErase);
+        }
+        break;
+    case BLOCK_ERASE_CMD:
+        if (consumeWriteEnable()) {
+            ++s_flashStats.blockErases;
+            erase(cmd.Address, BLOCK_SIZE, s_timings.blockErase);
+        }
+        break;
+    case CHIP_ERASE_CMD:
+        if (consumeWriteEnable()) {
+            erase(0, FLASH_SIZE, s_timings.chipErase);
+        }
+        break;
+    }
+}
+
+static void unmapFlash()
+{
+    if (s_flash) {
+        munmap(s_flash, FLASH_SIZE);
+        munmap(s_firmwareView, FLASH_SIZE);
+        close(s_flashFd);
+    }
+
+    s_flash = nullptr;
+    s_firmwareView = nullptr;
+    s_flashFd = -1;
+}
+
+static void setMemoryMapped(bool enabled)
+{
+    s_state.memoryMapped = enabled;
+    mprotect(s_firmwareView, FLASH_SIZE, enabled ? PROT_READ : PROT_NONE);
+}
+
+static bool mapFlash(int fd)
+{
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || ftruncate(fd, FLASH_SIZE) != 0) {
+        close(fd);
+        return false;
+    }
+
+    auto flash = mmap(nullptr, FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    auto firmwareView = mmap(nullptr, FLASH_SIZE, PROT_NONE, MAP_SHARED, fd, 0);
+
+    if (flash == MAP_FAILED || firmwareView == MAP_FAILED) {
+        if (flash != MAP_FAILED) {
+            munmap(flash, FLASH_SIZE);
+        }
+        if (firmwareView != MAP_FAILED) {
+            munmap(firmwareView, FLASH_SIZE);
+        }
+        close(fd);
+        return false;
+    }
+
+    unmapFlash();
+
+    s_flash = static_cast<std::uint8_t*>(flash);
+    s_firmwareView = static_cast<std::uint8_t*>(firmwareView);
+    s_flashFd = fd;
+    hostQspiMemory = s_firmwareView;
+
+    // A new or shorter image is padded with erased bytes
+    auto size = static_cast<std::uint32_t>(std::min<off_t>(info.st_size, FLASH_SIZE));
+    std::fill_n(s_flash + size, FLASH_SIZE - size, 0xFF);
+
+    setMemoryMapped(s_state.memoryMapped);
+    return true;
+}
+
+void initializeQspiFlash()
+{
+    mapFlash(memfd_create("qspi-flash", 0));
+}
+
+bool openFlashImage(const char* path)
+{
+    auto fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    return mapFlash(fd);
+}
+
+FlashStats getFlashStats()
+{
+    return s_flashStats;
+}
+
+void resetFlashStats()
+{
+    s_flashStats = {};
+}
+
+void setFlashTimings(const FlashTimings& timings)
+{
+    s_timings = timings;
+}
+
+void pollQspi()
+{
+    if (!s_state.autoPolling) {
+        return;
+    }
+
+    ++s_flashStats.statusPolls;
+
+    std::uint32_t status = readStatus(s_state.pollInstruction);
+    if ((status & s_state.pollConfig.Mask) != s_state.pollConfig.Match) {
+        return;
+    }
+
+    s_state.statusMatched = true;
+    runAsIrq(&QUADSPI_IRQHandler);
+}
+
+};
+
+using namespace lg;
+
+extern "C" HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef* hqspi, QSPI_CommandTypeDef* cmd, uint32_t)
+{
+    if (host::s_state.memoryMapped) {
+        return HAL_BUSY;
+    }
+
+    if (cmd->DataMode != QSPI_DATA_NONE) {
+        // The command completes with the following Transmit / Receive call
+        host::s_state.pendingCommand = *cmd;
+        hqspi->State = HAL_QSPI_STATE_BUSY;
+        return HAL_OK;
+    }
+
+    host::executeCommand(*cmd);
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef* hqspi, uint8_t* pData, uint32_t)
+{
+    if (hqspi->State != HAL_QSPI_STATE_BUSY) {
+        return HAL_ERROR;
+    }
+
+    auto& cmd = host::s_state.pendingCommand;
+    auto instruction = static_cast<std::uint8_t>(cmd.Instruction);
+    hqspi->State = HAL_QSPI_STATE_READY;
+
+    switch (instruction) {
+    case host::PAGE_PROG_CMD:
+    case host::QUAD_IN_FAST_PROG_CMD:
+        if (host::consumeWriteEnable()) {
+            host::program(cmd.Address, pData, cmd.NbData);
+        }
+        break;
+    case host::WRITE_STATUS_REG_CMD:
+    case host::WRITE_STATUS_REG2_CMD:
+    case host::WRITE_STATUS_REG3_CMD:
+        host::writeStatus(instruction, pData[0]);
+        break;
+    }
+
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef* hqspi, uint8_t* pData, uint32_t)
+{
+    if (hqspi->State != HAL_QSPI_STATE_BUSY) {
+        return HAL_ERROR;
+    }
+
+    auto& cmd = host::s_state.pendingCommand;
+    auto instruction = static_cast<std::uint8_t>(cmd.Instruction);
+    hqspi->State = HAL_QSPI_STATE_READY;
+
+    switch (instruction) {
+    case host::READ_CMD:
+    case host::FAST_READ_CMD:
+    case host::QUAD_OUT_FAST_READ_CMD:
+    case host::QUAD_IN_OUT_FAST_READ_CMD:
+        for (std::uint32_t i = 0; i < cmd.NbData; ++i) {
+            pData[i] = host::s_flash[(cmd.Address + i) % host::FLASH_SIZE];
+        }
+        break;
+    default:
+        for (std::uint32_t i = 0; i < cmd.NbData; ++i) {
+            pData[i] = host::readStatus(instruction);
+        }
+        break;
+    }
+
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_QSPI_AutoPolling(QSPI_HandleTypeDef*, QSPI_CommandTypeDef* cmd,
+    QSPI_AutoPollingTypeDef* cfg, uint32_t Timeout)
+{
+    if (host::s_state.memoryMapped) {
+        return HAL_BUSY;
+    }
+
+    auto instruction = static_cast<std::uint8_t>(cmd->Instruction);
+    auto deadline = host::Clock::now() + std::chrono::milliseconds(Timeout);
+
+    // Like the hardware, this keeps the CPU busy until the status matches
+    while (true) {
+        ++host::s_flashStats.statusPolls;
+
+        std::uint32_t status = host::readStatus(instruction);
+        if ((status & cfg->Mask) == cfg->Match) {
+            return HAL_OK;
+        }
+
+        if (Timeout != HAL_MAX_DELAY && host::Clock::now() > deadline) {
+            return HAL_TIMEOUT;
+        }
+
+        std::this_thread::sleep_for(host::STATUS_POLL_INTERVAL);
+    }
+}
+
+extern "C" HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef* hqspi, QSPI_CommandTypeDef*,
+    QSPI_MemoryMappedTypeDef*)
+{
+    host::setMemoryMapped(true);
+    hqspi->State = HAL_QSPI_STATE_BUSY_MEM_MAPPED;
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef* hqspi)
+{
+    host::setMemoryMapped(false);
+    host::s_state.autoPolling = false;
+    hqspi->State = HAL_QSPI_STATE_READY;
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef* hqspi, QSPI_CommandTypeDef* cmd,
+    QSPI_AutoPollingTypeDef* cfg)
+{
+    if (hqspi->State != HAL_QSPI_STATE_READY) {
+        return HAL_BUSY;
+    }
+
+    // The status is polled by the host IRQ task, completion is reported
+    // through QUADSPI_IRQHandler like on the target
+    host::s_state.pollInstruction = static_cast<std::uint8_t>(cmd->Instruction);
+    host::s_state.pollConfig = *cfg;
+    host::s_state.statusMatched = false;
+    host::s_state.autoPolling = true;
+    hqspi->State = HAL_QSPI_STATE_BUSY_AUTO_POLLING;
+    return HAL_OK;
+}
+
+extern "C" void HAL_QSPI_IRQHandler(QSPI_HandleTypeDef* hqspi)
+{
+    if (!host::s_state.autoPolling || !host::s_state.statusMatched) {
+        return;
+    }
+
+    // Automatic stop ends the polling on the first match
+    host::s_state.autoPolling = false;
+    host::s_state.statusMatched = false;
+    hqspi->State = HAL_QSPI_STATE_READY;
+
+    HAL_QSPI_StatusMatchCallback(hqspi);
+}
@@ -0,0 +1,227 @@
+#include <host.hpp>
+
+#include <utc.hpp>
+
+#include <array>
+#include <chrono>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+extern "C" void RTC_Alarm_IRQHandler(void);
+
+namespace lg::host {
+
+using Clock = std::chrono::steady_clock;
+
+// Matches SynchPrediv from MX_RTC_Init()
+static constexpr std::uint32_t RTC_SECOND_FRACTION = 255;
+
+static std::uint32_t wallClockTimestamp()
+{
+    auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch).count();
+}
+
+// The RTC keeps running from the host wall clock, as if the backup domain
+// survived the reset. The firmware overrides it after the first NTP sync.
+static std::uint32_t s_baseTimestamp = wallClockTimestamp();
+static Clock::time_point s_baseTime = Clock::now();
+
+static std::array<std::uint32_t, 32> s_backupRegisters {};
+
+static RTC_AlarmTypeDef s_alarm {};
+static bool s_alarmEnabled = false;
+static std::uint32_t s_lastAlarmTimestamp = 0;
+
+static std::uint8_t toBcd(std::uint8_t value)
+{
+    return static_cast<std::uint8_t>(((value / 10) << 4) | (value % 10));
+}
+
+static std::uint8_t fromBcd(std::uint8_t value)
+{
+    return static_cast<std::uint8_t>((value >> 4) * 10 + (value & 0x0F));
+}
+
+static std::uint32_t getTimestamp(std::uint32_t* subSeconds)
+{
+    taskENTER_CRITICAL();
+    auto elapsed = Clock::now() - s_baseTime;
+    auto timestamp = s_baseTimestamp;
+    taskEXIT_CRITICAL();
+
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(elapsed);
+
+    if (subSeconds) {
+        auto fraction = std::chrono::duration_cast<std::chrono::microseconds>(elapsed - seconds);
+        *subSeconds = RTC_SECOND_FRACTION
+            - static_cast<std::uint32_t>(fraction.count() * (RTC_SECOND_FRACTION + 1) / 1000000);
+    }
+
+    return timestamp + static_cast<std::uint32_t>(seconds.count());
+}
+
+void setRtcTimestamp(std::uint32_t timestamp)
+{
+    taskENTER_CRITICAL();
+    s_baseTimestamp = timestamp;
+    s_baseTime = Clock::now();
+    taskEXIT_CRITICAL();
+}
+
+std::uint32_t getRtcTimestamp()
+{
+    return getTimestamp(nullptr);
+}
+
+void pollRtcAlarm()
+{
+    if (!s_alarmEnabled) {
+        return;
+    }
+
+    auto timestamp = getRtcTimestamp();
+    if (timestamp == s_lastAlarmTimestamp) {
+        return;
+    }
+
+    UtcTime now(timestamp);
+    auto mask = s_alarm.AlarmMask;
+    auto& time = s_alarm.AlarmTime;
+
+    if (!(mask & RTC_ALARMMASK_SECONDS) && now.getSecond() != time.Seconds) {
+        return;
+    }
+
+    if (!(mask & RTC_ALARMMASK_MINUTES) && now.getMinute() != time.Minutes) {
+        return;
+    }
+
+    if (!(mask & RTC_ALARMMASK_HOURS) && now.getHour() != time.Hours) {
+        return;
+    }
+
+    if (!(mask & RTC_ALARMMASK_DATEWEEKDAY) && now.getDay() != s_alarm.AlarmDateWeekDay) {
+        return;
+    }
+
+    s_lastAlarmTimestamp = timestamp;
+    runAsIrq(&RTC_Alarm_IRQHandler);
+}
+
+};
+
+using namespace lg;
+
+extern "C" HAL_StatusTypeDef HAL_RTC_GetTime(RTC_HandleTypeDef*, RTC_TimeTypeDef* sTime, uint32_t Format)
+{
+    RTC_DateTypeDef date {};
+    std::uint32_t subSeconds = 0;
+
+    UtcTime(host::getTimestamp(&subSeconds)).toHAL(date, *sTime);
+    sTime->TimeFormat = 0;
+    sTime->SubSeconds = subSeconds;
+    sTime->SecondFraction = host::RTC_SECOND_FRACTION;
+
+    if (Format == RTC_FORMAT_BCD) {
+        sTime->Hours = host::toBcd(sTime->Hours);
+        sTime->Minutes = host::toBcd(sTime->Minutes);
+        sTime->Seconds = host::toBcd(sTime->Seconds);
+    }
+
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_RTC_GetDate(RTC_HandleTypeDef*, RTC_DateTypeDef* sDate, uint32_t Format)
+{
+    RTC_TimeTypeDef time {};
+
+    UtcTime(host::getRtcTimestamp()).toHAL(*sDate, time);
+
+    if (Format == RTC_FORMAT_BCD) {
+        sDate->Date = host::toBcd(sDate->Date);
+        sDate->Month = host::toBcd(sDate->Month);
+        sDate->Year = host::toBcd(sDate->Year);
+    }
+
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_RTC_SetTime(RTC_HandleTypeDef*, RTC_TimeTypeDef* sTime, uint32_t Format)
+{
+    RTC_DateTypeDef date {};
+    RTC_TimeTypeDef time {};
+
+    UtcTime(host::getRtcTimestamp()).toHAL(date, time);
+
+    time.Hours = sTime->Hours;
+    time.Minutes = sTime->Minutes;
+    time.Seconds = sTime->Seconds;
+
+    if (Format == RTC_FORMAT_BCD) {
+        time.Hours = host::fromBcd(time.Hours);
+        time.Minutes = host::fromBcd(time.Minutes);
+        time.Seconds = host::fromBcd(time.Seconds);
+    }
+
+    host::setRtcTimestamp(UtcTime::fromHAL(date, time).toTimestamp());
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_RTC_SetDate(RTC_HandleTypeDef*, RTC_DateTypeDef* sDate, uint32_t Format)
+{
+    RTC_DateTypeDef date {};
+    RTC_TimeTypeDef time {};
+
+    UtcTime(host::getRtcTimestamp()).toHAL(date, time);
+
+    date.Date = sDate->Date;
+    date.Month = sDate->Month;
+    date.Year = sDate->Year;
+
+    if (Format == RTC_FORMAT_BCD) {
+        date.Date = host::fromBcd(date.Date);
+        date.Month = host::fromBcd(date.Month);
+        date.Year = host::fromBcd(date.Year);
+    }
+
+    host::setRtcTimestamp(UtcTime::fromHAL(date, time).toTimestamp());
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_RTC_SetAlarm_IT(RTC_HandleTypeDef*, RTC_AlarmTypeDef* sAlarm, uint32_t Format)
+{
+    auto alarm = *sAlarm;
+
+    if (Format == RTC_FORMAT_BCD) {
+        alarm.AlarmTime.Hours = host::fromBcd(alarm.AlarmTime.Hours);
+        alarm.AlarmTime.Minutes = host::fromBcd(alarm.AlarmTime.Minutes);
+        alarm.AlarmTime.Seconds = host::fromBcd(alarm.AlarmTime.Seconds);
+        alarm.AlarmDateWeekDay = host::fromBcd(alarm.AlarmDateWeekDay);
+    }
+
+    host::s_alarm = alarm;
+    host::s_alarmEnabled = true;
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_RTCEx_SetSmoothCalib(RTC_HandleTypeDef*, uint32_t, uint32_t, uint32_t)
+{
+    return HAL_OK;
+}
+
+extern "C" void HAL_RTC_AlarmIRQHandler(RTC_HandleTypeDef*)
+{
+    // Alarm flags are not latched by the emulation, nothing to clear
+}
+
+extern "C" void HAL_RTCEx_BKUPWrite(RTC_HandleTypeDef*, uint32_t BackupRegister, uint32_t Data)
+{
+    lg::host::s_backupRegisters.at(BackupRegister) = Data;
+}
+
+extern "C" uint32_t HAL_RTCEx_BKUPRead(RTC_HandleTypeDef*, uint32_t BackupRegister)
+{
+    return lg::host::s_backupRegisters.at(BackupRegister);
+}
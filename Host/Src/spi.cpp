@@ -0,0 +1,28 @@
+#include <host.hpp>
+
+#include <algorithm>
+
+// The LoRa transceiver is not emulated, SPI reads return zeros
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef*, uint8_t*, uint16_t, uint32_t)
+{
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef*, uint8_t* pData, uint16_t Size, uint32_t)
+{
+    std::fill_n(pData, Size, 0);
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef*, uint8_t*, uint8_t* pRxData,
+    uint16_t Size, uint32_t)
+{
+    std::fill_n(pRxData, Size, 0);
+    return HAL_OK;
+}
+
+extern "C" HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef* hspi)
+{
+    return hspi->State;
+}
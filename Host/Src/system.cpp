@@ -0,0 +1,60 @@
+#include <host.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static const Clock::time_point s_startTime = Clock::now();
+
+extern "C" void HAL_Delay(uint32_t Delay)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(Delay));
+}
+
+extern "C" uint32_t HAL_GetTick(void)
+{
+    auto elapsed = Clock::now() - s_startTime;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+// Fixed, recognizable device UID
+extern "C" uint32_t HAL_GetUIDw0(void)
+{
+    return 0x484F5354;
+}
+
+extern "C" uint32_t HAL_GetUIDw1(void)
+{
+    return 0x00000001;
+}
+
+extern "C" uint32_t HAL_GetUIDw2(void)
+{
+    return 0x00000002;
+}
+
+extern "C" uint32_t HAL_RCC_GetSysClockFreq(void)
+{
+    return 216000000;
+}
+
+extern "C" void HAL_NVIC_SetPriority(IRQn_Type, uint32_t, uint32_t)
+{
+}
+
+extern "C" void HAL_NVIC_EnableIRQ(IRQn_Type)
+{
+}
+
+extern "C" void HAL_NVIC_DisableIRQ(IRQn_Type)
+{
+}
+
+extern "C" void vAssertCalled(const char* file, int line)
+{
+    std::fprintf(stderr, "FreeRTOS assertion failed at %s:%d\n", file, line);
+    std::abort();
+}
@@ -0,0 +1,137 @@
+#include <host.hpp>
+
+#include <tim.h>
+
+#include <array>
+#include <chrono>
+
+extern "C" void TIM7_IRQHandler(void);
+
+namespace lg::host {
+
+using Clock = std::chrono::steady_clock;
+
+struct TimerIrq {
+    TIM_HandleTypeDef* htim;
+    void (*handler)();
+    Clock::time_point lastUpdate;
+};
+
+// Timers whose update interrupt is serviced by the firmware
+static std::array<TimerIrq, 1> s_timerIrqs = { {
+    { &htim7, &TIM7_IRQHandler, {} },
+} };
+
+static Clock::duration updatePeriod(const TIM_TypeDef* tim)
+{
+    // APB timer clock runs at half of SYSCLK
+    auto timerClock = static_cast<std::uint64_t>(HAL_RCC_GetSysClockFreq() / 2);
+    auto ticks = static_cast<std::uint64_t>(tim->PSC + 1) * (tim->ARR + 1);
+
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::nanoseconds(ticks * 1000000000ULL / timerClock));
+}
+
+static TimerIrq* findTimerIrq(const TIM_HandleTypeDef* htim)
+{
+    for (auto& irq : s_timerIrqs) {
+        if (irq.htim == htim) {
+            return &irq;
+        }
+    }
+
+    return nullptr;
+}
+
+void addFlowImpulses(std::uint16_t count)
+{
+    auto tim = htim1.Instance;
+
+    if (tim->CR1 & TIM_CR1_CEN) {
+        tim->CNT = (tim->CNT + count) & 0xFFFF;
+    }
+}
+
+void pollTimers()
+{
+    auto now = Clock::now();
+
+    for (auto& irq : s_timerIrqs) {
+        auto tim = irq.htim->Instance;
+
+        if (!(tim->CR1 & TIM_CR1_CEN) || !(tim->DIER & TIM_DIER_UIE)) {
+            continue;
+        }
+
+        if (now - irq.lastUpdate < updatePeriod(tim)) {
+            continue;
+        }
+
+        // At most one update per poll, a late timer does not catch up
+        irq.lastUpdate = now;
+        tim->SR = tim->SR | TIM_FLAG_UPDATE;
+        runAsIrq(irq.handler);
+    }
+}
+
+};
+
+using namespace lg;
+
+static void startTimer(TIM_HandleTypeDef* htim, bool interrupt)
+{
+    htim->Instance->CR1 = htim->Instance->CR1 | TIM_CR1_CEN;
+
+    if (interrupt) {
+        htim->Instance->DIER = htim->Instance->DIER | TIM_DIER_UIE;
+    }
+
+    if (auto irq = host::findTimerIrq(htim)) {
+        irq->lastUpdate = host::Clock::now();
+    }
+}
+
+static void stopTimer(TIM_HandleTypeDef* htim)
+{
+    htim->Instance->CR1 = htim->Instance->CR1 & ~TIM_CR1_CEN;
+    htim->Instance->DIER = htim->Instance->DIER & ~TIM_DIER_UIE;
+}
+
+extern "C" HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim)
+{
+    startTimer(htim, false);
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef* htim)
+{
+    stopTimer(htim);
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef* htim)
+{
+    startTimer(htim, true);
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef* htim)
+{
+    stopTimer(htim);
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef*, uint32_t)
+{
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef*, uint32_t)
+{
+    return HAL_OK;
+}
+
+extern "C" void HAL_TIM_IRQHandler(TIM_HandleTypeDef* htim)
+{
+    htim->Instance->SR = htim->Instance->SR & ~TIM_FLAG_UPDATE;
+}
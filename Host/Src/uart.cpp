@@ -0,0 +1,182 @@
+#include <host.hpp>
+
+#include <device.hpp>
+
+#include <usart.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+namespace lg::host {
+
+using Clock = std::chrono::steady_clock;
+
+static UartTxHandler s_uartTxHandler;
+static UartStats s_uartStats {};
+// Set while the firmware has not answered the last received bytes yet
+static bool s_uartAwaitingTurnaround {};
+static Clock::time_point s_uartLastReceive {};
+
+static std::uint32_t s_espReportPeriodMs {};
+static std::array<configSTACK_DEPTH_TYPE, 1024> s_espReportTaskStack {};
+static StaticTask_t s_espReportTaskTcb {};
+
+static void raiseRxEvent(UART_HandleTypeDef& huart, std::uint16_t position)
+{
+    ++s_uartStats.rxEvents;
+    runAsIrq([&] { HAL_UARTEx_RxEventCallback(&huart, position); });
+}
+
+void setUartTxHandler(UartTxHandler handler)
+{
+    s_uartTxHandler = std::move(handler);
+}
+
+void uartReceive(const std::uint8_t* data, std::size_t size)
+{
+    auto& huart = huart1;
+    auto stream = huart.hdmarx->Instance;
+
+    if (huart.RxState != HAL_UART_STATE_BUSY_RX) {
+        // Reception is not enabled yet, the bytes are lost
+        return;
+    }
+
+    // Circular DMA: NDTR counts down and reloads when it reaches zero
+    for (std::size_t i = 0; i < size; ++i) {
+        huart.pRxBuffPtr[huart.RxXferSize - stream->NDTR] = data[i];
+
+        stream->NDTR = stream->NDTR - 1;
+        if (stream->NDTR == 0) {
+            stream->NDTR = huart.RxXferSize;
+            raiseRxEvent(huart, huart.RxXferSize);
+        } else if (stream->NDTR == huart.RxXferSize / 2) {
+            raiseRxEvent(huart, huart.RxXferSize / 2);
+        }
+    }
+
+    if (size) {
+        raiseRxEvent(huart, huart.RxXferSize - stream->NDTR);
+
+        s_uartStats.bytesReceived += size;
+        s_uartAwaitingTurnaround = true;
+        s_uartLastReceive = Clock::now();
+    }
+}
+
+UartStats getUartStats()
+{
+    return s_uartStats;
+}
+
+void resetUartStats()
+{
+    s_uartStats = {};
+    s_uartAwaitingTurnaround = false;
+}
+
+static void espReportTaskMain(void*)
+{
+    while (true) {
+        vTaskDelay(s_espReportPeriodMs);
+
+        std::fprintf(stderr, "ESP UART: %u B in, %u B out, turnaround avg %u us max %u us\n",
+            s_uartStats.bytesReceived, s_uartStats.bytesSent,
+            s_uartStats.turnarounds ? static_cast<std::uint32_t>(s_uartStats.turnaroundTimeUs / s_uartStats.turnarounds) : 0,
+            s_uartStats.maxTurnaroundUs);
+
+        for (std::size_t i = 0; i < static_cast<std::size_t>(EspAtDriver::CommandClass::COMMAND_CLASS_COUNT); ++i) {
+            auto commandClass = static_cast<EspAtDriver::CommandClass>(i);
+            auto stats = Device::get().getEspAtDriver().getCommandStats(commandClass);
+
+            std::fprintf(stderr, "ESP %s commands: %u, wait avg %u ms max %u ms, %u timeouts, %u cancelled\n",
+                EspAtDriver::getCommandClassName(commandClass), stats.commands,
+                stats.commands ? stats.waitTimeMs / stats.commands : 0, stats.maxWaitTimeMs,
+                stats.timeouts, stats.cancelled);
+        }
+
+        if (isFakeModemStarted()) {
+            auto modem = getFakeModemStats();
+
+            std::fprintf(stderr, "ESP modem: %u commands, %u sends (%u B), %u errors, %u dropped, %u/%u connections\n",
+                modem.commands, modem.sends, modem.sendBytes, modem.injectedErrors, modem.droppedCommands,
+                modem.connections, modem.connections + modem.refusedConnections);
+        }
+    }
+}
+
+void startEspReport(std::uint32_t periodMs)
+{
+    s_espReportPeriodMs = periodMs;
+
+    xTaskCreateStatic(
+        &espReportTaskMain /* Task function */,
+        "Host ESP Report" /* Task name */,
+        s_espReportTaskStack.size() /* Stack size */,
+        nullptr /* Parameters */,
+        1 /* Priority */,
+        s_espReportTaskStack.data() /* Task stack address */,
+        &s_espReportTaskTcb /* Task control block */
+    );
+}
+
+};
+
+extern "C" HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart, const uint8_t* pData, uint16_t Size)
+{
+    using namespace lg::host;
+
+    if (huart->gState != HAL_UART_STATE_READY) {
+        return HAL_BUSY;
+    }
+
+    if (s_uartAwaitingTurnaround) {
+        auto turnaroundUs = static_cast<std::uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - s_uartLastReceive).count());
+
+        ++s_uartStats.turnarounds;
+        s_uartStats.turnaroundTimeUs += turnaroundUs;
+        s_uartStats.maxTurnaroundUs = std::max(s_uartStats.maxTurnaroundUs, turnaroundUs);
+        s_uartAwaitingTurnaround = false;
+    }
+
+    s_uartStats.bytesSent += Size;
+
+    // The transfer completes immediately, the peer sees the whole buffer at once
+    if (s_uartTxHandler) {
+        s_uartTxHandler(pData, Size);
+    }
+
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef* huart, uint8_t* pData, uint16_t Size)
+{
+    if (huart->RxState != HAL_UART_STATE_READY) {
+        return HAL_BUSY;
+    }
+
+    huart->pRxBuffPtr = pData;
+    huart->RxXferSize = Size;
+    huart->hdmarx->Instance->NDTR = Size;
+    huart->hdmarx->State = HAL_DMA_STATE_BUSY;
+    huart->RxState = HAL_UART_STATE_BUSY_RX;
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef* huart, uint8_t* pData, uint16_t Size)
+{
+    // Events are raised by uartReceive(), the transfer itself is the same
+    return HAL_UART_Receive_DMA(huart, pData, Size);
+}
+
+extern "C" HAL_DMA_StateTypeDef HAL_DMA_GetState(DMA_HandleTypeDef* hdma)
+{
+    return hdma->State;
+}